@@ -0,0 +1,42 @@
+#include "analysis.h"
+#include "module.h"
+#include "threadpool.h"
+
+SemanticErrorsException::SemanticErrorsException(
+		std::vector<std::exception_ptr> errors)
+		: errors(std::move(errors)) {
+	error = std::to_string(this->errors.size()) + " errors found:";
+	for (const auto &e : this->errors) {
+		try {
+			std::rethrow_exception(e);
+		} catch (const std::exception &ex) {
+			error += "\n\t";
+			error += ex.what();
+		}
+	}
+}
+
+std::vector<std::exception_ptr> AnalyzeModules(
+		const std::vector<Module *> &modules, ThreadPool *pool) {
+	std::vector<std::vector<std::exception_ptr>> found(modules.size());
+	TaskGroup group(pool);
+	for (size_t i = 0; i < modules.size(); i++) {
+		group.Run([&, i] { found[i] = modules[i]->Analyze(); });
+	}
+	group.Wait();
+
+	std::vector<std::exception_ptr> errors;
+	for (auto &moduleErrors : found) {
+		errors.insert(errors.end(), moduleErrors.begin(), moduleErrors.end());
+	}
+	return errors;
+}
+
+void ThrowErrors(std::vector<std::exception_ptr> errors) {
+	if (errors.size() == 1) {
+		std::rethrow_exception(errors.front());
+	}
+	if (!errors.empty()) {
+		throw SemanticErrorsException(std::move(errors));
+	}
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <exception>
+#include <string>
+#include <vector>
+
+class Module;
+class ThreadPool;
+
+//! Thrown by ThrowErrors when more than one error was found
+struct SemanticErrorsException : public std::exception {
+	std::string error;
+	std::vector<std::exception_ptr> errors;
+	explicit SemanticErrorsException(std::vector<std::exception_ptr> errors);
+	const char *what() const throw() {
+		return error.c_str();
+	}
+};
+
+/**
+ * Analyze every module, in parallel on pool, and return the errors found in
+ * the order of the modules
+ *
+ * Every module is checked, even after errors are found in others.
+ */
+std::vector<std::exception_ptr> AnalyzeModules(
+		const std::vector<Module *> &modules, ThreadPool *pool);
+
+/**
+ * Throw the errors, if there are any: a single error is rethrown as is, while
+ * several are thrown together as a SemanticErrorsException
+ */
+void ThrowErrors(std::vector<std::exception_ptr> errors);
@@ -0,0 +1,102 @@
+#include "batch.h"
+#include "frontend.h"
+#include "modulelibrary.h"
+#include "threadpool.h"
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+std::vector<batchItem> ReadManifest(const std::string &fileName,
+																		const std::string &outputDirectory) {
+	std::ifstream manifest(fileName);
+	if (!manifest.good()) {
+		throw std::runtime_error("Cannot read manifest '" + fileName + "'");
+	}
+	std::filesystem::path base = std::filesystem::path(fileName).parent_path();
+	std::vector<batchItem> items;
+	std::string line;
+	while (std::getline(manifest, line)) {
+		std::istringstream fields(line);
+		std::string input;
+		std::string output;
+		if (!(fields >> input) || input[0] == '#') {
+			continue;
+		}
+		input = (base / input).string();
+		if (fields >> output) {
+			output = (base / output).string();
+		} else {
+			output = BatchOutputName(input, outputDirectory);
+		}
+		items.push_back({input, output});
+	}
+	return items;
+}
+
+std::string BatchOutputName(const std::string &input,
+														const std::string &outputDirectory) {
+	std::filesystem::path output(input);
+	output.replace_extension(".crn");
+	if (!outputDirectory.empty()) {
+		output = std::filesystem::path(outputDirectory) / output.filename();
+	}
+	return output.string();
+}
+
+size_t CompileBatch(const std::vector<batchItem> &items, unsigned jobs,
+										std::ostream &diagnostics, unsigned passes) {
+	ModuleLibrary library;
+	std::string workingDirectory = std::filesystem::current_path().string();
+	std::vector<std::string> errors(items.size());
+	std::vector<std::string> reports(items.size());
+	std::unique_ptr<ThreadPool> pool;
+	if (jobs > 1) {
+		pool = std::make_unique<ThreadPool>(jobs);
+	}
+	TaskGroup group(pool.get());
+	for (size_t i = 0; i < items.size(); i++) {
+		group.Run([&, i] {
+			const batchItem &item = items[i];
+			std::ifstream file(item.input);
+			if (!file.good()) {
+				errors[i] = "No file for parsing or file not found\n";
+				return;
+			}
+			std::stringstream source;
+			source << file.rdbuf();
+			compileRequest request;
+			request.source = source.str();
+			request.path = std::filesystem::canonical(item.input).string();
+			request.workingDirectory = workingDirectory;
+			request.passes = passes;
+			compileResult result = library.Compile(request);
+			if (!result.ok) {
+				errors[i] = result.output;
+				return;
+			}
+			try {
+				Frontend frontend;
+				frontend.verbose = false;
+				frontend.outputFileName = item.output;
+				frontend.WriteNetwork(result.output);
+				reports[i] = result.report;
+			} catch (const std::exception &e) {
+				errors[i] = std::string(e.what()) + "\n";
+			}
+		});
+	}
+	group.Wait();
+
+	size_t failed = 0;
+	for (size_t i = 0; i < items.size(); i++) {
+		if (!errors[i].empty()) {
+			diagnostics << items[i].input << ":\n" << errors[i];
+			failed++;
+		} else if (!reports[i].empty()) {
+			diagnostics << items[i].input << ":\n" << reports[i];
+		}
+	}
+	return failed;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <ostream>
+#include <string>
+#include <vector>
+
+//! An input file of a batch, and where its network is written
+struct batchItem {
+	std::string input;
+	std::string output;
+};
+
+/**
+ * Read a manifest of inputs
+ *
+ * Every line names an input file, optionally followed by its output file.
+ * Empty lines and lines starting with # are skipped. Relative paths are
+ * relative to the directory of the manifest. Inputs without an output get one
+ * from BatchOutputName.
+ */
+std::vector<batchItem> ReadManifest(const std::string &fileName,
+																		const std::string &outputDirectory = "");
+/**
+ * The output for input: the input with a .crn extension, placed in
+ * outputDirectory if it is not empty
+ */
+std::string BatchOutputName(const std::string &input,
+														const std::string &outputDirectory);
+
+/**
+ * Compile every item of a batch, on jobs threads, running the optimization
+ * passes on each
+ *
+ * The imports of all inputs are parsed and flattened once, in a ModuleLibrary
+ * shared by all of them. The errors of every failed item, and the optimization
+ * reports of the others, are written to diagnostics in the order of the items.
+ * Returns the number of failed items.
+ */
+size_t CompileBatch(const std::vector<batchItem> &items, unsigned jobs,
+										std::ostream &diagnostics, unsigned passes = 0);
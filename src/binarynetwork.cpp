@@ -0,0 +1,313 @@
+#include "binarynetwork.h"
+#include "crnwriter.h"
+#include "module.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <limits>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+//! One side of every reaction, in compressed sparse row form
+struct sparseSide {
+	std::vector<std::uint32_t> offsets{0};
+	std::vector<std::uint32_t> species;
+	std::vector<std::int32_t> coefficients;
+};
+
+template <class T> void WriteArray(CrnWriter &out, const std::vector<T> &v) {
+	out.Write(std::string_view(reinterpret_cast<const char *>(v.data()),
+														 v.size() * sizeof(T)));
+}
+
+//! Take the next count elements of type T from the file
+template <class T>
+const T *Take(const char *data, size_t size, std::uint64_t &offset,
+							std::uint64_t count) {
+	if (count > (size - offset) / sizeof(T)) {
+		throw BadNetworkFileException("the file is truncated");
+	}
+	const T *res = reinterpret_cast<const T *>(data + offset);
+	offset += count * sizeof(T);
+	return res;
+}
+
+void CheckOffsets(const std::uint32_t *offsets, std::uint32_t rows,
+									std::uint32_t entries) {
+	if (offsets[0] != 0 || offsets[rows] != entries) {
+		throw BadNetworkFileException("the offsets do not cover the entries");
+	}
+	for (std::uint32_t i = 0; i < rows; i++) {
+		if (offsets[i] > offsets[i + 1]) {
+			throw BadNetworkFileException("the offsets are not ordered");
+		}
+	}
+}
+
+void CheckSpecies(const std::uint32_t *species, std::uint32_t count,
+									std::uint32_t speciesCount) {
+	for (std::uint32_t i = 0; i < count; i++) {
+		if (species[i] >= speciesCount) {
+			throw BadNetworkFileException("a specie number is out of range");
+		}
+	}
+}
+} // namespace
+
+std::uint32_t CheckedCount(std::uint64_t count, const std::string &format) {
+	if (count > std::numeric_limits<std::uint32_t>::max()) {
+		throw WriteFailedException("the network is too large for the " + format +
+															 " format");
+	}
+	return static_cast<std::uint32_t>(count);
+}
+
+std::vector<specie> SpeciesByName(const Module &module) {
+	std::vector<specie> species;
+	std::unordered_set<specie> seen;
+	auto see = [&](const specie &s) {
+		if (seen.insert(s).second) {
+			species.push_back(s);
+		}
+	};
+	for (const auto &s : module.outputSpecies) {
+		see(s);
+	}
+	for (const auto &c : module.concentrations) {
+		see(c.first);
+	}
+	for (const auto &r : module.reactions) {
+		for (const auto &ratio : r.reactants) {
+			see(ratio.first);
+		}
+		for (const auto &ratio : r.products) {
+			see(ratio.first);
+		}
+	}
+	// Numbered by name, so everything ordered by number is ordered as in text
+	std::sort(species.begin(), species.end(),
+						[](const specie &a, const specie &b) { return a.Name() < b.Name(); });
+	return species;
+}
+
+void WriteBinaryNetwork(const Module &module, CrnWriter &out) {
+	std::vector<specie> species = SpeciesByName(module);
+	std::unordered_map<specie, std::uint32_t> number;
+	for (size_t i = 0; i < species.size(); i++) {
+		number.emplace(species[i], static_cast<std::uint32_t>(i));
+	}
+
+	std::vector<double> rates;
+	rates.reserve(module.reactions.size());
+	sparseSide reactants;
+	sparseSide products;
+	std::vector<std::pair<std::uint32_t, std::int32_t>> side;
+	auto addSide = [&](const speciesRatios &ratios, sparseSide &to) {
+		side.clear();
+		for (const auto &ratio : ratios) {
+			side.emplace_back(number.at(ratio.first), ratio.second);
+		}
+		std::sort(side.begin(), side.end());
+		for (const auto &entry : side) {
+			to.species.push_back(entry.first);
+			to.coefficients.push_back(entry.second);
+		}
+		to.offsets.push_back(CheckedCount(to.species.size(), "binary"));
+	};
+	for (const auto &r : module.reactions) {
+		rates.push_back(r.rate);
+		addSide(r.reactants, reactants);
+		addSide(r.products, products);
+	}
+
+	std::vector<std::uint32_t> outputs;
+	for (const auto &s : module.outputSpecies) {
+		outputs.push_back(number.at(s));
+	}
+	std::vector<std::pair<std::uint32_t, std::int32_t>> concs;
+	for (const auto &c : module.concentrations) {
+		concs.emplace_back(number.at(c.first), c.second);
+	}
+	std::sort(concs.begin(), concs.end());
+	std::vector<std::uint32_t> concentrationSpecies;
+	std::vector<std::int32_t> concentrations;
+	for (const auto &c : concs) {
+		concentrationSpecies.push_back(c.first);
+		concentrations.push_back(c.second);
+	}
+
+	std::vector<std::uint32_t> nameOffsets{0};
+	std::string names;
+	for (const auto &s : species) {
+		names += s.Name();
+		names += '\0';
+		nameOffsets.push_back(CheckedCount(names.size(), "binary"));
+	}
+
+	binaryNetworkHeader header{};
+	header.magic = BINARY_NETWORK_MAGIC;
+	header.version = BINARY_NETWORK_VERSION;
+	header.speciesCount = CheckedCount(species.size(), "binary");
+	header.reactionCount = CheckedCount(rates.size(), "binary");
+	header.reactantCount = CheckedCount(reactants.species.size(), "binary");
+	header.productCount = CheckedCount(products.species.size(), "binary");
+	header.outputCount = CheckedCount(outputs.size(), "binary");
+	header.concentrationCount = CheckedCount(concentrations.size(), "binary");
+	header.nameBytes = names.size();
+	out.Write(
+			std::string_view(reinterpret_cast<const char *>(&header), sizeof header));
+	WriteArray(out, rates);
+	for (const sparseSide *s : {&reactants, &products}) {
+		WriteArray(out, s->offsets);
+		WriteArray(out, s->species);
+		WriteArray(out, s->coefficients);
+	}
+	WriteArray(out, outputs);
+	WriteArray(out, concentrationSpecies);
+	WriteArray(out, concentrations);
+	WriteArray(out, nameOffsets);
+	out.Write(names);
+}
+
+BinaryNetwork::BinaryNetwork(const std::string &path) {
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		throw BadNetworkFileException(path + ": " + std::strerror(errno));
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		throw BadNetworkFileException(path + ": the file is empty");
+	}
+	mappingSize = static_cast<size_t>(st.st_size);
+	mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		mapping = nullptr;
+		throw BadNetworkFileException(path + ": " + std::strerror(errno));
+	}
+	try {
+		Read(static_cast<const char *>(mapping), mappingSize);
+	} catch (...) {
+		munmap(mapping, mappingSize);
+		throw;
+	}
+}
+
+BinaryNetwork::BinaryNetwork(const char *data, size_t size) {
+	Read(data, size);
+}
+
+BinaryNetwork::~BinaryNetwork() {
+	if (mapping != nullptr) {
+		munmap(mapping, mappingSize);
+	}
+}
+
+void BinaryNetwork::Read(const char *data, size_t size) {
+	if (reinterpret_cast<std::uintptr_t>(data) % alignof(double) != 0) {
+		throw BadNetworkFileException("the data is not aligned");
+	}
+	std::uint64_t offset = 0;
+	header = Take<binaryNetworkHeader>(data, size, offset, 1);
+	if (header->magic != BINARY_NETWORK_MAGIC) {
+		throw BadNetworkFileException("wrong magic number or byte order");
+	}
+	if (header->version != BINARY_NETWORK_VERSION) {
+		throw BadNetworkFileException("unsupported version " +
+																	std::to_string(header->version));
+	}
+	const binaryNetworkHeader &h = *header;
+	rates = Take<double>(data, size, offset, h.reactionCount);
+	reactantOffsets =
+			Take<std::uint32_t>(data, size, offset, h.reactionCount + 1ull);
+	reactantSpecies = Take<std::uint32_t>(data, size, offset, h.reactantCount);
+	reactantCoefficients =
+			Take<std::int32_t>(data, size, offset, h.reactantCount);
+	productOffsets =
+			Take<std::uint32_t>(data, size, offset, h.reactionCount + 1ull);
+	productSpecies = Take<std::uint32_t>(data, size, offset, h.productCount);
+	productCoefficients = Take<std::int32_t>(data, size, offset, h.productCount);
+	outputs = Take<std::uint32_t>(data, size, offset, h.outputCount);
+	concentrationSpecies =
+			Take<std::uint32_t>(data, size, offset, h.concentrationCount);
+	concentrations = Take<std::int32_t>(data, size, offset, h.concentrationCount);
+	nameOffsets = Take<std::uint32_t>(data, size, offset, h.speciesCount + 1ull);
+	names = Take<char>(data, size, offset, h.nameBytes);
+	if (offset != size) {
+		throw BadNetworkFileException("unexpected data after the names");
+	}
+
+	CheckOffsets(reactantOffsets, h.reactionCount, h.reactantCount);
+	CheckOffsets(productOffsets, h.reactionCount, h.productCount);
+	CheckSpecies(reactantSpecies, h.reactantCount, h.speciesCount);
+	CheckSpecies(productSpecies, h.productCount, h.speciesCount);
+	CheckSpecies(outputs, h.outputCount, h.speciesCount);
+	CheckSpecies(concentrationSpecies, h.concentrationCount, h.speciesCount);
+	if (nameOffsets[0] != 0 || nameOffsets[h.speciesCount] != h.nameBytes) {
+		throw BadNetworkFileException("the name offsets do not cover the names");
+	}
+	for (std::uint32_t i = 0; i < h.speciesCount; i++) {
+		// Every name has at least its terminating zero
+		if (nameOffsets[i] >= nameOffsets[i + 1] ||
+				names[nameOffsets[i + 1] - 1] != '\0') {
+			throw BadNetworkFileException("a specie name is not terminated");
+		}
+	}
+}
+
+void BinaryNetwork::WriteText(CrnWriter &out) const {
+	out.Write(CRNSIMUL_COMMAND);
+	if (header->outputCount != 0) {
+		out.Write("-C ");
+		for (std::uint32_t i = 0; i < header->outputCount; i++) {
+			if (i != 0) {
+				out.Write(',');
+			}
+			out.Write(SpecieName(outputs[i]));
+		}
+	}
+	out.Write('\n');
+
+	for (std::uint32_t i = 0; i < header->concentrationCount; i++) {
+		out.Write(SpecieName(concentrationSpecies[i]));
+		out.Write(" := ");
+		out.WriteInt(concentrations[i]);
+		out.Write(";\n");
+	}
+
+	auto writeSide = [&](const std::uint32_t *offsets,
+											 const std::uint32_t *species,
+											 const std::int32_t *coefficients, std::uint32_t r) {
+		if (offsets[r] == offsets[r + 1]) {
+			out.Write('0');
+			return;
+		}
+		for (std::uint32_t i = offsets[r]; i < offsets[r + 1]; i++) {
+			if (i != offsets[r]) {
+				out.Write(" + ");
+			}
+			if (coefficients[i] != 1) {
+				out.WriteInt(coefficients[i]);
+			}
+			out.Write(SpecieName(species[i]));
+		}
+	};
+	for (std::uint32_t r = 0; r < header->reactionCount; r++) {
+		writeSide(reactantOffsets, reactantSpecies, reactantCoefficients, r);
+		if (rates[r] != 1) {
+			out.Write(" ->(");
+			out.WriteDouble(rates[r]);
+			out.Write(") ");
+		} else {
+			out.Write(" -> ");
+		}
+		writeSide(productOffsets, productSpecies, productCoefficients, r);
+		out.Write(";\n");
+	}
+}
@@ -0,0 +1,121 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class CrnWriter;
+class Module;
+struct specie;
+
+struct BadNetworkFileException : public std::exception {
+	std::string error;
+	BadNetworkFileException(std::string reason)
+			: error("Not a valid binary network: " + reason) {}
+	const char *what() const throw() {
+		return error.c_str();
+	}
+};
+
+/*! \brief The header at the start of a binary network file
+ * \detail The header is followed by these arrays, in native byte order and
+ * without padding, so every array is aligned for its element type:
+ *
+ * - `double rates[reactionCount]`
+ * - `uint32_t reactantOffsets[reactionCount + 1]`, then
+ *   `uint32_t reactantSpecies[reactantCount]` and
+ *   `int32_t reactantCoefficients[reactantCount]`. The reactants of reaction
+ *   r are at the indexes from reactantOffsets[r] up to reactantOffsets[r + 1].
+ * - The products, laid out in the same way with productCount entries
+ * - `uint32_t outputs[outputCount]`
+ * - `uint32_t concentrationSpecies[concentrationCount]`, then
+ *   `int32_t concentrations[concentrationCount]`
+ * - `uint32_t nameOffsets[speciesCount + 1]`, then the `nameBytes` bytes of
+ *   the names. Each name is terminated by a zero byte, which is included in
+ *   the range given by the offsets.
+ *
+ * Species are numbered in the order of their names, and both sides of a
+ * reaction and the concentrations are ordered by specie number.
+ */
+struct binaryNetworkHeader {
+	std::uint32_t magic;
+	std::uint32_t version;
+	std::uint32_t speciesCount;
+	std::uint32_t reactionCount;
+	std::uint32_t reactantCount;
+	std::uint32_t productCount;
+	std::uint32_t outputCount;
+	std::uint32_t concentrationCount;
+	std::uint64_t nameBytes;
+};
+
+//! "CRNB" when read in the byte order of the machine that wrote it
+constexpr std::uint32_t BINARY_NETWORK_MAGIC = 0x424e5243;
+constexpr std::uint32_t BINARY_NETWORK_VERSION = 1;
+
+//! Write a prepared module as a binary network
+void WriteBinaryNetwork(const Module &module, CrnWriter &out);
+
+/**
+ * The species a prepared module uses, in the order they are numbered by the
+ * binary formats
+ *
+ * These are the outputs and the species with a concentration or in a
+ * reaction, ordered by name.
+ */
+std::vector<specie> SpeciesByName(const Module &module);
+
+/**
+ * A count as stored in the 32-bit fields of the binary formats
+ *
+ * Throws WriteFailedException, naming format, if it does not fit.
+ */
+std::uint32_t CheckedCount(std::uint64_t count, const std::string &format);
+
+/*! \brief A binary network, read in place
+ * \detail The arrays are used directly where they lie in the file, which is
+ * mapped into memory, so opening a network only checks that it is
+ * consistent. Every specie number and offset is checked then, so they can be
+ * used without further bounds checks.
+ */
+class BinaryNetwork {
+public:
+	//! Map the file at path
+	explicit BinaryNetwork(const std::string &path);
+	//! Use a network in memory, which must outlive this object
+	BinaryNetwork(const char *data, size_t size);
+	~BinaryNetwork();
+	BinaryNetwork(const BinaryNetwork &) = delete;
+	BinaryNetwork &operator=(const BinaryNetwork &) = delete;
+
+	const binaryNetworkHeader &Header() const {
+		return *header;
+	}
+	std::string_view SpecieName(std::uint32_t specie) const {
+		return std::string_view(names + nameOffsets[specie],
+														nameOffsets[specie + 1] - nameOffsets[specie] - 1);
+	}
+
+	const double *rates;
+	const std::uint32_t *reactantOffsets;
+	const std::uint32_t *reactantSpecies;
+	const std::int32_t *reactantCoefficients;
+	const std::uint32_t *productOffsets;
+	const std::uint32_t *productSpecies;
+	const std::int32_t *productCoefficients;
+	const std::uint32_t *outputs;
+	const std::uint32_t *concentrationSpecies;
+	const std::int32_t *concentrations;
+
+	//! Write the network as text, exactly as it would have been compiled
+	void WriteText(CrnWriter &out) const;
+
+private:
+	void Read(const char *data, size_t size);
+	const binaryNetworkHeader *header;
+	const std::uint32_t *nameOffsets;
+	const char *names;
+	void *mapping = nullptr;
+	size_t mappingSize = 0;
+};
@@ -0,0 +1,77 @@
+#include "module.h"
+#include "optimizer.h"
+#include <functional>
+#include <unordered_map>
+
+namespace {
+struct reactionKeyHash {
+	size_t operator()(const reaction *r) const {
+		size_t hash = 0;
+		auto mix = [&hash](size_t v) {
+			hash ^= v + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+		};
+		for (const auto &ratio : r->reactants) {
+			mix(ratio.first.id);
+			mix(static_cast<size_t>(ratio.second));
+		}
+		mix(~size_t(0));
+		for (const auto &ratio : r->products) {
+			mix(ratio.first.id);
+			mix(static_cast<size_t>(ratio.second));
+		}
+		return hash;
+	}
+};
+
+struct reactionKeyEqual {
+	bool operator()(const reaction *a, const reaction *b) const {
+		return a->reactants == b->reactants && a->products == b->products;
+	}
+};
+
+void DropZeroCoefficients(speciesRatios &ratios) {
+	for (auto it = ratios.begin(); it != ratios.end();) {
+		if (it->second == 0) {
+			ratios.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+} // namespace
+
+passResult CanonicalizeReactions(Module &module) {
+	std::vector<reaction> &reactions = module.reactions;
+	size_t noOps = 0;
+	size_t merged = 0;
+	// The first reaction with each pair of sides, which later ones merge into
+	std::unordered_map<const reaction *, size_t, reactionKeyHash,
+										 reactionKeyEqual>
+			first;
+	first.reserve(reactions.size());
+	size_t kept = 0;
+	for (size_t i = 0; i < reactions.size(); i++) {
+		reaction &r = reactions[i];
+		DropZeroCoefficients(r.reactants);
+		DropZeroCoefficients(r.products);
+		if (r.rate == 0 || r.reactants == r.products) {
+			noOps++;
+			continue;
+		}
+		auto it = first.find(&r);
+		if (it != first.end()) {
+			reactions[it->second].rate += r.rate;
+			merged++;
+			continue;
+		}
+		if (kept != i) {
+			reactions[kept] = std::move(r);
+		}
+		first.insert(std::make_pair(&reactions[kept], kept));
+		kept++;
+	}
+	reactions.resize(kept);
+	return {"canonicalize", "merged " + std::to_string(merged) +
+															" duplicate reactions, dropped " +
+															std::to_string(noOps) + " no-op reactions"};
+}
@@ -0,0 +1,253 @@
+#include "codegen.h"
+#include "crnwriter.h"
+#include "kinetics.h"
+#include <cerrno>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <filesystem>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+extern char **environ;
+
+namespace {
+void WriteIndex(CrnWriter &out, const char *array, std::size_t i) {
+	out.Write(array);
+	out.Write('[');
+	out.Write(std::to_string(i));
+	out.Write(']');
+}
+
+//! A double literal that reads back as d, whatever its magnitude
+void WriteLiteral(CrnWriter &out, double d) {
+	// Fixed notation would write large constants as integer literals, which
+	// overflow their type
+	char literal[32];
+	auto res = std::to_chars(literal, literal + sizeof literal, d,
+													 std::chars_format::scientific);
+	out.Write(std::string_view(literal, res.ptr - literal));
+}
+
+//! constant times the reactants of r, leaving out one factor of skip
+void WriteProduct(CrnWriter &out, const KineticNetwork &network,
+									double constant, std::size_t r,
+									std::uint32_t skip = UINT32_MAX) {
+	// A constant of one is only written when nothing else is
+	bool first = constant == 1;
+	if (!first) {
+		WriteLiteral(out, constant);
+	}
+	for (auto i = network.reactantOffsets[r]; i < network.reactantOffsets[r + 1];
+			 i++) {
+		int power = network.reactantOrders[i] - (i == skip ? 1 : 0);
+		for (int n = 0; n < power; n++, first = false) {
+			if (!first) {
+				out.Write(" * ");
+			}
+			WriteIndex(out, "x", network.reactantSpecies[i]);
+		}
+	}
+	if (first) {
+		out.Write('1');
+	}
+}
+
+//! Continue a sum with a term, folding its sign into the operator
+void WriteSign(CrnWriter &out, bool first, double &constant) {
+	if (first) {
+		return;
+	}
+	if (constant < 0) {
+		out.Write(" - ");
+		constant = -constant;
+	} else {
+		out.Write(" + ");
+	}
+}
+
+void WriteSize(CrnWriter &out, const char *name, std::size_t size) {
+	out.Write("extern \"C\" const unsigned ");
+	out.Write(name);
+	out.Write(" = ");
+	out.Write(std::to_string(size));
+	out.Write(";\n");
+}
+
+//! Run argv, and wait for it to finish
+bool Run(const std::vector<std::string> &args) {
+	std::vector<char *> argv;
+	for (const auto &arg : args) {
+		argv.push_back(const_cast<char *>(arg.c_str()));
+	}
+	argv.push_back(nullptr);
+	pid_t pid;
+	if (posix_spawnp(&pid, argv[0], nullptr, nullptr, argv.data(), environ) !=
+			0) {
+		return false;
+	}
+	int status;
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR) {
+			return false;
+		}
+	}
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+} // namespace
+
+void WriteNativeKernels(const KineticNetwork &network, CrnWriter &out) {
+	const std::size_t species = network.SpeciesCount();
+	const std::size_t reactions = network.ReactionCount();
+	out.Write("// Generated by chemilang for a network of ");
+	out.Write(std::to_string(species) + " species and " +
+						std::to_string(reactions) + " reactions\n");
+	for (std::size_t s = 0; s < species; s++) {
+		out.Write("// x[" + std::to_string(s) + "] is ");
+		out.Write(network.names[s]);
+		out.Write('\n');
+	}
+	out.Write('\n');
+	WriteSize(out, "chemilang_species", species);
+	WriteSize(out, "chemilang_reactions", reactions);
+	WriteSize(out, "chemilang_jacobian_entries", network.jacobianColumns.size());
+
+	out.Write("\nextern \"C\" void chemilang_propensities(const double *x, "
+						"double *a) {\n");
+	for (std::size_t r = 0; r < reactions; r++) {
+		out.Write('\t');
+		WriteIndex(out, "a", r);
+		out.Write(" = ");
+		WriteProduct(out, network, network.rates[r], r);
+		out.Write(";\n");
+	}
+	out.Write("}\n");
+
+	// The changes by specie, rather than by reaction
+	std::vector<std::vector<std::pair<std::size_t, int>>> changes(species);
+	for (std::size_t r = 0; r < reactions; r++) {
+		for (auto i = network.changeOffsets[r]; i < network.changeOffsets[r + 1];
+				 i++) {
+			changes[network.changeSpecies[i]].emplace_back(r,
+																										 network.changeAmounts[i]);
+		}
+	}
+	out.Write("\nextern \"C\" void chemilang_rhs(const double *x, double *dx) "
+						"{\n");
+	for (std::size_t r = 0; r < reactions; r++) {
+		out.Write("\tconst double a" + std::to_string(r) + " = ");
+		WriteProduct(out, network, network.rates[r], r);
+		out.Write(";\n");
+	}
+	for (std::size_t s = 0; s < species; s++) {
+		out.Write('\t');
+		WriteIndex(out, "dx", s);
+		out.Write(" = ");
+		if (changes[s].empty()) {
+			out.Write('0');
+		}
+		for (std::size_t i = 0; i < changes[s].size(); i++) {
+			double amount = changes[s][i].second;
+			WriteSign(out, i == 0, amount);
+			if (amount != 1) {
+				WriteLiteral(out, amount);
+				out.Write(" * ");
+			}
+			out.Write("a" + std::to_string(changes[s][i].first));
+		}
+		out.Write(";\n");
+	}
+	out.Write("}\n");
+
+	out.Write("\nextern \"C\" void chemilang_jacobian(const double *x, double "
+						"*j) {\n");
+	const auto &terms = network.jacobianTerms;
+	std::size_t term = 0;
+	for (std::size_t e = 0; e < network.jacobianColumns.size(); e++) {
+		out.Write('\t');
+		WriteIndex(out, "j", e);
+		out.Write(" = ");
+		if (term == terms.size() || terms[term].entry != e) {
+			out.Write('0');
+		}
+		for (bool first = true; term < terms.size() && terms[term].entry == e;
+				 term++, first = false) {
+			double constant =
+					terms[term].coefficient * network.rates[terms[term].reaction];
+			WriteSign(out, first, constant);
+			WriteProduct(out, network, constant, terms[term].reaction,
+									 terms[term].reactant);
+		}
+		out.Write(";\n");
+	}
+	out.Write("}\n");
+}
+
+NativeKernels::NativeKernels(const KineticNetwork &network) {
+	const char *tmp = std::getenv("TMPDIR");
+	std::string pattern =
+			std::string(tmp != nullptr && *tmp != '\0' ? tmp : "/tmp") +
+			"/chemilang-XXXXXX";
+	if (mkdtemp(pattern.data()) == nullptr) {
+		throw NativeCompileException(pattern + ": " + std::strerror(errno));
+	}
+	const std::string dir = pattern;
+	const std::string source = dir + "/kernels.cpp";
+	const std::string shared = dir + "/kernels.so";
+	try {
+		int fd = open(source.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+									S_IRUSR | S_IWUSR);
+		if (fd < 0) {
+			throw NativeCompileException(source + ": " + std::strerror(errno));
+		}
+		try {
+			CrnWriter writer(fd);
+			WriteNativeKernels(network, writer);
+			writer.Flush();
+		} catch (...) {
+			close(fd);
+			throw;
+		}
+		close(fd);
+
+		const char *cxx = std::getenv("CXX");
+		std::string compiler = cxx != nullptr && *cxx != '\0' ? cxx : "c++";
+		if (!Run({compiler, "-O2", "-shared", "-fPIC", "-o", shared, source})) {
+			throw NativeCompileException(compiler + " failed on " + source);
+		}
+		library = dlopen(shared.c_str(), RTLD_NOW | RTLD_LOCAL);
+		if (library == nullptr) {
+			throw NativeCompileException(dlerror());
+		}
+	} catch (...) {
+		std::filesystem::remove_all(dir);
+		throw;
+	}
+	// The library stays mapped after its file is gone
+	std::filesystem::remove_all(dir);
+
+	auto size = [this](const char *name) {
+		auto value = static_cast<const unsigned *>(dlsym(library, name));
+		return value != nullptr ? *value : ~0u;
+	};
+	propensities = reinterpret_cast<decltype(propensities)>(
+			dlsym(library, "chemilang_propensities"));
+	rhs = reinterpret_cast<decltype(rhs)>(dlsym(library, "chemilang_rhs"));
+	jacobian =
+			reinterpret_cast<decltype(jacobian)>(dlsym(library, "chemilang_jacobian"));
+	if (propensities == nullptr || rhs == nullptr || jacobian == nullptr ||
+			size("chemilang_species") != network.SpeciesCount() ||
+			size("chemilang_reactions") != network.ReactionCount() ||
+			size("chemilang_jacobian_entries") != network.jacobianColumns.size()) {
+		dlclose(library);
+		throw NativeCompileException("the library does not match the network");
+	}
+}
+
+NativeKernels::~NativeKernels() {
+	dlclose(library);
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <string>
+
+class CrnWriter;
+class KineticNetwork;
+
+struct NativeCompileException : public std::exception {
+	std::string error;
+	NativeCompileException(std::string reason)
+			: error("Could not compile native kernels: " + reason) {}
+	const char *what() const throw() {
+		return error.c_str();
+	}
+};
+
+/**
+ * Write C++ source computing the kernels of the network without interpreting
+ * its arrays
+ *
+ * Every reaction is unrolled into an expression, and reactant orders into
+ * repeated multiplications. The source defines these functions with C
+ * linkage, with the arrays laid out as in KineticNetwork:
+ *
+ * - `void chemilang_propensities(const double *x, double *a)`
+ * - `void chemilang_rhs(const double *x, double *dx)`
+ * - `void chemilang_jacobian(const double *x, double *j)`, which writes the
+ *   entries in the order of KineticNetwork::jacobianColumns
+ *
+ * and the sizes it was generated for, as `chemilang_species`,
+ * `chemilang_reactions` and `chemilang_jacobian_entries`.
+ */
+void WriteNativeKernels(const KineticNetwork &network, CrnWriter &out);
+
+/*! \brief Kernels generated for a network, compiled and loaded into the process
+ * \detail The source is compiled into a shared library with the compiler in
+ * $CXX, or c++, in a temporary directory which is removed again. The library
+ * stays loaded for as long as the object lives.
+ */
+class NativeKernels {
+public:
+	explicit NativeKernels(const KineticNetwork &network);
+	~NativeKernels();
+	NativeKernels(const NativeKernels &) = delete;
+	NativeKernels &operator=(const NativeKernels &) = delete;
+
+	void (*propensities)(const double *x, double *a);
+	void (*rhs)(const double *x, double *dx);
+	void (*jacobian)(const double *x, double *j);
+
+private:
+	void *library = nullptr;
+};
@@ -0,0 +1,270 @@
+#include "compileserver.h"
+#include "threadpool.h"
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+const char *PROTOCOL = "chemilang 2";
+
+sockaddr_un SocketAddress(const std::string &socketPath) {
+	sockaddr_un addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (socketPath.empty() || socketPath.size() >= sizeof(addr.sun_path)) {
+		throw SocketException(socketPath, "invalid socket path");
+	}
+	std::memcpy(addr.sun_path, socketPath.c_str(), socketPath.size() + 1);
+	return addr;
+}
+
+int Connect(const sockaddr_un &addr) {
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	if (connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) !=
+			0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+bool SendAll(int fd, const std::string &data) {
+	size_t sent = 0;
+	while (sent < data.size()) {
+		ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		sent += static_cast<size_t>(n);
+	}
+	return true;
+}
+
+bool ReceiveAll(int fd, std::string &data) {
+	char buffer[64 * 1024];
+	while (true) {
+		ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			return false;
+		}
+		if (n == 0) {
+			return true;
+		}
+		data.append(buffer, static_cast<size_t>(n));
+	}
+}
+} // namespace
+
+CompileServer::CompileServer(std::string socketPath, bool reclaimNames)
+		: socketPath(std::move(socketPath)), library(reclaimNames) {}
+
+CompileServer::~CompileServer() {
+	Stop();
+}
+
+compileResult CompileServer::Compile(const compileRequest &request) {
+	return library.Compile(request);
+}
+
+void CompileServer::Serve() {
+	sockaddr_un addr = SocketAddress(socketPath);
+	// Refuse to take over the socket of a running server, but replace a stale
+	// one left by a server that was killed
+	int probe = Connect(addr);
+	if (probe >= 0) {
+		close(probe);
+		throw SocketException(socketPath, "another server is listening");
+	}
+	unlink(socketPath.c_str());
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		throw SocketException(socketPath, std::strerror(errno));
+	}
+	if (bind(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) != 0 ||
+			listen(fd, SOMAXCONN) != 0) {
+		std::string reason = std::strerror(errno);
+		close(fd);
+		throw SocketException(socketPath, reason);
+	}
+	listenFd = fd;
+
+	{
+		ThreadPool pool(MAX_CONNECTIONS);
+		while (!stopping) {
+			{
+				// Further clients wait in the backlog of the socket
+				std::unique_lock<std::mutex> lock(connectionMutex);
+				connectionsDone.wait(lock, [this] {
+					return stopping || connections.size() < MAX_CONNECTIONS;
+				});
+			}
+			int connection = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+			if (connection < 0) {
+				if (errno == EINTR || errno == ECONNABORTED) {
+					continue;
+				}
+				break;
+			}
+			// A client that stops sending gives up its connection after a while
+			timeval timeout{RECEIVE_TIMEOUT_SECONDS, 0};
+			setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+								 sizeof(timeout));
+			setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+								 sizeof(timeout));
+			{
+				std::lock_guard<std::mutex> lock(connectionMutex);
+				if (stopping) {
+					close(connection);
+					break;
+				}
+				connections.insert(connection);
+			}
+			pool.Submit([this, connection] {
+				HandleConnection(connection);
+				std::lock_guard<std::mutex> lock(connectionMutex);
+				connections.erase(connection);
+				close(connection);
+				connectionsDone.notify_all();
+			});
+		}
+		// The pool finishes the connections in progress before it is joined
+	}
+	listenFd = -1;
+	close(fd);
+	unlink(socketPath.c_str());
+}
+
+void CompileServer::Stop() {
+	std::lock_guard<std::mutex> lock(connectionMutex);
+	stopping = true;
+	int fd = listenFd;
+	if (fd >= 0) {
+		// Wakes up the accept in Serve
+		shutdown(fd, SHUT_RDWR);
+	}
+	// Requests still being received are dropped, so no client keeps Serve
+	// from returning
+	for (int connection : connections) {
+		shutdown(connection, SHUT_RD);
+	}
+	connectionsDone.notify_all();
+}
+
+void CompileServer::HandleConnection(int fd) {
+	std::string data;
+	compileRequest request;
+	if (!ReceiveAll(fd, data)) {
+		return;
+	}
+	if (!DecodeRequest(data, request)) {
+		SendAll(fd, "error\nMalformed request\n");
+		return;
+	}
+	compileResult result = Compile(request);
+	// The report goes before the network, with its length on the status line
+	SendAll(fd, result.ok ? "ok " + std::to_string(result.report.size()) + "\n" +
+															result.report + result.output
+												: "error\n" + result.output);
+}
+
+std::string CompileServer::EncodeRequest(const compileRequest &request) {
+	return std::string(PROTOCOL) + "\npath " + request.path + "\ncwd " +
+				 request.workingDirectory + "\njobs " + std::to_string(request.jobs) +
+				 "\npasses " + std::to_string(request.passes) + "\n\n" + request.source;
+}
+
+bool CompileServer::DecodeRequest(const std::string &data,
+																	compileRequest &request) {
+	size_t pos = data.find('\n');
+	if (pos == std::string::npos || data.compare(0, pos, PROTOCOL) != 0) {
+		return false;
+	}
+	pos++;
+	while (true) {
+		size_t end = data.find('\n', pos);
+		if (end == std::string::npos) {
+			return false;
+		}
+		if (end == pos) {
+			request.source = data.substr(end + 1);
+			return true;
+		}
+		std::string line = data.substr(pos, end - pos);
+		size_t space = line.find(' ');
+		std::string key = line.substr(0, space);
+		std::string value = space == std::string::npos ? "" : line.substr(space + 1);
+		if (key == "path") {
+			request.path = value;
+		} else if (key == "cwd") {
+			request.workingDirectory = value;
+		} else if (key == "jobs") {
+			char *last = nullptr;
+			unsigned long jobs = strtoul(value.c_str(), &last, 10);
+			if (value.empty() || *last != '\0' || jobs == 0 || jobs > 1024) {
+				return false;
+			}
+			request.jobs = static_cast<unsigned>(jobs);
+		} else if (key == "passes") {
+			char *last = nullptr;
+			unsigned long passes = strtoul(value.c_str(), &last, 10);
+			if (value.empty() || *last != '\0' ||
+					(passes & ~Optimizer::KNOWN_PASSES)) {
+				return false;
+			}
+			request.passes = static_cast<unsigned>(passes);
+		}
+		// Unknown keys are ignored, so newer clients work with older servers
+		pos = end + 1;
+	}
+}
+
+bool CompileRemote(const std::string &socketPath, const compileRequest &request,
+									 compileResult &result) {
+	sockaddr_un addr;
+	try {
+		addr = SocketAddress(socketPath);
+	} catch (const SocketException &) {
+		return false;
+	}
+	int fd = Connect(addr);
+	if (fd < 0) {
+		return false;
+	}
+	std::string response;
+	bool sent = SendAll(fd, CompileServer::EncodeRequest(request)) &&
+							shutdown(fd, SHUT_WR) == 0 && ReceiveAll(fd, response);
+	close(fd);
+	size_t newline = response.find('\n');
+	if (!sent || newline == std::string::npos) {
+		return false;
+	}
+	std::string status = response.substr(0, newline);
+	if (status == "error") {
+		result.ok = false;
+		result.output = response.substr(newline + 1);
+		return true;
+	}
+	char *last = nullptr;
+	unsigned long long reportSize = strtoull(status.c_str() + 3, &last, 10);
+	if (status.compare(0, 3, "ok ") != 0 || *last != '\0' ||
+			reportSize > response.size() - newline - 1) {
+		return false;
+	}
+	result.ok = true;
+	result.report = response.substr(newline + 1, reportSize);
+	result.output = response.substr(newline + 1 + reportSize);
+	return true;
+}
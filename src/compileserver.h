@@ -0,0 +1,79 @@
+#pragma once
+#include "modulelibrary.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <string>
+
+struct SocketException : public std::exception {
+	std::string error;
+	SocketException(std::string socketPath, std::string reason)
+			: error("Socket " + socketPath + ": " + reason) {}
+	const char *what() const throw() {
+		return error.c_str();
+	}
+};
+
+/*! \brief Compiles requests from other processes against a ModuleLibrary
+ * \detail The library stays resident, so libraries are only parsed by the
+ * first request that imports them. The protocol is a single request and
+ * response per connection. The request is a header of `key value` lines, an
+ * empty line, and the source. The response is `error` on a line of its own,
+ * followed by the diagnostics, or `ok` and the length of the optimization
+ * report, followed by the report and the network.
+ */
+class CompileServer {
+public:
+	//! With reclaimNames, the library forgets the names of old requests, see
+	//! ModuleLibrary
+	explicit CompileServer(std::string socketPath, bool reclaimNames = false);
+	~CompileServer();
+	CompileServer(const CompileServer &) = delete;
+	CompileServer &operator=(const CompileServer &) = delete;
+
+	//! Compile a request, using the library for everything it imports
+	compileResult Compile(const compileRequest &request);
+	//! Connections served at once, each on a thread of a pool
+	static constexpr unsigned MAX_CONNECTIONS = 16;
+	//! How long a connection may wait for the client to send or receive
+	static constexpr int RECEIVE_TIMEOUT_SECONDS = 10;
+
+	/**
+	 * Listen on the socket, and compile requests until Stop is called
+	 *
+	 * Up to MAX_CONNECTIONS connections are served concurrently, and the rest
+	 * wait to be accepted. Stop drops the requests still being received, and
+	 * Serve returns once those being compiled are answered. Throws
+	 * SocketException if the socket cannot be created, or is in use by
+	 * another server.
+	 */
+	void Serve();
+	void Stop();
+
+	static std::string EncodeRequest(const compileRequest &request);
+	//! Returns false if data is not a well formed request
+	static bool DecodeRequest(const std::string &data, compileRequest &request);
+
+private:
+	void HandleConnection(int fd);
+
+	std::string socketPath;
+	std::atomic<int> listenFd{-1};
+	std::atomic<bool> stopping{false};
+	std::mutex connectionMutex;
+	// Signalled whenever a connection finishes, and on Stop
+	std::condition_variable connectionsDone;
+	// The sockets of the connections being served
+	std::set<int> connections;
+	ModuleLibrary library;
+};
+
+/**
+ * Compile request on the server listening at socketPath
+ *
+ * Returns false, without touching result, if no server is listening, so the
+ * caller can compile by itself instead.
+ */
+bool CompileRemote(const std::string &socketPath, const compileRequest &request,
+									 compileResult &result);
@@ -0,0 +1,63 @@
+#include "composition.h"
+#include "threadpool.h"
+#include <exception>
+#include <iterator>
+
+namespace {
+struct compositionResult {
+	std::map<specie, int> concentrations;
+	std::vector<reaction> reactions;
+	std::vector<specie> species;
+	std::exception_ptr error;
+};
+} // namespace
+
+void ApplyCompositionsInOrder(const std::vector<numberedComposition> &comps,
+															const std::string &moduleName,
+															std::map<specie, int> &concOut,
+															std::vector<reaction> &reactionOut,
+															std::vector<specie> &specieOut,
+															const compositionContext &context,
+															ThreadPool *pool) {
+	if (pool == nullptr || comps.size() < 2) {
+		for (const auto &comp : comps) {
+			comp.composition->ApplyComposition(moduleName, comp.number, concOut,
+																				 reactionOut, specieOut, context, pool);
+		}
+		return;
+	}
+
+	std::vector<compositionResult> results(comps.size());
+	{
+		TaskGroup group(pool);
+		for (size_t i = 0; i < comps.size(); i++) {
+			group.Run([&, i] {
+				compositionResult &res = results[i];
+				try {
+					comps[i].composition->ApplyComposition(
+							moduleName, comps[i].number, res.concentrations, res.reactions,
+							res.species, context, pool);
+				} catch (...) {
+					res.error = std::current_exception();
+				}
+			});
+		}
+		group.Wait();
+	}
+
+	size_t reactionCount = reactionOut.size();
+	for (const auto &res : results) {
+		reactionCount += res.reactions.size();
+	}
+	reactionOut.reserve(reactionCount);
+	for (auto &res : results) {
+		if (res.error) {
+			std::rethrow_exception(res.error);
+		}
+		// insert keeps the first value for a specie, as in the serial case
+		concOut.insert(res.concentrations.begin(), res.concentrations.end());
+		std::move(res.reactions.begin(), res.reactions.end(),
+							std::back_inserter(reactionOut));
+		specieOut.insert(specieOut.end(), res.species.begin(), res.species.end());
+	}
+}
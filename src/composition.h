@@ -1,12 +1,28 @@
 #pragma once
 #include "typedefs.h"
 #include <map>
+#include <string>
 #include <vector>
 
+class CacheWriter;
 class Module;
+class ThreadPool;
+
+/*! \brief What the compositions enclosing another one do to its reactions
+ * \detail Conditional and scalar compositions do not transform the reactions
+ * of their children themselves. They extend the context instead, and it is
+ * applied once, as the reactions of a module instance are created.
+ */
+struct compositionContext {
+	//! Added to both sides of every reaction, unless already present
+	std::vector<specie> catalysts;
+	//! Every rate is multiplied by each of these, outermost first
+	std::vector<reactionRate> scales;
+};
 
 class Composition {
 public:
+	virtual ~Composition() = default;
 	/*!
 	 * \brief Apply the composition to the referenced properties
 	 * \detail ApplyComposition takes a module name, a composition number, and the
@@ -14,9 +30,45 @@ public:
 	 * an abstract class, it allows for many implementations. Currently, the only
 	 * two present are Conditionals and Modules. They are, however, quite
 	 * interesting.
+	 *
+	 * Every reaction written to reactionOut has the context applied to it.
+	 *
+	 * When pool is not null, independent parts of the composition may be
+	 * applied in parallel on it, but the result is the same as without it.
 	 */
 	virtual void ApplyComposition(std::string moduleName, int compositionNumber,
 																std::map<specie, int> &concOut,
 																std::vector<reaction> &reactionOut,
-																std::vector<specie> &specieOut) = 0;
+																std::vector<specie> &specieOut,
+																const compositionContext &context,
+																ThreadPool *pool) = 0;
+
+	//! Add the modules this composition instantiates to out
+	virtual void AddSubModules(std::vector<Module *> &out) const = 0;
+
+	//! Write the composition, and its children, to a module cache entry
+	virtual void Serialize(CacheWriter &out) const = 0;
 };
+
+//! A composition together with the composition number it is applied with
+struct numberedComposition {
+	Composition *composition;
+	int number;
+};
+
+/**
+ * Apply each composition in turn, as if ApplyComposition was called on them in
+ * order
+ *
+ * With a pool, every composition is applied into buffers of its own, in
+ * parallel, and the buffers are then appended to the outputs in order. The
+ * output is therefore identical to the serial case, and if more than one
+ * composition throws, it is the exception of the first one that is rethrown.
+ */
+void ApplyCompositionsInOrder(const std::vector<numberedComposition> &comps,
+															const std::string &moduleName,
+															std::map<specie, int> &concOut,
+															std::vector<reaction> &reactionOut,
+															std::vector<specie> &specieOut,
+															const compositionContext &context,
+															ThreadPool *pool);
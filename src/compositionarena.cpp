@@ -0,0 +1,9 @@
+#include "compositionarena.h"
+
+void CompositionArena::Release() {
+	for (auto it = nodes.rbegin(); it != nodes.rend(); it++) {
+		(*it)->~Composition();
+	}
+	nodes.clear();
+	resource.release();
+}
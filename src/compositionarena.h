@@ -0,0 +1,52 @@
+#pragma once
+#include "composition.h"
+#include <memory_resource>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*! \brief Owns the composition tree of a compilation
+ * \detail Compositions, and the vectors inside them, are carved out of large
+ * contiguous blocks instead of being allocated one at a time. Release, or
+ * destroying the arena, runs the destructors of every node in reverse order of
+ * creation and then frees all the blocks at once.
+ */
+class CompositionArena {
+public:
+	CompositionArena() : resource(INITIAL_BLOCK_SIZE) {}
+	CompositionArena(const CompositionArena &) = delete;
+	CompositionArena &operator=(const CompositionArena &) = delete;
+	~CompositionArena() {
+		Release();
+	}
+
+	/**
+	 * Construct a composition in the arena
+	 *
+	 * The memory resource of the arena is passed as the last constructor
+	 * argument, so the composition can allocate its vectors from it too.
+	 */
+	template <class T, class... Args> T *Make(Args &&... args) {
+		static_assert(std::is_base_of<Composition, T>::value,
+									"The arena only holds compositions");
+		void *memory = resource.allocate(sizeof(T), alignof(T));
+		T *node = new (memory) T(std::forward<Args>(args)..., &resource);
+		nodes.push_back(node);
+		return node;
+	}
+
+	std::pmr::memory_resource *Resource() {
+		return &resource;
+	}
+	size_t Size() const {
+		return nodes.size();
+	}
+
+	//! Destroy every composition in the arena, and free its memory
+	void Release();
+
+private:
+	static constexpr size_t INITIAL_BLOCK_SIZE = 64 * 1024;
+	std::pmr::monotonic_buffer_resource resource;
+	std::vector<Composition *> nodes;
+};
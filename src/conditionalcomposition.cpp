@@ -1,17 +1,32 @@
 #include "conditionalcomposition.h"
+#include "modulecache.h"
 
 void ConditionalComposition::ApplyComposition(
 		std::string moduleName, int compositionNumber,
 		std::map<specie, int> &concOut, std::vector<reaction> &reactionOut,
-		std::vector<specie> &specieOut) {
-	std::vector<reaction> intermediaryReactions;
+		std::vector<specie> &specieOut, const compositionContext &context,
+		ThreadPool *pool) {
+	std::vector<numberedComposition> comps;
 	for (Composition *subcomp : subCompositions) {
-		subcomp->ApplyComposition(moduleName, compositionNumber, concOut,
-															intermediaryReactions, specieOut);
+		comps.push_back({subcomp, compositionNumber});
 	}
-	for (auto rcn : intermediaryReactions) {
-		rcn.reactants.insert(std::make_pair(condition, 1));
-		rcn.products.insert(std::make_pair(condition, 1));
-		reactionOut.push_back(rcn);
+	compositionContext inner = context;
+	inner.catalysts.push_back(condition);
+	ApplyCompositionsInOrder(comps, moduleName, concOut, reactionOut, specieOut,
+													 inner, pool);
+}
+
+void ConditionalComposition::AddSubModules(std::vector<Module *> &out) const {
+	for (const Composition *subcomp : subCompositions) {
+		subcomp->AddSubModules(out);
+	}
+}
+
+void ConditionalComposition::Serialize(CacheWriter &out) const {
+	out.WriteU8(ConditionalTag);
+	out.WriteSpecie(condition);
+	out.WriteU32(static_cast<std::uint32_t>(subCompositions.size()));
+	for (const Composition *subcomp : subCompositions) {
+		subcomp->Serialize(out);
 	}
 }
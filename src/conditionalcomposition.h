@@ -1,5 +1,6 @@
 #pragma once
 #include "composition.h"
+#include <memory_resource>
 
 /*! \brief A composition in which the reactions have a catalyst
  * \detail This type of composition allows for the user to have their
@@ -12,17 +13,25 @@ public:
 	 *
 	 * @param condition The specie which is added as acatalyst
 	 * @param subCompositions The child compositions
+	 * @param resource Where the list of children is allocated
 	 */
-	ConditionalComposition(specie condition,
-												 std::vector<Composition *> subCompositions)
-			: condition(condition), subCompositions(subCompositions) {}
+	ConditionalComposition(
+			specie condition, const std::vector<Composition *> &subCompositions,
+			std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+			: condition(condition),
+				subCompositions(subCompositions.begin(), subCompositions.end(),
+												resource) {}
 
 	void ApplyComposition(std::string moduleName, int compositionNumber,
 												std::map<specie, int> &concOut,
 												std::vector<reaction> &reactionOut,
-												std::vector<specie> &specieOut) override;
+												std::vector<specie> &specieOut,
+												const compositionContext &context,
+												ThreadPool *pool) override;
+	void AddSubModules(std::vector<Module *> &out) const override;
+	void Serialize(CacheWriter &out) const override;
 
 private:
 	specie condition;
-	std::vector<Composition *> subCompositions;
+	std::pmr::vector<Composition *> subCompositions;
 };
@@ -0,0 +1,88 @@
+#include "crnwriter.h"
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <unistd.h>
+
+// Fixed notation of a double has at most 309 integer digits, or a fraction of
+// at most 324 zeros followed by 17 significant digits
+constexpr size_t MAX_DOUBLE_CHARS = 360;
+
+CrnWriter::CrnWriter(int fd) : fd(fd), buffer(BUFFER_SIZE) {}
+
+CrnWriter::CrnWriter(std::string &sink) : sink(&sink), buffer(BUFFER_SIZE) {}
+
+CrnWriter::~CrnWriter() {
+	// Errors cannot be reported from here, so call Flush explicitly to get them
+	try {
+		Flush();
+	} catch (const WriteFailedException &) {
+	}
+}
+
+void CrnWriter::Flush() {
+	if (sink != nullptr) {
+		sink->append(buffer.data(), used);
+		used = 0;
+		return;
+	}
+	size_t written = 0;
+	while (written < used) {
+		ssize_t res = ::write(fd, buffer.data() + written, used - written);
+		if (res < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			used = 0;
+			throw WriteFailedException(std::strerror(errno));
+		}
+		written += static_cast<size_t>(res);
+	}
+	used = 0;
+}
+
+void CrnWriter::Reserve(size_t n) {
+	if (buffer.size() - used < n) {
+		Flush();
+	}
+	if (buffer.size() < n) {
+		buffer.resize(n);
+	}
+}
+
+void CrnWriter::Write(std::string_view s) {
+	Reserve(s.size());
+	std::memcpy(buffer.data() + used, s.data(), s.size());
+	used += s.size();
+}
+
+void CrnWriter::Write(char c) {
+	Reserve(1);
+	buffer[used++] = c;
+}
+
+void CrnWriter::WriteInt(int i) {
+	// Enough for any 32 bit int with its sign
+	constexpr size_t MAX_INT_CHARS = 12;
+	Reserve(MAX_INT_CHARS);
+	char *begin = buffer.data() + used;
+	auto res = std::to_chars(begin, begin + MAX_INT_CHARS, i);
+	used += res.ptr - begin;
+}
+
+void CrnWriter::WriteDouble(double d) {
+	Reserve(MAX_DOUBLE_CHARS);
+	char *begin = buffer.data() + used;
+	auto res = std::to_chars(begin, begin + MAX_DOUBLE_CHARS, d,
+													 std::chars_format::fixed);
+	used += res.ptr - begin;
+}
+
+namespace precision {
+std::string to_string(double d) {
+	char out[MAX_DOUBLE_CHARS];
+	auto res = std::to_chars(out, out + MAX_DOUBLE_CHARS, d,
+													 std::chars_format::fixed);
+	return std::string(out, res.ptr);
+}
+} // namespace precision
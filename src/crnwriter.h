@@ -0,0 +1,52 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+//! The start of every network, which makes it executable with crnsimul
+constexpr std::string_view CRNSIMUL_COMMAND =
+		"#!/usr/bin/env -S crnsimul -e -P ";
+
+struct WriteFailedException : public std::exception {
+	std::string error;
+	WriteFailedException(std::string reason)
+			: error("Could not write output: " + reason) {}
+	const char *what() const throw() {
+		return error.c_str();
+	}
+};
+
+/*! \brief A buffered writer for the emitted network
+ * \detail The writer either streams to a file descriptor, flushing whenever
+ * its fixed size buffer is full, or appends to a string. Numbers are
+ * formatted with std::to_chars directly into the buffer, so emitting a
+ * reaction does not allocate.
+ */
+class CrnWriter {
+public:
+	//! Write to fd. The descriptor is not closed by the writer.
+	explicit CrnWriter(int fd);
+	//! Append to sink
+	explicit CrnWriter(std::string &sink);
+	~CrnWriter();
+
+	void Write(std::string_view s);
+	void Write(char c);
+	void WriteInt(int i);
+	//! Shortest decimal representation which reads back as the same double
+	void WriteDouble(double d);
+	void Flush();
+
+private:
+	static constexpr size_t BUFFER_SIZE = 1 << 16;
+	void Reserve(size_t n);
+	int fd = -1;
+	std::string *sink = nullptr;
+	std::vector<char> buffer;
+	size_t used = 0;
+};
+
+namespace precision {
+std::string to_string(double d);
+}
@@ -0,0 +1,102 @@
+#include "module.h"
+#include "netchange.h"
+#include "optimizer.h"
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+void CountSpecies(const Module &module, std::unordered_set<specie> &out) {
+	for (const auto &r : module.reactions) {
+		for (const auto &ratio : r.reactants) {
+			out.insert(ratio.first);
+		}
+		for (const auto &ratio : r.products) {
+			out.insert(ratio.first);
+		}
+	}
+	for (const auto &c : module.concentrations) {
+		out.insert(c.first);
+	}
+}
+} // namespace
+
+passResult EliminateDeadReactions(Module &module) {
+	if (module.outputSpecies.empty()) {
+		return {"dead", "no output species, nothing removed"};
+	}
+	std::vector<reaction> &reactions = module.reactions;
+	std::unordered_map<specie, std::vector<size_t>> changedBy;
+	for (size_t i = 0; i < reactions.size(); i++) {
+		ForEachNetChange(reactions[i], [&](const specie &s, int) {
+			changedBy[s].push_back(i);
+		});
+	}
+
+	// A reaction matters if it changes a live specie, and its rate then
+	// depends on all its reactants, which are live too
+	std::unordered_set<specie> live(module.outputSpecies.begin(),
+																	module.outputSpecies.end());
+	std::vector<specie> work(module.outputSpecies.begin(),
+													 module.outputSpecies.end());
+	std::vector<char> keep(reactions.size(), false);
+	while (!work.empty()) {
+		specie s = work.back();
+		work.pop_back();
+		auto it = changedBy.find(s);
+		if (it == changedBy.end()) {
+			continue;
+		}
+		for (size_t i : it->second) {
+			if (keep[i]) {
+				continue;
+			}
+			keep[i] = true;
+			for (const auto &ratio : reactions[i].reactants) {
+				if (live.insert(ratio.first).second) {
+					work.push_back(ratio.first);
+				}
+			}
+		}
+	}
+
+	std::unordered_set<specie> before;
+	CountSpecies(module, before);
+	size_t kept = 0;
+	for (size_t i = 0; i < reactions.size(); i++) {
+		if (keep[i]) {
+			if (kept != i) {
+				reactions[kept] = std::move(reactions[i]);
+			}
+			kept++;
+		}
+	}
+	size_t removedReactions = reactions.size() - kept;
+	reactions.resize(kept);
+
+	size_t removedConcentrations = 0;
+	for (auto it = module.concentrations.begin();
+			 it != module.concentrations.end();) {
+		if (live.count(it->first) == 0) {
+			it = module.concentrations.erase(it);
+			removedConcentrations++;
+		} else {
+			++it;
+		}
+	}
+	std::unordered_set<specie> after;
+	CountSpecies(module, after);
+	std::vector<specie> privateSpecies;
+	for (const auto &s : module.privateSpecies) {
+		if (after.count(s) != 0) {
+			privateSpecies.push_back(s);
+		}
+	}
+	module.privateSpecies = std::move(privateSpecies);
+
+	return {"dead", "removed " + std::to_string(removedReactions) +
+											" reactions, " +
+											std::to_string(before.size() - after.size()) +
+											" species and " +
+											std::to_string(removedConcentrations) +
+											" concentrations"};
+}
@@ -1,11 +1,17 @@
 #include "driver.h"
+#include "analysis.h"
+#include "binarynetwork.h"
 #include "frontend.h"
-#include "parser.hpp"
+#include "modulecache.h"
+#include "threadpool.h"
+#include <algorithm>
 #include <boost/algorithm/string.hpp>
 #include <cstdlib>
+#include <filesystem>
+#include <exception>
 #include <fstream>
+#include <functional>
 #include <iostream>
-#include <regex>
 #include <sstream>
 
 driver::driver() : trace_parsing(false), trace_scanning(false) {}
@@ -16,91 +22,340 @@ int driver::parse_file(const std::string &filename) {
 		Frontend::Exception(fileError, filename);
 		return 1;
 	}
+	std::string path = std::filesystem::canonical(filename).string();
+	importedFiles.insert(path);
 	std::stringstream buffer;
 	buffer << fileStream.rdbuf();
-	return parse_string(buffer.str());
+	return ParseUnits(buffer.str(), path);
 }
 
-// TODO: This is not the best way of doing this
-// If we have time, we should implement it properly in flex/
-// bison or as part of a real preprocessor
-std::string driver::import_files(const std::string &in) {
-	std::smatch m;
-	std::regex e("import ([/a-zA-Z0-9.]+);");
-	std::string res = in;
-	while (std::regex_search(res, m, e)) {
-		const std::string &filename = m[1];
-		std::ifstream f(filename);
-		if (f.good()) {
-			parse_file(filename);
-		} else {
-			parse_file(FindFileInPath(filename));
+int driver::parse_string(const std::string &s, const std::string &path) {
+	if (!path.empty()) {
+		importedFiles.insert(path);
+	}
+	return ParseUnits(s, path);
+}
+
+int driver::ParseUnits(const std::string &source, const std::string &path) {
+	std::vector<parseUnit> units;
+	units.push_back({path, source, {}});
+	std::map<std::string, size_t> unitIndex;
+	if (!path.empty()) {
+		unitIndex.insert(std::make_pair(path, 0));
+	}
+
+	// Find the import graph, and the level of every file in it. Imports which
+	// lead back to a file that is still being scanned are dropped, as that
+	// file cannot be parsed before itself anyway.
+	enum { UNSEEN, SCANNING, DONE };
+	std::vector<int> state;
+	std::vector<size_t> unitLevel;
+	std::vector<std::vector<size_t>> levels;
+	// Every unit after the files it imports, in the order of the imports
+	std::vector<size_t> order;
+	std::function<size_t(size_t)> discover = [&](size_t unit) -> size_t {
+		state.resize(units.size(), UNSEEN);
+		unitLevel.resize(units.size(), 0);
+		if (state[unit] == DONE) {
+			return unitLevel[unit];
+		}
+		state[unit] = SCANNING;
+		std::vector<std::string> imports;
+		{
+			ParseContext scan(*this, nullptr);
+			imports = scan.ScanImports(units[unit].source);
 		}
-		res = m.prefix().str() + m.suffix().str();
+		for (const auto &import : imports) {
+			std::string importPath = ResolveImport(import);
+			if (!units[unit].path.empty()) {
+				fileImports[units[unit].path].push_back(importPath);
+			}
+			auto known = unitIndex.find(importPath);
+			if (known != unitIndex.end()) {
+				units[unit].imports.push_back(known->second);
+			} else if (importedFiles.find(importPath) != importedFiles.end()) {
+				// Parsed by an earlier call, and already merged
+			} else if (library != nullptr &&
+								 library->importedFiles.count(importPath) != 0) {
+				UseLibraryFile(importPath);
+			} else {
+				std::ifstream file(importPath);
+				std::stringstream buffer;
+				buffer << file.rdbuf();
+				unitIndex.insert(std::make_pair(importPath, units.size()));
+				units[unit].imports.push_back(units.size());
+				units.push_back({importPath, buffer.str(), {}});
+				importedFiles.insert(importPath);
+			}
+		}
+		size_t level = 0;
+		for (size_t i = 0; i < units[unit].imports.size(); i++) {
+			size_t imported = units[unit].imports[i];
+			state.resize(units.size(), UNSEEN);
+			if (state[imported] != SCANNING) {
+				level = std::max(level, discover(imported) + 1);
+			}
+		}
+		state[unit] = DONE;
+		unitLevel[unit] = level;
+		order.push_back(unit);
+		if (levels.size() <= level) {
+			levels.resize(level + 1);
+		}
+		levels[level].push_back(unit);
+		return level;
+	};
+	discover(0);
+
+	ModuleCache cache(cacheDirectory);
+	std::unique_ptr<ThreadPool> pool;
+	if (jobs > 1) {
+		pool = std::make_unique<ThreadPool>(jobs);
 	}
-	return res;
+	// Parse the units of batch concurrently, and merge their modules. A unit
+	// using a module nobody has merged yet is added to deferred instead, when
+	// given, as the module may come from a file imported before it that is on
+	// the same or a later level.
+	std::vector<std::exception_ptr> semanticErrors;
+	auto parseBatch = [&](const std::vector<size_t> &batch,
+												std::vector<size_t> *deferred) {
+		std::vector<std::unique_ptr<ParseContext>> contexts;
+		for (size_t unit : batch) {
+			arenas.push_back(std::make_unique<CompositionArena>());
+			contexts.push_back(std::make_unique<ParseContext>(
+					*this, arenas.back().get(), units[unit].path));
+		}
+		std::vector<int> results(batch.size(), 0);
+		std::vector<std::exception_ptr> errors(batch.size());
+		std::vector<char> loaded(batch.size(), false);
+		std::vector<char> missing(batch.size(), false);
+		auto useCache = [&](size_t i) {
+			return batch[i] != 0 && !cacheDirectory.empty();
+		};
+		TaskGroup group(pool.get());
+		for (size_t i = 0; i < batch.size(); i++) {
+			group.Run([&, i] {
+				const parseUnit &unit = units[batch[i]];
+				try {
+					loaded[i] = useCache(i) &&
+											cache.Load(unit.path, unit.source, *contexts[i]);
+					if (!loaded[i]) {
+						results[i] = contexts[i]->Parse(unit.source);
+					}
+				} catch (const NoSuchModuleException &) {
+					if (deferred != nullptr) {
+						missing[i] = true;
+					} else {
+						errors[i] = std::current_exception();
+					}
+				} catch (...) {
+					errors[i] = std::current_exception();
+				}
+			});
+		}
+		group.Wait();
+		for (const auto &error : errors) {
+			if (error) {
+				// Later files would fail on the modules this one did not define
+				semanticErrors.push_back(error);
+				ThrowErrors(std::move(semanticErrors));
+			}
+		}
+
+		// Verify every module parsed in the batch at once, and keep going on
+		// errors, so those of every file are reported together. Cache entries
+		// were verified when stored.
+		std::vector<Module *> parsed;
+		for (size_t i = 0; i < batch.size(); i++) {
+			if (!loaded[i] && !missing[i] && results[i] == 0) {
+				for (auto &m : contexts[i]->modules) {
+					parsed.push_back(&m.second);
+				}
+			}
+		}
+		std::vector<std::exception_ptr> found = AnalyzeModules(parsed, pool.get());
+		semanticErrors.insert(semanticErrors.end(), found.begin(), found.end());
+		for (size_t i = 0; i < batch.size() && found.empty(); i++) {
+			if (useCache(i) && !loaded[i] && !missing[i] && results[i] == 0) {
+				group.Run([&, i] {
+					const parseUnit &unit = units[batch[i]];
+					cache.Store(unit.path, unit.source, contexts[i]->modules);
+				});
+			}
+		}
+		group.Wait();
+
+		int failed = 0;
+		for (size_t i = 0; i < batch.size(); i++) {
+			if (missing[i]) {
+				deferred->push_back(batch[i]);
+				continue;
+			}
+			const std::string &unitPath = units[batch[i]].path;
+			if (!unitPath.empty()) {
+				for (const auto &m : contexts[i]->modules) {
+					fileModules[unitPath].push_back(m.first);
+				}
+			}
+			MergeModules(contexts[i]->modules);
+			if (results[i] != 0 && failed == 0) {
+				failed = results[i];
+			}
+		}
+		return failed;
+	};
+
+	std::vector<size_t> deferred;
+	for (const auto &level : levels) {
+		int failed = parseBatch(level, &deferred);
+		if (failed != 0) {
+			ThrowErrors(std::move(semanticErrors));
+			return failed;
+		}
+	}
+	// A file sees the modules of every file imported before it, as when files
+	// were parsed one at a time, so the deferred units are parsed again in
+	// import order, after everything else
+	std::vector<size_t> position(units.size());
+	for (size_t i = 0; i < order.size(); i++) {
+		position[order[i]] = i;
+	}
+	std::sort(deferred.begin(), deferred.end(),
+						[&](size_t a, size_t b) { return position[a] < position[b]; });
+	for (size_t unit : deferred) {
+		int failed = parseBatch({unit}, nullptr);
+		if (failed != 0) {
+			ThrowErrors(std::move(semanticErrors));
+			return failed;
+		}
+	}
+	ThrowErrors(std::move(semanticErrors));
+	return 0;
 }
 
-int driver::parse_string(const std::string &s) {
-	scan_begin(import_files(s));
-	return parse();
+void driver::MergeModules(std::map<std::string, Module> &sink) {
+	for (const auto &m : sink) {
+		if (modules.find(m.first) != modules.end() ||
+				libraryModules.find(m.first) != libraryModules.end()) {
+			throw MultipleModulesWithSameName(m.first);
+		}
+	}
+	// Splicing the nodes keeps the modules at the same address, so the
+	// compositions that point to them stay valid
+	modules.merge(sink);
 }
 
-int driver::parse() {
-	yy::parser parse(*this);
-	parse.set_debug_level(
-			static_cast<yy::parser::debug_level_type>(trace_parsing));
-	int res = parse();
-	scan_end();
-	return res;
+void driver::UseLibraryFile(const std::string &path) {
+	if (!libraryFiles.insert(path).second) {
+		return;
+	}
+	auto defined = library->fileModules.find(path);
+	if (defined != library->fileModules.end()) {
+		for (const std::string &name : defined->second) {
+			libraryModules.insert(
+					std::make_pair(name, &library->modules.at(name)));
+		}
+	}
+	auto imported = library->fileImports.find(path);
+	if (imported != library->fileImports.end()) {
+		for (const std::string &import : imported->second) {
+			UseLibraryFile(import);
+		}
+	}
 }
 
 std::string driver::Compile() {
-	if (modules.find("main") == modules.end()) {
-		std::cerr << "Modules declared:" << std::endl;
-		for (const auto &m : modules) {
-			std::cerr << "\t" << m.first << std::endl;
-		}
-		throw NoMainModuleException();
+	std::string res;
+	{
+		CrnWriter writer(res);
+		Emit(writer);
 	}
-	std::string res = "#!/usr/bin/env -S crnsimul -e -P ";
-	res += modules["main"].Compile();
 	return res;
 };
 
-void driver::FinishParsingModule() {
-	currentModule.Verify();
-	AddModuleToMap();
-	currentModule = Module();
+void driver::Emit(CrnWriter &out) {
+	Module &main = PrepareMain();
+	out.Write(CRNSIMUL_COMMAND);
+	main.Emit(out);
 }
 
-void driver::FinishParsingFunction() {
-	currentModule.VerifyFunction();
-	AddModuleToMap();
-	currentModule = Module();
+void driver::EmitBinary(CrnWriter &out) {
+	WriteBinaryNetwork(PrepareMain(), out);
 }
 
-void driver::AddModuleToMap() {
-	if (modules.find(currentModule.name) == modules.end()) {
-		modules.insert(std::make_pair(currentModule.name, currentModule));
+Module &driver::PrepareMain() {
+	if (modules.find("main") == modules.end()) {
+		*diagnostics << "Modules declared:" << std::endl;
+		for (const auto &m : modules) {
+			*diagnostics << "\t" << m.first << std::endl;
+		}
+		throw NoMainModuleException();
+	}
+	Module &main = modules["main"];
+	Optimizer *passes = optimizer.passes != 0 ? &optimizer : nullptr;
+	if (jobs > 1) {
+		ThreadPool pool(jobs);
+		main.PrepareNetwork(&pool, passes);
 	} else {
-		throw MultipleModulesWithSameName(currentModule.name);
+		main.PrepareNetwork(nullptr, passes);
 	}
+	return main;
 }
 
-std::string driver::FindFileInPath(const std::string &fileName) {
-	char *chemPath = getenv("CHEMPATH");
-	std::string searchPath = defaultPath;
+std::string driver::ResolveImport(const std::string &fileName) {
+	auto key = std::make_pair(baseDirectory, fileName);
+	auto resolved = resolvedImports.find(key);
+	if (resolved == resolvedImports.end()) {
+		std::string path = fileName;
+		if (!baseDirectory.empty() && fileName.front() != '/' &&
+				std::ifstream(baseDirectory + "/" + fileName).good()) {
+			path = baseDirectory + "/" + fileName;
+		} else if (!std::ifstream(fileName).good()) {
+			path = FindFileInPath(fileName);
+		}
+		path = std::filesystem::canonical(path).string();
+		resolved = resolvedImports.emplace(key, path).first;
+	}
+	return resolved->second;
+}
 
-	if (chemPath != nullptr) {
-		searchPath = std::string(chemPath) + ":" + searchPath;
+bool driver::ResolvesAlikeFrom(const std::string &directory) const {
+	for (const auto &resolved : resolvedImports) {
+		const std::string &base = resolved.first.first;
+		const std::string &fileName = resolved.first.second;
+		if (base == directory || fileName.front() == '/') {
+			continue;
+		}
+		// Only a file in either base directory can make the two differ
+		auto inDirectory = [&fileName](const std::string &dir) -> std::string {
+			if (dir.empty() || !std::ifstream(dir + "/" + fileName).good()) {
+				return "";
+			}
+			return std::filesystem::canonical(dir + "/" + fileName).string();
+		};
+		std::string before = inDirectory(base);
+		std::string after = inDirectory(directory);
+		if (before != after) {
+			return false;
+		}
 	}
+	return true;
+}
 
-	std::vector<std::string> paths;
-	boost::split(paths, searchPath, [](char c) { return c == ':'; });
-	for (std::string &dir : paths) {
-		if (dir.back() != '/')
-			dir += "/";
+std::string driver::FindFileInPath(const std::string &fileName) {
+	if (searchPath.empty()) {
+		char *chemPath = getenv("CHEMPATH");
+		std::string pathVariable = defaultPath;
+		if (chemPath != nullptr) {
+			pathVariable = std::string(chemPath) + ":" + pathVariable;
+		}
+		boost::split(searchPath, pathVariable, [](char c) { return c == ':'; });
+		for (std::string &dir : searchPath) {
+			if (dir.empty() || dir.back() != '/')
+				dir += "/";
+		}
+	}
+	for (const std::string &dir : searchPath) {
 		std::ifstream f(dir + fileName);
 		if (f.good()) {
 			return dir + fileName;
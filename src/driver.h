@@ -1,15 +1,16 @@
 #pragma once
+#include "compositionarena.h"
 #include "module.h"
-#include "parser.hpp"
+#include "optimizer.h"
+#include "parsecontext.h"
+#include <iostream>
 #include <map>
+#include <memory>
+#include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
-// Give Flex the prototype of yylex we want ...
-#define YY_DECL yy::parser::symbol_type yylex(driver &drv)
-// ... and declare it for the parser's sake.
-YY_DECL;
-
 struct NoMainModuleException : public std::exception {
 	const char *what() const throw() {
 		return "No main module declared";
@@ -33,28 +34,98 @@ public:
 
 	// Run the parser on file F.  Return 0 on success.
 	int parse_file(const std::string &filename);
-	int parse_string(const std::string &s);
-	int parse();
+	// Run the parser on s, read from the file at the canonical path, if any.
+	int parse_string(const std::string &s, const std::string &path = "");
 	std::string Compile();
-	void FinishParsingModule();
-	void FinishParsingFunction();
+	//! Compile the main module, and stream the network to out
+	void Emit(CrnWriter &out);
+	//! Compile the main module, and write the network in the binary format
+	void EmitBinary(CrnWriter &out);
+	//! Flatten and optimize the main module, which must exist
+	Module &PrepareMain();
 	std::map<std::string, Module> modules;
-	Module currentModule;
 	// Whether to generate parser debug traces.
 	bool trace_parsing;
-
-	// Handling the scanner.
-	void scan_begin(const std::string &instream);
-	void scan_end();
+	// Number of threads used to parse imports and flatten compositions
+	unsigned jobs = 1;
 	// Whether to generate scanner debug traces.
 	bool trace_scanning;
-	// The token's location used by the scanner.
-	yy::location location;
-	// Removes all instances of the import regex, and parses the files
-	std::string import_files(const std::string &in);
+	// Where precompiled imports are kept. Empty disables the module cache.
+	std::string cacheDirectory;
+	// The passes run on main before it is emitted
+	Optimizer optimizer;
+	// Where syntax errors and other diagnostics are written
+	std::ostream *diagnostics = &std::cerr;
+	// Relative imports are looked up here before the working directory
+	std::string baseDirectory;
+	/**
+	 * Modules shared with other drivers, which this driver only reads
+	 *
+	 * Files the library has imported are not parsed again, and the modules they
+	 * define become visible through libraryModules. Library modules must all be
+	 * flattened already, as flattening is the only thing that modifies a module
+	 * after parsing.
+	 */
+	driver *library = nullptr;
+	// The library modules defined in files this driver imports
+	std::map<std::string, Module *> libraryModules;
+	//! Canonical paths of every file parsed so far
+	const std::set<std::string> &ImportedFiles() const {
+		return importedFiles;
+	}
+	/**
+	 * Find the file for an import statement
+	 *
+	 * Returns the canonical path of the file. Resolved paths are cached for
+	 * each baseDirectory.
+	 */
+	std::string ResolveImport(const std::string &fileName);
+	/**
+	 * Whether every import resolved so far would resolve to the same file with
+	 * directory as the baseDirectory
+	 */
+	bool ResolvesAlikeFrom(const std::string &directory) const;
 
 private:
-	void AddModuleToMap();
+	//! A file to parse, and the indexes of the units it imports
+	struct parseUnit {
+		std::string path;
+		std::string source;
+		std::vector<size_t> imports;
+	};
+	/**
+	 * Parse source, and every file it imports that has not been parsed yet
+	 *
+	 * The import graph is found first, by scanning only the imports of each
+	 * file. Files are then parsed level by level, starting with those that
+	 * import nothing new. All files on a level are parsed concurrently, and
+	 * their modules are merged into modules in a fixed order before the next
+	 * level, so a file can use everything it imports.
+	 *
+	 * A file may also use the modules of files imported before it, by the file
+	 * importing it or earlier. When such a module is not merged yet, the file
+	 * is parsed again after all the levels, in import order.
+	 *
+	 * Imported files are loaded from the module cache instead, when it has an
+	 * entry for their current source.
+	 */
+	int ParseUnits(const std::string &source, const std::string &path);
+	void MergeModules(std::map<std::string, Module> &sink);
+	//! Make the modules of a library file, and of everything it imports, visible
+	void UseLibraryFile(const std::string &path);
 	std::string FindFileInPath(const std::string &fileName);
 	std::string defaultPath = "/usr/local/share/chemlib/:/usr/share/chemlib/";
+	// The directories of CHEMPATH and defaultPath, split on first use
+	std::vector<std::string> searchPath;
+	// Base directories and import file names to canonical paths
+	std::map<std::pair<std::string, std::string>, std::string> resolvedImports;
+	// Canonical paths of every file parsed so far
+	std::set<std::string> importedFiles;
+	// The names of the modules defined in, and the files imported by, each file
+	std::map<std::string, std::vector<std::string>> fileModules;
+	std::map<std::string, std::vector<std::string>> fileImports;
+	// Library files whose modules are in libraryModules
+	std::set<std::string> libraryFiles;
+	// Own the compositions of every parsed file
+	std::vector<std::unique_ptr<CompositionArena>> arenas;
 };
@@ -0,0 +1,226 @@
+#include "ensemble.h"
+#include "crnwriter.h"
+#include "kinetics.h"
+#include "random.h"
+#include "stochastic.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+
+QuantileEstimator::QuantileEstimator(double quantile) : quantile(quantile) {}
+
+void QuantileEstimator::Add(double value) {
+	if (count < 5) {
+		heights[count++] = value;
+		std::sort(heights, heights + count);
+		if (count == 5) {
+			for (int i = 0; i < 5; i++) {
+				positions[i] = i;
+			}
+			desired[0] = 0;
+			desired[1] = 2 * quantile;
+			desired[2] = 4 * quantile;
+			desired[3] = 2 + 2 * quantile;
+			desired[4] = 4;
+		}
+		return;
+	}
+	count++;
+	int cell;
+	if (value < heights[0]) {
+		heights[0] = value;
+		cell = 0;
+	} else if (value >= heights[4]) {
+		heights[4] = value;
+		cell = 3;
+	} else {
+		cell = 0;
+		while (value >= heights[cell + 1]) {
+			cell++;
+		}
+	}
+	for (int i = cell + 1; i < 5; i++) {
+		positions[i]++;
+	}
+	const double increments[5] = {0, quantile / 2, quantile, (1 + quantile) / 2,
+																1};
+	for (int i = 0; i < 5; i++) {
+		desired[i] += increments[i];
+	}
+
+	for (int i = 1; i < 4; i++) {
+		double d = desired[i] - positions[i];
+		if ((d >= 1 && positions[i + 1] - positions[i] > 1) ||
+				(d <= -1 && positions[i - 1] - positions[i] < -1)) {
+			int step = d > 0 ? 1 : -1;
+			double below = positions[i] - positions[i - 1];
+			double above = positions[i + 1] - positions[i];
+			double parabolic =
+					heights[i] +
+					step / (positions[i + 1] - positions[i - 1]) *
+							((below + step) * (heights[i + 1] - heights[i]) / above +
+							 (above - step) * (heights[i] - heights[i - 1]) / below);
+			if (heights[i - 1] < parabolic && parabolic < heights[i + 1]) {
+				heights[i] = parabolic;
+			} else {
+				heights[i] += step * (heights[i + step] - heights[i]) /
+											(positions[i + step] - positions[i]);
+			}
+			positions[i] += step;
+		}
+	}
+}
+
+double QuantileEstimator::Value() const {
+	if (count == 0) {
+		return NAN;
+	}
+	if (count < 5) {
+		// The nearest rank of the values so far
+		auto rank = static_cast<std::size_t>(std::ceil(quantile * count));
+		return heights[std::max<std::size_t>(rank, 1) - 1];
+	}
+	return heights[2];
+}
+
+EnsembleStatistics::EnsembleStatistics(std::size_t samples,
+																			 std::size_t observed)
+		: observedCount(observed), means(samples * observed),
+			squares(samples * observed) {
+	quantiles.reserve(samples * observed * QUANTILE_COUNT);
+	for (std::size_t i = 0; i < samples * observed; i++) {
+		for (double q : QUANTILES) {
+			quantiles.emplace_back(q);
+		}
+	}
+}
+
+void EnsembleStatistics::Add(const std::vector<double> &trajectory) {
+	count++;
+	for (std::size_t i = 0; i < means.size(); i++) {
+		double delta = trajectory[i] - means[i];
+		means[i] += delta / count;
+		squares[i] += delta * (trajectory[i] - means[i]);
+		for (std::size_t q = 0; q < QUANTILE_COUNT; q++) {
+			quantiles[i * QUANTILE_COUNT + q].Add(trajectory[i]);
+		}
+	}
+}
+
+double EnsembleStatistics::Variance(std::size_t sample,
+																		std::size_t observed) const {
+	if (count < 2) {
+		return 0;
+	}
+	return squares[sample * observedCount + observed] / (count - 1);
+}
+
+ensembleStats RunEnsemble(const KineticNetwork &network,
+													const simulationOptions &options,
+													unsigned trajectories, ThreadPool *pool,
+													EnsembleStatistics &statistics) {
+	const DependencyGraph dependencies(network);
+	const std::size_t width = network.observed.size();
+	const unsigned workers = pool ? std::max(1u, pool->Size()) : 1;
+	// How far past the next trajectory to add a worker may start
+	const unsigned window = 2 * workers;
+	ensembleStats total;
+	// Trajectories which finished before an earlier one, waiting their turn
+	std::map<unsigned, std::vector<double>> finished;
+	unsigned next = 0;
+	unsigned claimed = 0;
+	bool failed = false;
+	std::mutex mutex;
+	std::condition_variable advanced;
+
+	auto work = [&] {
+		std::vector<double> trajectory;
+		for (;;) {
+			unsigned i;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				// The trajectory at next is being simulated by another worker, so
+				// this only waits for it to finish
+				advanced.wait(lock, [&] {
+					return failed || claimed >= trajectories || claimed < next + window;
+				});
+				if (failed || claimed >= trajectories) {
+					return;
+				}
+				i = claimed++;
+			}
+			trajectory.clear();
+			trajectory.reserve((options.samples + 1) * width);
+			RandomStream random(options.seed, i);
+			simulationStats stats;
+			try {
+				stats = SimulateStochastic(network, dependencies, options, random,
+																	 [&](double, const double *state) {
+																		 for (auto s : network.observed) {
+																			 trajectory.push_back(state[s]);
+																		 }
+																	 });
+			} catch (...) {
+				std::lock_guard<std::mutex> lock(mutex);
+				failed = true;
+				advanced.notify_all();
+				throw;
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+			total.steps += stats.steps;
+			total.rejected += stats.rejected;
+			finished.emplace(i, std::move(trajectory));
+			total.peakBuffered = std::max(total.peakBuffered, finished.size());
+			for (auto first = finished.begin();
+					 first != finished.end() && first->first == next;
+					 first = finished.erase(first), next++) {
+				statistics.Add(first->second);
+			}
+			advanced.notify_all();
+		}
+	};
+	TaskGroup group(pool);
+	for (unsigned w = 0; w < workers; w++) {
+		group.Run(work);
+	}
+	group.Wait();
+	return total;
+}
+
+void WriteEnsemble(const KineticNetwork &network,
+									 const simulationOptions &options,
+									 const EnsembleStatistics &statistics, CrnWriter &out) {
+	out.Write("time");
+	for (auto s : network.observed) {
+		for (const char *column : {"mean", "variance"}) {
+			out.Write(',');
+			out.Write(network.names[s]);
+			out.Write('_');
+			out.Write(column);
+		}
+		for (double q : EnsembleStatistics::QUANTILES) {
+			out.Write(',');
+			out.Write(network.names[s]);
+			out.Write("_q" + std::to_string(static_cast<int>(q * 100 + 0.5)));
+		}
+	}
+	out.Write('\n');
+	for (unsigned sample = 0; sample <= options.samples; sample++) {
+		out.WriteDouble(options.endTime * sample / options.samples);
+		for (std::size_t o = 0; o < network.observed.size(); o++) {
+			out.Write(',');
+			out.WriteDouble(statistics.Mean(sample, o));
+			out.Write(',');
+			out.WriteDouble(statistics.Variance(sample, o));
+			for (std::size_t q = 0; q < EnsembleStatistics::QUANTILE_COUNT; q++) {
+				out.Write(',');
+				out.WriteDouble(statistics.Quantile(sample, o, q));
+			}
+		}
+		out.Write('\n');
+	}
+}
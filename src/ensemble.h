@@ -0,0 +1,101 @@
+#pragma once
+#include "simulation.h"
+#include <vector>
+
+class ThreadPool;
+
+/*! \brief An estimate of one quantile of a stream of values, in constant space
+ * \detail The P-square algorithm of Jain and Chlamtac keeps five markers,
+ * the minimum, the maximum, the quantile and two between, and moves them
+ * along a parabola through their neighbours as values arrive. Until five
+ * values have arrived it is exact.
+ */
+class QuantileEstimator {
+public:
+	explicit QuantileEstimator(double quantile);
+
+	void Add(double value);
+	double Value() const;
+
+private:
+	double quantile;
+	std::size_t count = 0;
+	double heights[5];
+	double positions[5];
+	double desired[5];
+};
+
+/*! \brief The mean, variance and quantiles of the observed species of many
+ * trajectories, at every sample time
+ * \detail Trajectories are added one at a time, and only the running
+ * statistics are kept. The estimates depend on the order trajectories are
+ * added in, so RunEnsemble adds them in the order of their streams.
+ */
+class EnsembleStatistics {
+public:
+	//! The quantiles estimated, besides the mean and variance
+	static constexpr double QUANTILES[] = {0.05, 0.5, 0.95};
+	static constexpr std::size_t QUANTILE_COUNT = 3;
+
+	EnsembleStatistics(std::size_t samples, std::size_t observed);
+
+	/**
+	 * Add a trajectory: for every sample in order, the amount of every observed
+	 * specie
+	 */
+	void Add(const std::vector<double> &trajectory);
+
+	std::size_t Count() const {
+		return count;
+	}
+	double Mean(std::size_t sample, std::size_t observed) const {
+		return means[sample * observedCount + observed];
+	}
+	//! The unbiased sample variance, 0 for less than two trajectories
+	double Variance(std::size_t sample, std::size_t observed) const;
+	double Quantile(std::size_t sample, std::size_t observed,
+									std::size_t quantile) const {
+		return quantiles[(sample * observedCount + observed) * QUANTILE_COUNT +
+										 quantile]
+				.Value();
+	}
+
+private:
+	std::size_t observedCount;
+	std::size_t count = 0;
+	// Welford's running mean and sum of squared deviations
+	std::vector<double> means;
+	std::vector<double> squares;
+	std::vector<QuantileEstimator> quantiles;
+};
+
+struct ensembleStats : simulationStats {
+	// The most trajectories held at once, waiting for an earlier one to finish
+	std::size_t peakBuffered = 0;
+};
+
+/**
+ * Simulate trajectories of the network with the stochastic method of the
+ * options, on the threads of pool, or the calling thread without one
+ *
+ * Trajectory i draws from stream i of the seed, and the trajectories are added
+ * to statistics in order as they finish, so the statistics are the same for
+ * any number of threads. The network and its dependency graph are shared by
+ * every simulation.
+ *
+ * A worker per thread takes the trajectories in order, but never starts one
+ * twice the thread count past the earliest unfinished trajectory, so no more
+ * than that many finished trajectories are ever held.
+ */
+ensembleStats RunEnsemble(const KineticNetwork &network,
+														const simulationOptions &options,
+														unsigned trajectories, ThreadPool *pool,
+														EnsembleStatistics &statistics);
+
+/**
+ * Write the statistics as comma separated values: the time, and the mean,
+ * variance and quantiles of every observed specie
+ */
+void WriteEnsemble(const KineticNetwork &network,
+									 const simulationOptions &options,
+									 const EnsembleStatistics &statistics, CrnWriter &out);
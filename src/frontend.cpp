@@ -1,18 +1,156 @@
 #include "frontend.h"
+#include "binarynetwork.h"
+#include "codegen.h"
+#include "crnwriter.h"
+#include "ensemble.h"
+#include "kinetics.h"
+#include "matrixexport.h"
+#include "threadpool.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <memory>
 #include <ostream>
 #include <sys/stat.h>
+#include <unistd.h>
 
 void Frontend::GenerateStringStream() {
 	stream.str(drv->Compile());
 }
 
 void Frontend::WriteFile() {
-	GenerateStringStream();
-	fileStream.open(outputFileName);
-	fileStream << stream.rdbuf();
-	chmod(outputFileName.c_str(), S_IRWXU);
-	fileStream.close();
-	std::cout << "Output written to " << outputFileName << std::endl;
+	if (simulate) {
+		Simulate();
+	} else if (!matrixFormat.empty()) {
+		ExportMatrices();
+	} else if (format == binaryFormat) {
+		WriteWith(outputFileName,
+							[this](CrnWriter &writer) { drv->EmitBinary(writer); });
+	} else if (format == cppFormat) {
+		KineticNetwork network(drv->PrepareMain());
+		WriteWith(outputFileName, [&network](CrnWriter &writer) {
+			WriteNativeKernels(network, writer);
+		});
+	} else {
+		WriteWith(outputFileName,
+							[this](CrnWriter &writer) { drv->Emit(writer); });
+	}
+}
+
+void Frontend::WriteNetwork(const std::string &network) {
+	WriteWith(outputFileName,
+						[&network](CrnWriter &writer) { writer.Write(network); });
+}
+
+void Frontend::DecodeFile(const std::string &binaryFile) {
+	// The network is mapped, not read, so truncating it would pull the pages
+	// out from under the decoder
+	std::error_code error;
+	if (outputFileName != "-" &&
+			std::filesystem::equivalent(binaryFile, outputFileName, error)) {
+		throw WriteFailedException(outputFileName +
+															 ": is the binary network being decoded");
+	}
+	BinaryNetwork network(binaryFile);
+	WriteWith(outputFileName,
+						[&network](CrnWriter &writer) { network.WriteText(writer); });
+}
+
+void Frontend::ExportMatrices() {
+	if (outputFileName == "-") {
+		throw WriteFailedException("matrices are written to files, not stdout");
+	}
+	std::string base = outputFileName;
+	const std::string extension = ".crn";
+	if (base.size() > extension.size() &&
+			base.compare(base.size() - extension.size(), extension.size(),
+									 extension) == 0) {
+		base.resize(base.size() - extension.size());
+	}
+	MatrixExporter exporter(drv->PrepareMain());
+	if (matrixFormat == "csr") {
+		WriteWith(base + ".csr",
+							[&exporter](CrnWriter &writer) { exporter.WriteCsr(writer); });
+	} else {
+		WriteWith(base + ".stoichiometry.mtx", [&exporter](CrnWriter &writer) {
+			exporter.WriteStoichiometry(writer);
+		});
+		WriteWith(base + ".orders.mtx",
+							[&exporter](CrnWriter &writer) { exporter.WriteOrders(writer); });
+		WriteWith(base + ".rates.mtx",
+							[&exporter](CrnWriter &writer) { exporter.WriteRates(writer); });
+	}
+	WriteWith(base + ".index",
+						[&exporter](CrnWriter &writer) { exporter.WriteIndex(writer); });
+}
+
+void Frontend::Simulate() {
+	KineticNetwork network(drv->PrepareMain());
+	std::unique_ptr<NativeKernels> kernels;
+	if (native) {
+		kernels = std::make_unique<NativeKernels>(network);
+		network.UseNative(*kernels);
+	}
+	simulationStats stats;
+	if (ensemble > 0) {
+		std::unique_ptr<ThreadPool> pool;
+		if (ensembleJobs > 1) {
+			pool = std::make_unique<ThreadPool>(ensembleJobs);
+		}
+		EnsembleStatistics statistics(simulation.samples + 1,
+																	network.observed.size());
+		stats = RunEnsemble(network, simulation, ensemble, pool.get(), statistics);
+		WriteWith(outputFileName, [&](CrnWriter &writer) {
+			WriteEnsemble(network, simulation, statistics, writer);
+		});
+	} else {
+		WriteWith(outputFileName, [&](CrnWriter &writer) {
+			WriteSampleHeader(network, writer);
+			stats = RunSimulation(network, simulation,
+														[&](double time, const double *state) {
+															WriteSample(network, writer, time, state);
+														});
+		});
+	}
+	if (verbose) {
+		std::cerr << "simulate: " << stats.steps << " steps, " << stats.rejected
+							<< " rejected" << std::endl;
+	}
+}
+
+void Frontend::WriteWith(const std::string &fileName,
+												 const std::function<void(CrnWriter &)> &emit) {
+	if (fileName == "-") {
+		CrnWriter writer(STDOUT_FILENO);
+		emit(writer);
+		writer.Flush();
+		return;
+	}
+
+	int fd = open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU);
+	if (fd < 0) {
+		throw WriteFailedException(fileName + ": " + std::strerror(errno));
+	}
+	try {
+		CrnWriter writer(fd);
+		emit(writer);
+		writer.Flush();
+	} catch (...) {
+		// Leave no truncated output behind, but never remove a device or pipe
+		struct stat info;
+		bool regular = fstat(fd, &info) == 0 && S_ISREG(info.st_mode);
+		close(fd);
+		if (regular) {
+			unlink(fileName.c_str());
+		}
+		throw;
+	}
+	fchmod(fd, S_IRWXU);
+	close(fd);
+	if (verbose) {
+		std::cout << "Output written to " << fileName << std::endl;
+	}
 }
 
 void Frontend::Exception(Error errorCode, const std::string &input) {
@@ -36,8 +174,30 @@ void Frontend::Exception(Error errorCode, const std::string &input) {
 
 void Frontend::PrintHelper() {
 	std::string helperstring = "Usage:  chemilang filename [OPTIONS]\n"
+														 "        chemilang --batch filename... [OPTIONS]\n"
 														 "Options:\n"
-														 "    -o  Output filename\n"
+														 "    -o  Output filename, or - for stdout\n"
+														 "    -j, --jobs N  Parse imports and flatten compositions on N threads\n"
+														 "    -O  Optimize the network, keeping the outputs the same\n"
+														 "    --passes LIST  Run the comma separated optimization passes\n"
+														 "    --format=FORMAT  Write the network as text, bin for binary, or cpp for\n"
+														 "        C++ kernels computing its rates and Jacobian\n"
+														 "    --decode FILE  Write the binary network in FILE as text\n"
+														 "    --matrices FORMAT  Write the matrices of the network, as mm or csr\n"
+														 "    --simulate END  Simulate the network until END, writing the outputs\n"
+														 "    --samples N  Write N + 1 evenly spaced samples of the simulation\n"
+														 "    --method NAME  Simulate with rk45, rosenbrock for stiff networks, or ssa\n"
+														 "        or tau for one exact or tau leaping stochastic trajectory\n"
+														 "    --seed N  Seed the random numbers of stochastic simulations\n"
+														 "    --ensemble N  Simulate N stochastic trajectories on -j threads, writing\n"
+														 "        the mean, variance and quantiles of the outputs\n"
+														 "    --native  Compile the kernels of the network before simulating it\n"
+														 "    --no-cache  Always parse imports, instead of using the module cache\n"
+														 "    --batch  Compile every file given, -o names a directory\n"
+														 "    --manifest FILE  Compile every file listed in FILE\n"
+														 "    --watch  Compile again whenever the file or its imports change\n"
+														 "    --serve SOCKET  Compile requests from clients on a Unix socket\n"
+														 "    --client SOCKET  Compile on the server at SOCKET, if one is running\n"
 														 "    -h  Display help information";
 	std::cout << helperstring << std::endl;
 };
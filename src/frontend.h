@@ -1,5 +1,7 @@
 #include "driver.h"
+#include "simulation.h"
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <sstream>
 #include <stdlib.h>
@@ -12,6 +14,13 @@ enum Error {
 	outFileError = 3,
 };
 
+enum OutputFormat {
+	textFormat,
+	binaryFormat,
+	//! C++ source of the kernels of the network
+	cppFormat,
+};
+
 class Frontend {
 public:
 	driver *drv;
@@ -19,9 +28,41 @@ public:
 	static void PrintHelper();
 	static void Exception(Error errorCode, const std::string &input);
 	void GenerateStringStream();
+	//! Stream the compiled network to outputFileName, or stdout if it is "-"
 	void WriteFile();
+	//! Write a network compiled elsewhere, in the same way as WriteFile
+	void WriteNetwork(const std::string &network);
+	/**
+	 * Write a binary network file as text
+	 *
+	 * Throws WriteFailedException if outputFileName is the binary file itself.
+	 */
+	void DecodeFile(const std::string &binaryFile);
+	/**
+	 * Write the matrices of the compiled network, and their index
+	 *
+	 * The files are named after outputFileName, without its .crn extension.
+	 */
+	void ExportMatrices();
+	//! Simulate the compiled network, and write the observed species over time
+	void Simulate();
 	std::string outputFileName = "out.crn";
+	// Whether to report every file written
+	bool verbose = true;
+	OutputFormat format = textFormat;
+	// When "mm" or "csr", WriteFile exports matrices in that format instead
+	std::string matrixFormat;
+	// Whether WriteFile simulates the network instead, with these options
+	bool simulate = false;
+	simulationOptions simulation;
+	// Whether simulations compile the kernels of the network to native code
+	bool native = false;
+	// When positive, Simulate writes statistics of this many stochastic
+	// trajectories instead, simulated on ensembleJobs threads
+	unsigned ensemble = 0;
+	unsigned ensembleJobs = 1;
 
 private:
-	std::ofstream fileStream;
+	void WriteWith(const std::string &fileName,
+								 const std::function<void(CrnWriter &)> &emit);
 };
@@ -0,0 +1,119 @@
+#include "incremental.h"
+#include "composition.h"
+#include "modulecache.h"
+#include <exception>
+#include <thread>
+
+IncrementalCompiler::IncrementalCompiler(std::string fileName,
+																				 std::string cacheDirectory,
+																				 unsigned jobs, unsigned passes)
+		: fileName(std::move(fileName)), cacheDirectory(std::move(cacheDirectory)),
+			jobs(jobs), passes(passes) {}
+
+int IncrementalCompiler::Compile(std::string &out) {
+	driver drv;
+	drv.jobs = jobs;
+	drv.optimizer.passes = passes;
+	drv.cacheDirectory = cacheDirectory;
+	drv.diagnostics = diagnostics;
+	int res = drv.parse_file(fileName);
+	files = drv.ImportedFiles();
+	if (res != 0) {
+		return res;
+	}
+
+	// The hash of a module together with everything it composes. Modules can
+	// only compose modules defined before them, so there are no cycles.
+	std::map<const Module *, std::uint64_t> hashes;
+	std::function<std::uint64_t(Module *)> hashOf =
+			[&](Module *m) -> std::uint64_t {
+		auto it = hashes.find(m);
+		if (it != hashes.end()) {
+			return it->second;
+		}
+		std::vector<Module *> subModules;
+		for (const Composition *comp : m->compositions) {
+			comp->AddSubModules(subModules);
+		}
+		std::string key = std::to_string(ModuleCache::ContentHash(*m));
+		for (Module *sub : subModules) {
+			key += ":" + std::to_string(hashOf(sub));
+		}
+		std::uint64_t hash = ModuleCache::Hash(key);
+		hashes.insert(std::make_pair(m, hash));
+		return hash;
+	};
+	for (auto &m : drv.modules) {
+		hashOf(&m.second);
+	}
+
+	auto main = drv.modules.find("main");
+	if (main != drv.modules.end() && !network.empty() &&
+			hashes[&main->second] == mainHash) {
+		reflattened = 0;
+		out = network;
+		return 0;
+	}
+
+	std::set<const Module *> reused;
+	for (auto &m : drv.modules) {
+		auto old = templates.find(m.first);
+		if (old != templates.end() && old->second.hash == hashes[&m.second]) {
+			m.second.SetFlatTemplate(old->second.flat);
+			reused.insert(&m.second);
+		}
+	}
+	out = drv.Compile();
+	report = FormatReport(drv.optimizer.Report());
+
+	// Keep the templates of this compile only, so removed modules are dropped
+	std::map<std::string, flatEntry> flattened;
+	reflattened = 0;
+	for (const auto &m : drv.modules) {
+		auto flat = m.second.FlatTemplate();
+		if (flat) {
+			flattened[m.first] = {hashes[&m.second], flat};
+			if (reused.count(&m.second) == 0) {
+				reflattened++;
+			}
+		}
+	}
+	templates = std::move(flattened);
+	mainHash = hashes[&drv.modules["main"]];
+	network = out;
+	return 0;
+}
+
+void IncrementalCompiler::Watch(
+		const std::function<bool(int res, const std::string &network)> &onCompile,
+		std::chrono::milliseconds interval) {
+	while (true) {
+		std::string out;
+		int res;
+		try {
+			res = Compile(out);
+		} catch (const std::exception &e) {
+			*diagnostics << e.what() << std::endl;
+			res = 1;
+		}
+		if (!onCompile(res, out)) {
+			return;
+		}
+		// Files are polled, which works the same for every file system
+		auto times = FileTimes();
+		while (FileTimes() == times) {
+			std::this_thread::sleep_for(interval);
+		}
+	}
+}
+
+std::map<std::string, std::filesystem::file_time_type>
+IncrementalCompiler::FileTimes() const {
+	std::map<std::string, std::filesystem::file_time_type> times;
+	std::error_code ec;
+	times[fileName] = std::filesystem::last_write_time(fileName, ec);
+	for (const auto &file : files) {
+		times[file] = std::filesystem::last_write_time(file, ec);
+	}
+	return times;
+}
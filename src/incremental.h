@@ -0,0 +1,74 @@
+#pragma once
+#include "driver.h"
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <set>
+#include <string>
+
+/*! \brief Recompiles a file, redoing only the work its changes affect
+ * \detail Every compile hashes each module twice: once for what it defines
+ * itself, and once together with everything it transitively composes. The
+ * flattened templates are kept between compiles, keyed by the second hash, and
+ * a module whose hash is unchanged reuses its old template instead of being
+ * flattened again. When nothing main depends on changed, the previous network
+ * is returned as is. Unchanged imports are read from the module cache rather
+ * than parsed, if it is enabled.
+ */
+class IncrementalCompiler {
+public:
+	IncrementalCompiler(std::string fileName, std::string cacheDirectory = "",
+											unsigned jobs = 1, unsigned passes = 0);
+
+	/**
+	 * Compile the file as it is now
+	 *
+	 * Returns 0 and the network in out on success. Syntax errors are written to
+	 * diagnostics, other errors are thrown.
+	 */
+	int Compile(std::string &out);
+	/**
+	 * Compile the file, and again every time it or one of its imports changes
+	 *
+	 * onCompile gets the result of each compile, and watching stops when it
+	 * returns false. Errors are reported and watching continues, so they can
+	 * be fixed in place.
+	 */
+	void Watch(const std::function<bool(int res, const std::string &network)>
+								 &onCompile,
+						 std::chrono::milliseconds interval = std::chrono::milliseconds(250));
+
+	//! What the optimization passes changed in the last network compiled
+	const std::string &Report() const {
+		return report;
+	}
+	//! The number of modules the last compile had to flatten
+	size_t Reflattened() const {
+		return reflattened;
+	}
+
+	std::ostream *diagnostics = &std::cerr;
+
+private:
+	struct flatEntry {
+		std::uint64_t hash;
+		std::shared_ptr<const ModuleTemplate> flat;
+	};
+	//! The modification time of every file read by the last compile
+	std::map<std::string, std::filesystem::file_time_type> FileTimes() const;
+
+	std::string fileName;
+	std::string cacheDirectory;
+	unsigned jobs;
+	unsigned passes;
+	std::set<std::string> files;
+	std::map<std::string, flatEntry> templates;
+	std::uint64_t mainHash = 0;
+	std::string network;
+	std::string report;
+	size_t reflattened = 0;
+};
@@ -0,0 +1,156 @@
+#include "kinetics.h"
+#include "binarynetwork.h"
+#include "codegen.h"
+#include "module.h"
+#include "netchange.h"
+#include <algorithm>
+#include <unordered_map>
+
+KineticNetwork::KineticNetwork(const Module &module) {
+	std::vector<specie> species = SpeciesByName(module);
+	std::unordered_map<specie, std::uint32_t> number;
+	names.reserve(species.size());
+	for (std::size_t i = 0; i < species.size(); i++) {
+		number.emplace(species[i], static_cast<std::uint32_t>(i));
+		names.push_back(species[i].Name());
+	}
+
+	initialState.assign(species.size(), 0);
+	for (const auto &c : module.concentrations) {
+		initialState[number.at(c.first)] = c.second;
+	}
+	for (const auto &s : module.outputSpecies) {
+		observed.push_back(number.at(s));
+	}
+	if (observed.empty()) {
+		for (std::uint32_t i = 0; i < species.size(); i++) {
+			observed.push_back(i);
+		}
+	}
+
+	const std::size_t reactions = module.reactions.size();
+	rates.reserve(reactions);
+	reactantOffsets.reserve(reactions + 1);
+	changeOffsets.reserve(reactions + 1);
+	reactantOffsets.push_back(0);
+	changeOffsets.push_back(0);
+	std::vector<std::pair<std::uint32_t, int>> side;
+	for (const auto &r : module.reactions) {
+		rates.push_back(r.rate);
+		side.clear();
+		for (const auto &ratio : r.reactants) {
+			side.emplace_back(number.at(ratio.first), ratio.second);
+		}
+		std::sort(side.begin(), side.end());
+		for (const auto &entry : side) {
+			reactantSpecies.push_back(entry.first);
+			reactantOrders.push_back(entry.second);
+		}
+		reactantOffsets.push_back(static_cast<std::uint32_t>(side.size() +
+																												 reactantOffsets.back()));
+
+		side.clear();
+		ForEachNetChange(r, [&](const specie &s, int delta) {
+			side.emplace_back(number.at(s), delta);
+		});
+		std::sort(side.begin(), side.end());
+		for (const auto &entry : side) {
+			changeSpecies.push_back(entry.first);
+			changeAmounts.push_back(entry.second);
+		}
+		changeOffsets.push_back(
+				static_cast<std::uint32_t>(side.size() + changeOffsets.back()));
+	}
+	BuildJacobian();
+}
+
+void KineticNetwork::BuildJacobian() {
+	// Reaction r contributes to the entry of every specie it changes, for every
+	// reactant its rate depends on
+	std::vector<std::pair<std::uint64_t, jacobianTerm>> terms;
+	auto position = [](std::uint32_t row, std::uint32_t column) {
+		return (std::uint64_t(row) << 32) | column;
+	};
+	for (std::uint32_t s = 0; s < SpeciesCount(); s++) {
+		terms.push_back({position(s, s), {0, 0, 0, 0}});
+	}
+	for (std::uint32_t r = 0; r < ReactionCount(); r++) {
+		for (auto i = reactantOffsets[r]; i < reactantOffsets[r + 1]; i++) {
+			for (auto c = changeOffsets[r]; c < changeOffsets[r + 1]; c++) {
+				terms.push_back(
+						{position(changeSpecies[c], reactantSpecies[i]),
+						 {0, r, i, double(changeAmounts[c]) * reactantOrders[i]}});
+			}
+		}
+	}
+	std::stable_sort(
+			terms.begin(), terms.end(),
+			[](const auto &a, const auto &b) { return a.first < b.first; });
+
+	jacobianOffsets.assign(SpeciesCount() + 1, 0);
+	for (std::size_t i = 0; i < terms.size(); i++) {
+		bool newEntry = i == 0 || terms[i].first != terms[i - 1].first;
+		if (newEntry) {
+			jacobianOffsets[(terms[i].first >> 32) + 1]++;
+			jacobianColumns.push_back(static_cast<std::uint32_t>(terms[i].first));
+		}
+		// The diagonal placeholders have no coefficient
+		if (terms[i].second.coefficient != 0) {
+			jacobianTerm term = terms[i].second;
+			term.entry = static_cast<std::uint32_t>(jacobianColumns.size() - 1);
+			jacobianTerms.push_back(term);
+		}
+	}
+	for (std::size_t s = 0; s < SpeciesCount(); s++) {
+		jacobianOffsets[s + 1] += jacobianOffsets[s];
+	}
+}
+
+void KineticNetwork::UseNative(const NativeKernels &kernels) {
+	native = &kernels;
+}
+
+void KineticNetwork::Propensities(const double *state,
+																	double *propensities) const {
+	if (native != nullptr) {
+		native->propensities(state, propensities);
+		return;
+	}
+	for (std::size_t r = 0; r < ReactionCount(); r++) {
+		propensities[r] = Propensity(r, state);
+	}
+}
+
+void KineticNetwork::Jacobian(const double *state, double *values) const {
+	if (native != nullptr) {
+		native->jacobian(state, values);
+		return;
+	}
+	std::fill(values, values + jacobianColumns.size(), 0.0);
+	for (const auto &term : jacobianTerms) {
+		// The rate, differentiated by one factor of the reactant
+		double d = term.coefficient * rates[term.reaction];
+		for (auto i = reactantOffsets[term.reaction];
+				 i < reactantOffsets[term.reaction + 1]; i++) {
+			int power = reactantOrders[i] - (i == term.reactant ? 1 : 0);
+			for (int n = 0; n < power; n++) {
+				d *= state[reactantSpecies[i]];
+			}
+		}
+		values[term.entry] += d;
+	}
+}
+
+void KineticNetwork::Derivative(const double *state, double *derivative) const {
+	if (native != nullptr) {
+		native->rhs(state, derivative);
+		return;
+	}
+	std::fill(derivative, derivative + SpeciesCount(), 0.0);
+	for (std::size_t r = 0; r < ReactionCount(); r++) {
+		double a = Propensity(r, state);
+		for (auto i = changeOffsets[r]; i < changeOffsets[r + 1]; i++) {
+			derivative[changeSpecies[i]] += changeAmounts[i] * a;
+		}
+	}
+}
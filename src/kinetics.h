@@ -0,0 +1,109 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Module;
+class NativeKernels;
+
+//! How one reaction contributes to one entry of the Jacobian
+struct jacobianTerm {
+	std::uint32_t entry;
+	std::uint32_t reaction;
+	//! The reactant differentiated by, as an index into reactantSpecies
+	std::uint32_t reactant;
+	//! The net change of the row specie times the order of the reactant
+	double coefficient;
+};
+
+/*! \brief A prepared network, lowered for simulation
+ * \detail Species are numbered as in the binary network format, and the
+ * state of a simulation is a plain array of one amount per specie. Each
+ * property of the reactions is an array of its own, and both the reactants
+ * and the net changes of every reaction are compressed sparse rows, so the
+ * kernels below walk contiguous memory and never look up a specie by name.
+ *
+ * The network is never modified once it is built and its kernels are chosen,
+ * so any number of simulations may share it.
+ */
+class KineticNetwork {
+public:
+	explicit KineticNetwork(const Module &module);
+
+	std::size_t SpeciesCount() const {
+		return names.size();
+	}
+	std::size_t ReactionCount() const {
+		return rates.size();
+	}
+
+	/**
+	 * The mass action rate of reaction r, the rate constant times every
+	 * reactant amount to the power of its coefficient
+	 */
+	double Propensity(std::size_t r, const double *state) const {
+		double a = rates[r];
+		for (auto i = reactantOffsets[r]; i < reactantOffsets[r + 1]; i++) {
+			for (int n = 0; n < reactantOrders[i]; n++) {
+				a *= state[reactantSpecies[i]];
+			}
+		}
+		return a;
+	}
+	/**
+	 * The propensity of reaction r with the amounts in state as molecule
+	 * counts: the rate constant times the number of ordered ways to pick the
+	 * reactants, x (x - 1) ... for a reactant of order n. It tends to
+	 * Propensity as the counts grow.
+	 */
+	double StochasticPropensity(std::size_t r, const double *state) const {
+		double a = rates[r];
+		for (auto i = reactantOffsets[r]; i < reactantOffsets[r + 1]; i++) {
+			for (int n = 0; n < reactantOrders[i]; n++) {
+				a *= state[reactantSpecies[i]] - n;
+			}
+		}
+		return a;
+	}
+	//! Write the rate of change of every specie in state to derivative
+	void Derivative(const double *state, double *derivative) const;
+	//! Write the rate of every reaction to propensities
+	void Propensities(const double *state, double *propensities) const;
+	/**
+	 * Write the entries of the Jacobian of Derivative to values, in the order
+	 * of jacobianColumns
+	 */
+	void Jacobian(const double *state, double *values) const;
+	/**
+	 * Use kernels generated for this network instead of interpreting the
+	 * arrays. The kernels must outlive the network.
+	 */
+	void UseNative(const NativeKernels &kernels);
+
+	std::vector<std::string> names;
+	std::vector<double> initialState;
+	//! The species written by a simulation, the outputs of the module if any
+	std::vector<std::uint32_t> observed;
+
+	std::vector<double> rates;
+	std::vector<std::uint32_t> reactantOffsets;
+	std::vector<std::uint32_t> reactantSpecies;
+	std::vector<int> reactantOrders;
+	std::vector<std::uint32_t> changeOffsets;
+	std::vector<std::uint32_t> changeSpecies;
+	std::vector<int> changeAmounts;
+
+	/**
+	 * The sparsity pattern of the Jacobian, a row for each specie, and the
+	 * columns of its nonzero entries in order. The diagonal is always included,
+	 * so a matrix like I - hJ has the same pattern.
+	 */
+	std::vector<std::uint32_t> jacobianOffsets;
+	std::vector<std::uint32_t> jacobianColumns;
+	//! The derivatives making up the Jacobian, ordered by entry
+	std::vector<jacobianTerm> jacobianTerms;
+
+private:
+	void BuildJacobian();
+	const NativeKernels *native = nullptr;
+};
@@ -0,0 +1,160 @@
+#include "module.h"
+#include "optimizer.h"
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+//! Whether r is `x ->(k) x + y` for a single x
+bool IsCatalyticProduction(const reaction &r, specie &x, specie &y) {
+	if (r.reactants.size() != 1 || r.products.size() != 2) {
+		return false;
+	}
+	const speciesRatio &from = *r.reactants.begin();
+	if (from.second != 1) {
+		return false;
+	}
+	for (const auto &ratio : r.products) {
+		if (ratio.second != 1) {
+			return false;
+		}
+		if (ratio.first != from.first) {
+			y = ratio.first;
+		}
+	}
+	x = from.first;
+	return r.products.count(x) != 0 && y != x;
+}
+
+//! Whether r is `y ->(k) 0`
+bool IsDecay(const reaction &r, specie &y) {
+	if (r.reactants.size() != 1 || !r.products.empty() ||
+			r.reactants.begin()->second != 1) {
+		return false;
+	}
+	y = r.reactants.begin()->first;
+	return true;
+}
+
+//! The composition of the fused instance, as it would be written
+std::string InstanceName(const specie &x, const specie &y, reactionRate rate) {
+	// The rates of link and copy in chemlib
+	std::string module = rate == 1 ? "link" : rate == 100 ? "copy" : "";
+	if (module.empty()) {
+		std::ostringstream rateText;
+		rateText << rate;
+		return x.Name() + " ->(" + rateText.str() + ") " + x.Name() + " + " +
+					 y.Name() + "; " + y.Name() + " ->(" + rateText.str() + ") 0";
+	}
+	return y.Name() + " = " + module + "(" + x.Name() + ")";
+}
+} // namespace
+
+passResult FuseLinks(Module &module) {
+	std::vector<reaction> &reactions = module.reactions;
+	struct candidate {
+		size_t production = SIZE_MAX;
+		size_t decay = SIZE_MAX;
+		specie source;
+		// Whether another reaction changes the amount of the specie
+		bool changedElsewhere = false;
+	};
+	std::unordered_map<specie, candidate> candidates;
+	for (size_t i = 0; i < reactions.size(); i++) {
+		const reaction &r = reactions[i];
+		specie x;
+		specie y;
+		if (IsCatalyticProduction(r, x, y)) {
+			candidate &c = candidates[y];
+			c.changedElsewhere |= c.production != SIZE_MAX;
+			c.production = i;
+			c.source = x;
+			continue;
+		}
+		if (IsDecay(r, y)) {
+			candidate &c = candidates[y];
+			c.changedElsewhere |= c.decay != SIZE_MAX;
+			c.decay = i;
+			continue;
+		}
+		// Any other reaction may only use a pass-through specie as a catalyst
+		for (const auto &ratio : r.reactants) {
+			auto other = r.products.find(ratio.first);
+			if (other == r.products.end() || other->second != ratio.second) {
+				candidates[ratio.first].changedElsewhere = true;
+			}
+		}
+		for (const auto &ratio : r.products) {
+			if (r.reactants.count(ratio.first) == 0) {
+				candidates[ratio.first].changedElsewhere = true;
+			}
+		}
+	}
+
+	std::unordered_set<specie> pinned(module.outputSpecies.begin(),
+																		module.outputSpecies.end());
+	pinned.insert(module.inputSpecies.begin(), module.inputSpecies.end());
+	std::unordered_map<specie, specie> alias;
+	auto resolve = [&alias](specie s) {
+		for (auto it = alias.find(s); it != alias.end(); it = alias.find(s)) {
+			s = it->second;
+		}
+		return s;
+	};
+	std::vector<char> removed(reactions.size(), false);
+	passResult result{"fuse", ""};
+	// Candidates are visited in reaction order, so the report is stable
+	for (size_t i = 0; i < reactions.size(); i++) {
+		specie x;
+		specie y;
+		if (!IsCatalyticProduction(reactions[i], x, y)) {
+			continue;
+		}
+		const candidate &c = candidates[y];
+		// y tracks x at the same rate it decays, so it settles at the value of x
+		if (c.production != i || c.decay == SIZE_MAX || c.changedElsewhere ||
+				reactions[c.decay].rate != reactions[i].rate ||
+				pinned.count(y) != 0 || module.concentrations.count(y) != 0 ||
+				resolve(x) == y) {
+			continue;
+		}
+		alias[y] = x;
+		removed[i] = true;
+		removed[c.decay] = true;
+		result.details.push_back(InstanceName(x, y, reactions[i].rate));
+	}
+
+	auto substitute = [&](speciesRatios &side) {
+		speciesRatios res;
+		for (const auto &ratio : side) {
+			res[resolve(ratio.first)] += ratio.second;
+		}
+		side = std::move(res);
+	};
+	size_t kept = 0;
+	for (size_t i = 0; i < reactions.size(); i++) {
+		if (removed[i]) {
+			continue;
+		}
+		if (!alias.empty()) {
+			substitute(reactions[i].reactants);
+			substitute(reactions[i].products);
+		}
+		if (kept != i) {
+			reactions[kept] = std::move(reactions[i]);
+		}
+		kept++;
+	}
+	reactions.resize(kept);
+	std::vector<specie> privateSpecies;
+	for (const auto &s : module.privateSpecies) {
+		if (alias.count(s) == 0) {
+			privateSpecies.push_back(s);
+		}
+	}
+	module.privateSpecies = std::move(privateSpecies);
+
+	result.summary = "fused " + std::to_string(alias.size()) +
+									 " pass-through species";
+	return result;
+}
@@ -1,18 +1,106 @@
+#include "batch.h"
+#include "binarynetwork.h"
+#include "codegen.h"
+#include "compileserver.h"
 #include "driver.h"
 #include "frontend.h"
+#include "incremental.h"
+#include "modulecache.h"
 #include "sysexits.h"
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 
 bool file_included(const std::string &filename) {
 	return std::ifstream(filename).good();
 }
 
+bool ParseCount(const std::string &arg, unsigned long max, unsigned &count) {
+	char *end = nullptr;
+	unsigned long n = strtoul(arg.c_str(), &end, 10);
+	if (arg.empty() || *end != '\0' || n == 0 || n > max) {
+		return false;
+	}
+	count = static_cast<unsigned>(n);
+	return true;
+}
+
+bool ParseJobs(const std::string &arg, unsigned &jobs) {
+	return ParseCount(arg, 1024, jobs);
+}
+
+bool ParseSeed(const std::string &arg, std::uint64_t &seed) {
+	char *end = nullptr;
+	unsigned long long n = strtoull(arg.c_str(), &end, 10);
+	if (arg.empty() || *end != '\0' || arg[0] == '-') {
+		return false;
+	}
+	seed = n;
+	return true;
+}
+
+bool ParsePositive(const std::string &arg, double &value) {
+	char *end = nullptr;
+	double d = strtod(arg.c_str(), &end);
+	if (arg.empty() || *end != '\0' || !(d > 0) || !std::isfinite(d)) {
+		return false;
+	}
+	value = d;
+	return true;
+}
+
+// Compile filename on the server. Returns -1 if no server is running.
+int CompileOnServer(const std::string &socketPath, const std::string &filename,
+										driver &drv, Frontend &frontend) {
+	compileRequest request;
+	std::stringstream source;
+	source << std::ifstream(filename).rdbuf();
+	request.source = source.str();
+	request.path = std::filesystem::canonical(filename).string();
+	request.workingDirectory = std::filesystem::current_path().string();
+	request.jobs = drv.jobs;
+	request.passes = drv.optimizer.passes;
+	compileResult result;
+	if (!CompileRemote(socketPath, request, result)) {
+		return -1;
+	}
+	if (!result.ok) {
+		std::cerr << result.output;
+		return EX_DATAERR;
+	}
+	try {
+		frontend.WriteNetwork(result.output);
+	} catch (const WriteFailedException &e) {
+		std::cerr << e.what() << std::endl;
+		return EX_CANTCREAT;
+	}
+	std::cerr << result.report;
+	return EX_OK;
+}
+
 int main(int argc, char *argv[]) {
 	Frontend frontend;
 	std::string filename;
+	std::vector<std::string> inputs;
+	std::string manifest;
+	bool batch = false;
+	bool outputGiven = false;
+	bool jobsGiven = false;
+	bool methodGiven = false;
+	std::string serveSocket;
+	std::string clientSocket;
+	bool watch = false;
+	std::string decodeFile;
 	driver drv;
+	drv.cacheDirectory = ModuleCache::DefaultDirectory();
 	if (argv[argc - 1] == std::string("-h") ||
 			argv[argc - 1] == std::string("-help")) {
 		Frontend::PrintHelper();
@@ -22,21 +110,225 @@ int main(int argc, char *argv[]) {
 	for (int i = 1; i < argc; ++i) {
 		if (file_included(argv[i])) {
 			filename = argv[i];
-		} else if (argv[i] == std::string("-o") && argc == 4) {
+			inputs.push_back(filename);
+		} else if (argv[i] == std::string("-o") && i + 1 < argc) {
 			frontend.outputFileName = std::string(argv[++i]);
-		} else if (argv[i] == std::string("-o") && argc <= 3) {
+			outputGiven = true;
+		} else if (argv[i] == std::string("-o")) {
 			Frontend::Exception(outFileError, argv[i]);
 			return EX_USAGE;
+		} else if (argv[i] == std::string("-j") ||
+							 argv[i] == std::string("--jobs")) {
+			if (i + 1 >= argc || !ParseJobs(argv[i + 1], drv.jobs)) {
+				Frontend::Exception(argError, argv[i]);
+				return EX_USAGE;
+			}
+			jobsGiven = true;
+			i++;
+		} else if (argv[i] == std::string("-O")) {
+			drv.optimizer.passes = Optimizer::ALL_PASSES;
+		} else if (argv[i] == std::string("--passes")) {
+			if (i + 1 >= argc || !drv.optimizer.EnablePasses(argv[i + 1])) {
+				Frontend::Exception(argError, argv[i]);
+				return EX_USAGE;
+			}
+			i++;
+		} else if (argv[i] == std::string("--format=text")) {
+			frontend.format = textFormat;
+		} else if (argv[i] == std::string("--format=bin")) {
+			frontend.format = binaryFormat;
+		} else if (argv[i] == std::string("--format=cpp")) {
+			frontend.format = cppFormat;
+		} else if (argv[i] == std::string("--native")) {
+			frontend.native = true;
+		} else if (argv[i] == std::string("--matrices")) {
+			if (i + 1 >= argc || (argv[i + 1] != std::string("mm") &&
+														argv[i + 1] != std::string("csr"))) {
+				Frontend::Exception(argError, argv[i]);
+				return EX_USAGE;
+			}
+			frontend.matrixFormat = argv[++i];
+		} else if (argv[i] == std::string("--simulate")) {
+			if (i + 1 >= argc ||
+					!ParsePositive(argv[i + 1], frontend.simulation.endTime)) {
+				Frontend::Exception(argError, argv[i]);
+				return EX_USAGE;
+			}
+			frontend.simulate = true;
+			i++;
+		} else if (argv[i] == std::string("--samples")) {
+			if (i + 1 >= argc ||
+					!ParseCount(argv[i + 1], 100000000, frontend.simulation.samples)) {
+				Frontend::Exception(argError, argv[i]);
+				return EX_USAGE;
+			}
+			i++;
+		} else if (argv[i] == std::string("--method")) {
+			if (i + 1 >= argc ||
+					!ParseMethod(argv[i + 1], frontend.simulation.method)) {
+				Frontend::Exception(argError, argv[i]);
+				return EX_USAGE;
+			}
+			methodGiven = true;
+			i++;
+		} else if (argv[i] == std::string("--ensemble")) {
+			if (i + 1 >= argc ||
+					!ParseCount(argv[i + 1], 100000000, frontend.ensemble)) {
+				Frontend::Exception(argError, argv[i]);
+				return EX_USAGE;
+			}
+			i++;
+		} else if (argv[i] == std::string("--seed")) {
+			if (i + 1 >= argc || !ParseSeed(argv[i + 1], frontend.simulation.seed)) {
+				Frontend::Exception(argError, argv[i]);
+				return EX_USAGE;
+			}
+			i++;
+		} else if (argv[i] == std::string("--decode") && i + 1 < argc) {
+			decodeFile = argv[++i];
+		} else if (argv[i] == std::string("--batch")) {
+			batch = true;
+		} else if (argv[i] == std::string("--manifest") && i + 1 < argc) {
+			manifest = argv[++i];
+		} else if (argv[i] == std::string("--no-cache")) {
+			drv.cacheDirectory.clear();
+		} else if (argv[i] == std::string("--watch")) {
+			watch = true;
+		} else if (argv[i] == std::string("--serve") && i + 1 < argc) {
+			serveSocket = argv[++i];
+		} else if (argv[i] == std::string("--client") && i + 1 < argc) {
+			clientSocket = argv[++i];
 		} else {
 			Frontend::Exception(fileError, argv[i]);
 			return EX_DATAERR;
 		}
 	}
+	// The matrices are several files named after the output
+	if (!frontend.matrixFormat.empty() && frontend.outputFileName == "-") {
+		Frontend::Exception(argError, "--matrices");
+		return EX_USAGE;
+	}
+	if (frontend.ensemble > 0) {
+		// Ensembles are of exact stochastic trajectories, unless told otherwise
+		if (!methodGiven) {
+			frontend.simulation.method = ssaMethod;
+		}
+		if (!frontend.simulate || !IsStochastic(frontend.simulation.method)) {
+			Frontend::Exception(argError, "--ensemble");
+			return EX_USAGE;
+		}
+		frontend.ensembleJobs =
+				jobsGiven ? drv.jobs : std::max(1u, std::thread::hardware_concurrency());
+	}
+	// The kernels compute the rates of the deterministic methods only
+	if (frontend.native && frontend.simulate &&
+			IsStochastic(frontend.simulation.method)) {
+		Frontend::Exception(argError, "--native");
+		return EX_USAGE;
+	}
+
+	if (!decodeFile.empty()) {
+		try {
+			frontend.DecodeFile(decodeFile);
+		} catch (const BadNetworkFileException &e) {
+			std::cerr << e.what() << std::endl;
+			return EX_DATAERR;
+		} catch (const WriteFailedException &e) {
+			std::cerr << e.what() << std::endl;
+			return EX_CANTCREAT;
+		}
+		return EX_OK;
+	}
+
+	if (batch || !manifest.empty() || inputs.size() > 1) {
+		// -o names a directory for all the outputs
+		std::string outputDirectory = outputGiven ? frontend.outputFileName : "";
+		std::vector<batchItem> items;
+		if (!manifest.empty()) {
+			try {
+				items = ReadManifest(manifest, outputDirectory);
+			} catch (const std::runtime_error &e) {
+				std::cerr << e.what() << std::endl;
+				return EX_NOINPUT;
+			}
+		}
+		for (const auto &input : inputs) {
+			items.push_back({input, BatchOutputName(input, outputDirectory)});
+		}
+		unsigned jobs = drv.jobs;
+		if (!jobsGiven) {
+			jobs = std::max(1u, std::thread::hardware_concurrency());
+		}
+		size_t failed =
+				CompileBatch(items, jobs, std::cerr, drv.optimizer.passes);
+		std::cout << items.size() - failed << " of " << items.size()
+							<< " outputs written" << std::endl;
+		return failed == 0 ? EX_OK : EX_DATAERR;
+	}
+
+	if (!serveSocket.empty()) {
+		try {
+			// The server is all the process does, so it owns every name
+			CompileServer server(serveSocket, true);
+			server.Serve();
+		} catch (const SocketException &e) {
+			std::cerr << e.what() << std::endl;
+			return EX_OSERR;
+		}
+		return EX_OK;
+	}
+	if (frontend.simulate && !outputGiven) {
+		frontend.outputFileName = "-";
+	} else if (frontend.format == binaryFormat && !outputGiven) {
+		// Kept apart from out.crn, which --decode writes by default
+		frontend.outputFileName = "out.crnb";
+	}
+	// The server only returns text
+	if (!clientSocket.empty() && !filename.empty() && frontend.format == textFormat &&
+			frontend.matrixFormat.empty() && !frontend.simulate) {
+		int res = CompileOnServer(clientSocket, filename, drv, frontend);
+		if (res >= 0) {
+			return res;
+		}
+		// No server is running, so compile here instead
+	}
+
+	if (watch) {
+		IncrementalCompiler compiler(filename, drv.cacheDirectory, drv.jobs,
+																 drv.optimizer.passes);
+		compiler.Watch([&](int res, const std::string &network) {
+			if (res == 0) {
+				try {
+					frontend.WriteNetwork(network);
+				} catch (const WriteFailedException &e) {
+					std::cerr << e.what() << ", waiting for changes" << std::endl;
+					return true;
+				}
+				std::cerr << compiler.Report();
+			} else {
+				std::cerr << "Compilation failed, waiting for changes" << std::endl;
+			}
+			return true;
+		});
+		return EX_OK;
+	}
 
 	int parseRes = drv.parse_file(filename);
 	if (parseRes == 0) {
 		frontend.drv = &drv;
-		frontend.WriteFile();
+		try {
+			frontend.WriteFile();
+		} catch (const SimulationFailedException &e) {
+			std::cerr << e.what() << std::endl;
+			return EX_SOFTWARE;
+		} catch (const NativeCompileException &e) {
+			std::cerr << e.what() << std::endl;
+			return EX_SOFTWARE;
+		} catch (const WriteFailedException &e) {
+			std::cerr << e.what() << std::endl;
+			return EX_CANTCREAT;
+		}
+		std::cerr << FormatReport(drv.optimizer.Report());
 	} else {
 		return EX_DATAERR;
 	}
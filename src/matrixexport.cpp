@@ -0,0 +1,152 @@
+#include "matrixexport.h"
+#include "binarynetwork.h"
+#include "crnwriter.h"
+#include "module.h"
+#include "netchange.h"
+#include <algorithm>
+
+namespace {
+template <class T> void WriteValue(CrnWriter &out, const T &value) {
+	out.Write(std::string_view(reinterpret_cast<const char *>(&value),
+														 sizeof value));
+}
+} // namespace
+
+MatrixExporter::MatrixExporter(const Module &module)
+		: module(module), species(SpeciesByName(module)) {
+	for (std::size_t i = 0; i < species.size(); i++) {
+		number.emplace(species[i], static_cast<std::uint32_t>(i));
+	}
+}
+
+void MatrixExporter::Stoichiometry(std::size_t r, entries &out) const {
+	out.clear();
+	ForEachNetChange(module.reactions[r], [&](const specie &s, int delta) {
+		out.emplace_back(number.at(s), delta);
+	});
+	std::sort(out.begin(), out.end());
+}
+
+void MatrixExporter::Orders(std::size_t r, entries &out) const {
+	out.clear();
+	for (const auto &ratio : module.reactions[r].reactants) {
+		out.emplace_back(number.at(ratio.first), ratio.second);
+	}
+	std::sort(out.begin(), out.end());
+}
+
+void MatrixExporter::WriteMarket(
+		CrnWriter &out, const char *description,
+		void (MatrixExporter::*column)(std::size_t, entries &) const) const {
+	const std::size_t reactions = module.reactions.size();
+	// The header holds the number of entries, so they are counted first
+	entries buffer;
+	std::uint64_t count = 0;
+	for (std::size_t r = 0; r < reactions; r++) {
+		(this->*column)(r, buffer);
+		count += buffer.size();
+	}
+	out.Write("%%MatrixMarket matrix coordinate integer general\n% ");
+	out.Write(description);
+	out.Write("\n% Row i is specie i - 1 and column j is reaction j - 1 in the "
+						"index\n");
+	out.Write(std::to_string(species.size()) + " " + std::to_string(reactions) +
+						" " + std::to_string(count) + "\n");
+	for (std::size_t r = 0; r < reactions; r++) {
+		(this->*column)(r, buffer);
+		for (const auto &entry : buffer) {
+			out.Write(std::to_string(entry.first + 1));
+			out.Write(' ');
+			out.Write(std::to_string(r + 1));
+			out.Write(' ');
+			out.WriteInt(entry.second);
+			out.Write('\n');
+		}
+	}
+}
+
+void MatrixExporter::WriteStoichiometry(CrnWriter &out) const {
+	WriteMarket(out, "Net change of each specie in each reaction",
+							&MatrixExporter::Stoichiometry);
+}
+
+void MatrixExporter::WriteOrders(CrnWriter &out) const {
+	WriteMarket(out, "Order of each reaction in each of its reactants",
+							&MatrixExporter::Orders);
+}
+
+void MatrixExporter::WriteRates(CrnWriter &out) const {
+	out.Write("%%MatrixMarket matrix array real general\n"
+						"% Rate constant of each reaction\n");
+	out.Write(std::to_string(module.reactions.size()) + " 1\n");
+	for (const auto &r : module.reactions) {
+		out.WriteDouble(r.rate);
+		out.Write('\n');
+	}
+}
+
+void MatrixExporter::WriteCsrMatrix(
+		CrnWriter &out,
+		void (MatrixExporter::*column)(std::size_t, entries &) const) const {
+	// One pass over the reactions per array, as they are not kept
+	entries buffer;
+	std::uint64_t offset = 0;
+	WriteValue(out, std::uint32_t(0));
+	for (std::size_t r = 0; r < module.reactions.size(); r++) {
+		(this->*column)(r, buffer);
+		offset += buffer.size();
+		WriteValue(out, CheckedCount(offset, "CSR"));
+	}
+	for (std::size_t r = 0; r < module.reactions.size(); r++) {
+		(this->*column)(r, buffer);
+		for (const auto &entry : buffer) {
+			WriteValue(out, entry.first);
+		}
+	}
+	for (std::size_t r = 0; r < module.reactions.size(); r++) {
+		(this->*column)(r, buffer);
+		for (const auto &entry : buffer) {
+			WriteValue(out, entry.second);
+		}
+	}
+}
+
+void MatrixExporter::WriteCsr(CrnWriter &out) const {
+	csrMatricesHeader header{};
+	header.magic = CSR_MATRICES_MAGIC;
+	header.version = CSR_MATRICES_VERSION;
+	header.speciesCount = CheckedCount(species.size(), "CSR");
+	header.reactionCount = CheckedCount(module.reactions.size(), "CSR");
+	std::uint64_t stoichiometryCount = 0;
+	std::uint64_t orderCount = 0;
+	for (const auto &r : module.reactions) {
+		ForEachNetChange(r, [&](const specie &, int) { stoichiometryCount++; });
+		orderCount += r.reactants.size();
+	}
+	header.stoichiometryCount = CheckedCount(stoichiometryCount, "CSR");
+	header.orderCount = CheckedCount(orderCount, "CSR");
+	WriteValue(out, header);
+	for (const auto &r : module.reactions) {
+		WriteValue(out, r.rate);
+	}
+	WriteCsrMatrix(out, &MatrixExporter::Stoichiometry);
+	WriteCsrMatrix(out, &MatrixExporter::Orders);
+}
+
+void MatrixExporter::WriteIndex(CrnWriter &out) const {
+	out.Write("# species\n");
+	for (std::size_t i = 0; i < species.size(); i++) {
+		out.Write(std::to_string(i));
+		out.Write(' ');
+		out.Write(species[i].Name());
+		out.Write('\n');
+	}
+	out.Write("# reactions\n");
+	std::vector<speciesRatio> buffer;
+	for (std::size_t r = 0; r < module.reactions.size(); r++) {
+		out.Write(std::to_string(r));
+		out.Write(' ');
+		Module::EmitReaction(out, module.reactions[r], buffer);
+		out.Write('\n');
+	}
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include "specie.h"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class CrnWriter;
+class Module;
+
+/*! \brief The header of a raw CSR matrix file
+ * \detail The matrices are species by reactions, stored by reaction, so each
+ * row below is a column of the matrix. The header is followed by, in native
+ * byte order:
+ *
+ * - `double rates[reactionCount]`
+ * - `uint32_t stoichiometryOffsets[reactionCount + 1]`, then
+ *   `uint32_t stoichiometrySpecies[stoichiometryCount]` and
+ *   `int32_t stoichiometry[stoichiometryCount]`, the net change of each specie
+ * - `uint32_t orderOffsets[reactionCount + 1]`, then
+ *   `uint32_t orderSpecies[orderCount]` and `int32_t orders[orderCount]`, the
+ *   coefficient of each reactant
+ *
+ * Species are numbered as in the index file, and ordered by number within a
+ * reaction.
+ */
+struct csrMatricesHeader {
+	std::uint32_t magic;
+	std::uint32_t version;
+	std::uint32_t speciesCount;
+	std::uint32_t reactionCount;
+	std::uint32_t stoichiometryCount;
+	std::uint32_t orderCount;
+};
+
+//! "CRNM" when read in the byte order of the machine that wrote it
+constexpr std::uint32_t CSR_MATRICES_MAGIC = 0x4d4e5243;
+constexpr std::uint32_t CSR_MATRICES_VERSION = 1;
+
+/*! \brief Writes the matrices of a prepared network
+ * \detail The net stoichiometry matrix and the reactant order matrix have a
+ * row for each specie and a column for each reaction. They are written in a
+ * pass over the reactions per array, so only the numbering of the species is
+ * kept in memory, however many nonzeros there are.
+ */
+class MatrixExporter {
+public:
+	explicit MatrixExporter(const Module &module);
+
+	//! The net stoichiometry as a Matrix Market coordinate matrix
+	void WriteStoichiometry(CrnWriter &out) const;
+	//! The reactant orders as a Matrix Market coordinate matrix
+	void WriteOrders(CrnWriter &out) const;
+	//! The rates as a Matrix Market column vector
+	void WriteRates(CrnWriter &out) const;
+	//! The rates and both matrices in the raw CSR format
+	void WriteCsr(CrnWriter &out) const;
+	//! The name of every specie and the text of every reaction, by number
+	void WriteIndex(CrnWriter &out) const;
+
+private:
+	using entries = std::vector<std::pair<std::uint32_t, std::int32_t>>;
+	//! The entries of the column for reaction r, ordered by specie number
+	void Stoichiometry(std::size_t r, entries &out) const;
+	void Orders(std::size_t r, entries &out) const;
+	void WriteMarket(CrnWriter &out, const char *description,
+									 void (MatrixExporter::*column)(std::size_t, entries &)
+											 const) const;
+	void WriteCsrMatrix(CrnWriter &out,
+											void (MatrixExporter::*column)(std::size_t, entries &)
+													const) const;
+
+	const Module &module;
+	std::vector<specie> species;
+	std::unordered_map<specie, std::uint32_t> number;
+};
@@ -1,11 +1,16 @@
 #include "module.h"
 #include "composition.h"
+#include "crnwriter.h"
+#include "optimizer.h"
+#include "threadpool.h"
 #include "typedefs.h"
 #include <algorithm>
-#include <iomanip>
+#include <exception>
+#include <functional>
 #include <iostream>
-#include <sstream>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -13,149 +18,265 @@ namespace constants {
 std::string MAIN_MODULE = "main";
 } // namespace constants
 
-namespace precision {
+std::string Module::Compile() {
+	std::string output;
+	{
+		CrnWriter writer(output);
+		Emit(writer);
+	}
+	return output;
+}
 
-// TODO: This does not seem ideal, but getting floats in just the right format
-// seems to be a hard problem.
-std::string to_string(double d) {
-	std::ostringstream ss;
-	ss << std::fixed;
-	ss << std::setprecision(MAX_DECS);
-	ss << d;
-	std::string out = ss.str();
-	while (out.find('.') != std::string::npos && out.back() == '0') {
-		out.pop_back();
+void Module::PrepareNetwork(ThreadPool *pool, Optimizer *optimizer) {
+	if (!verified) {
+		Verify();
 	}
-	if (out.back() == '.') {
-		out.pop_back();
+	ApplyCompositions(pool);
+	if (optimizer != nullptr) {
+		optimizer->Run(*this);
 	}
-	return out;
 }
-} // namespace precision
 
-std::string Module::Compile() {
-	Verify();
-	ApplyCompositions();
+void Module::Emit(CrnWriter &out, ThreadPool *pool, Optimizer *optimizer) {
+	PrepareNetwork(pool, optimizer);
 
-	std::string output;
-
-	if (outputSpecies.size() > 0) {
-		output += "-C ";
-		for (const auto &specie : outputSpecies) {
-			output += OutputSpecieToString(specie);
+	if (!outputSpecies.empty()) {
+		out.Write("-C ");
+		for (size_t i = 0; i < outputSpecies.size(); i++) {
+			if (i != 0) {
+				out.Write(',');
+			}
+			out.Write(outputSpecies[i].Name());
 		}
-		output.pop_back();
 	}
-	output += "\n";
+	out.Write('\n');
 
-	for (const auto &concs : concentrations) {
-		output += SpecieConcsTostring(concs);
+	// Species are stored by id, but the output is ordered by name
+	std::vector<std::pair<specie, int>> sortedConcs(concentrations.begin(),
+																									concentrations.end());
+	std::sort(sortedConcs.begin(), sortedConcs.end(),
+						[](const std::pair<specie, int> &a, const std::pair<specie, int> &b) {
+							return a.first.Name() < b.first.Name();
+						});
+	for (const auto &concs : sortedConcs) {
+		out.Write(concs.first.Name());
+		out.Write(" := ");
+		out.WriteInt(concs.second);
+		out.Write(";\n");
 	}
+
+	std::vector<speciesRatio> side;
 	for (const auto &reaction : reactions) {
-		if (!reaction.reactants.empty()) {
-			for (const auto &specie : reaction.reactants) {
-				output += SpecieReactToString(specie);
-			}
-			// Remove the last trailing +, because I'm too lazy not to add it
-			output.pop_back();
-			output.pop_back();
-		} else {
-			output += "0 ";
-		}
-		if (reaction.rate != 1) {
-			output += "->";
-			output += "(";
-			output += precision::to_string(reaction.rate);
-			output += ") ";
-		} else {
-			output += "-> ";
+		EmitReaction(out, reaction, side);
+		out.Write(";\n");
+	}
+}
+
+void Module::EmitReaction(CrnWriter &out, const reaction &r,
+													std::vector<speciesRatio> &buffer) {
+	EmitSide(out, r.reactants, buffer);
+	if (r.rate != 1) {
+		out.Write(" ->(");
+		out.WriteDouble(r.rate);
+		out.Write(") ");
+	} else {
+		out.Write(" -> ");
+	}
+	EmitSide(out, r.products, buffer);
+}
+
+void Module::EmitSide(CrnWriter &out, const speciesRatios &ratios,
+											std::vector<speciesRatio> &buffer) {
+	if (ratios.empty()) {
+		out.Write('0');
+		return;
+	}
+	SortByName(ratios, buffer);
+	for (size_t i = 0; i < buffer.size(); i++) {
+		if (i != 0) {
+			out.Write(" + ");
 		}
-		const auto &products = reaction.products;
-		if (!products.empty()) {
-			for (const auto &specie : reaction.products) {
-				output += SpecieReactToString(specie);
-			}
-			output.pop_back();
-			output.pop_back();
-			output.pop_back();
-		} else {
-			output += "0";
+		if (buffer[i].second != 1) {
+			out.WriteInt(buffer[i].second);
 		}
-		output += ";\n";
+		out.Write(buffer[i].first.Name());
 	}
-	return output;
+}
+
+void Module::SortByName(const speciesRatios &ratios,
+												std::vector<speciesRatio> &out) {
+	out.assign(ratios.begin(), ratios.end());
+	std::sort(out.begin(), out.end(),
+						[](const speciesRatio &a, const speciesRatio &b) {
+							return a.first.Name() < b.first.Name();
+						});
 }
 
 void Module::Verify() {
-	std::set<specie> declaredSpecies;
-	for (const auto &specie : inputSpecies) {
-		declaredSpecies.insert(specie);
+	std::vector<std::exception_ptr> errors = Analyze();
+	if (!errors.empty()) {
+		std::rethrow_exception(errors.front());
+	}
+}
+
+void Module::VerifyFunction() {
+	isFunction = true;
+	Verify();
+}
+
+std::vector<std::exception_ptr> Module::Analyze() {
+	enum declaration { INPUT, OUTPUT, PRIVATE };
+	std::unordered_map<specie, declaration> declared;
+	declared.reserve(inputSpecies.size() + outputSpecies.size() +
+									 privateSpecies.size());
+	for (const auto &s : inputSpecies) {
+		declared.insert(std::make_pair(s, INPUT));
 	}
-	for (const auto &specie : outputSpecies) {
-		declaredSpecies.insert(specie);
+	for (const auto &s : outputSpecies) {
+		declared.insert(std::make_pair(s, OUTPUT));
 	}
-	for (const auto &specie : privateSpecies) {
-		declaredSpecies.insert(specie);
+	for (const auto &s : privateSpecies) {
+		declared.insert(std::make_pair(s, PRIVATE));
 	}
 
-	for (const auto &c : concentrations) {
-		if (declaredSpecies.find(c.first) == declaredSpecies.end()) {
-			throw SpecieNotDeclaredException(c.first, name);
+	std::vector<std::exception_ptr> errors;
+	// Every undeclared specie is reported once, where it is first used
+	std::unordered_set<specie> undeclared;
+	auto checkDeclared = [&](const specie &s) {
+		if (declared.find(s) == declared.end() && undeclared.insert(s).second) {
+			errors.push_back(std::make_exception_ptr(
+					SpecieNotDeclaredException(s.Name(), name)));
 		}
-		for (const auto &specie : inputSpecies) {
-			if (c.first == specie) {
-				throw InputSpecieConcException(c.first, name);
-			}
+	};
+	// The concentrations are kept by specie id, which depends on the order the
+	// names were interned in, so they are checked by name instead
+	std::vector<specie> concentrated;
+	concentrated.reserve(concentrations.size());
+	for (const auto &c : concentrations) {
+		concentrated.push_back(c.first);
+	}
+	std::sort(concentrated.begin(), concentrated.end(),
+						[](const specie &a, const specie &b) { return a.Name() < b.Name(); });
+	for (const auto &s : concentrated) {
+		auto it = declared.find(s);
+		if (it == declared.end()) {
+			checkDeclared(s);
+		} else if (it->second == INPUT) {
+			errors.push_back(
+					std::make_exception_ptr(InputSpecieConcException(s.Name(), name)));
 		}
 	}
 	for (const auto &reaction : reactions) {
-		for (const auto &specie : reaction.reactants) {
-			if (declaredSpecies.find(specie.first) == declaredSpecies.end()) {
-				throw SpecieNotDeclaredException(specie.first, name);
-			}
+		for (const auto &ratio : reaction.reactants) {
+			checkDeclared(ratio.first);
+		}
+		for (const auto &ratio : reaction.products) {
+			checkDeclared(ratio.first);
 		}
-		for (const auto &specie : reaction.products) {
-			if (declaredSpecies.find(specie.first) == declaredSpecies.end()) {
-				throw SpecieNotDeclaredException(specie.first, name);
+	}
+	if (isFunction && !FunctionPreservesInputs()) {
+		errors.push_back(
+				std::make_exception_ptr(FunctionIncorrectReactionsException(name)));
+	}
+	verified = errors.empty();
+	return errors;
+}
+
+bool Module::FunctionPreservesInputs() const {
+	auto coefficient = [](const speciesRatios &ratios, const specie &s) {
+		auto it = ratios.find(s);
+		return it == ratios.end() ? 0 : it->second;
+	};
+	for (const auto &reaction : reactions) {
+		for (const auto &input : inputSpecies) {
+			if (coefficient(reaction.reactants, input) !=
+					coefficient(reaction.products, input)) {
+				return false;
 			}
 		}
 	}
+	return true;
 }
 
-void Module::ApplyCompositions() {
+void Module::ApplyCompositions(ThreadPool *pool) {
+	if (pool != nullptr) {
+		FlattenSubModules(pool);
+	}
+	// The compositions are applied from the back of the vector
+	std::vector<numberedComposition> comps;
 	int compositionNumber = 0;
-	while (!compositions.empty()) {
-		Composition *comp = compositions.back();
-		comp->ApplyComposition(name, compositionNumber++, concentrations, reactions,
-													 privateSpecies);
-		compositions.pop_back();
+	for (auto it = compositions.rbegin(); it != compositions.rend(); it++) {
+		comps.push_back({*it, compositionNumber++});
 	}
+	ApplyCompositionsInOrder(comps, name, concentrations, reactions,
+													 privateSpecies, compositionContext{}, pool);
+	compositions.clear();
 }
 
-void Module::VerifyFunction() {
-	Verify();
-	for (const auto &input : inputSpecies) {
-		for (auto reaction : reactions) {
-			if (reaction.reactants[input] != reaction.products[input])
-				throw FunctionIncorrectReactionsException(name);
+const ModuleTemplate &Module::Flatten(ThreadPool *pool) {
+	if (!flatTemplate) {
+		if (!verified) {
+			Verify();
 		}
+		ApplyCompositions(pool);
+		flatTemplate = std::make_shared<const ModuleTemplate>(*this);
 	}
+	return *flatTemplate;
 }
 
-std::string
-Module::SpecieReactToString(const std::pair<std::string, int> &specie) {
-	return SpecieCoefToString(specie.second) + specie.first + " + ";
-}
-
-std::string Module::OutputSpecieToString(const std::string &specieName) {
-	return specieName + ",";
+void Module::SetFlatTemplate(std::shared_ptr<const ModuleTemplate> flat) {
+	flatTemplate = std::move(flat);
+	compositions.clear();
 }
 
-std::string Module::SpecieCoefToString(int coeff) {
-	return (coeff != 1) ? std::to_string(coeff) : "";
-}
+void Module::FlattenSubModules(ThreadPool *pool) {
+	std::map<Module *, size_t> depths;
+	std::vector<std::vector<Module *>> levels;
+	std::function<size_t(Module *)> depthOf = [&](Module *m) -> size_t {
+		auto it = depths.find(m);
+		if (it != depths.end()) {
+			return it->second;
+		}
+		std::vector<Module *> subModules;
+		for (const Composition *comp : m->compositions) {
+			comp->AddSubModules(subModules);
+		}
+		size_t depth = 0;
+		for (Module *sub : subModules) {
+			depth = std::max(depth, depthOf(sub) + 1);
+		}
+		depths.insert(std::make_pair(m, depth));
+		if (levels.size() <= depth) {
+			levels.resize(depth + 1);
+		}
+		levels[depth].push_back(m);
+		return depth;
+	};
+	std::vector<Module *> subModules;
+	for (const Composition *comp : compositions) {
+		comp->AddSubModules(subModules);
+	}
+	for (Module *sub : subModules) {
+		depthOf(sub);
+	}
 
-std::string
-Module::SpecieConcsTostring(const std::pair<std::string, int> &concs) {
-	return concs.first + " := " + std::to_string(concs.second) + ";\n";
+	for (const auto &level : levels) {
+		std::vector<std::exception_ptr> errors(level.size());
+		TaskGroup group(pool);
+		for (size_t i = 0; i < level.size(); i++) {
+			group.Run([&, i] {
+				try {
+					level[i]->Flatten(pool);
+				} catch (...) {
+					errors[i] = std::current_exception();
+				}
+			});
+		}
+		group.Wait();
+		for (const auto &error : errors) {
+			if (error) {
+				std::rethrow_exception(error);
+			}
+		}
+	}
 }
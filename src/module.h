@@ -1,6 +1,10 @@
 #pragma once
+#include "crnwriter.h"
+#include "moduletemplate.h"
 #include "typedefs.h"
+#include <exception>
 #include <map>
+#include <memory>
 #include <set>
 #include <string>
 #include <tuple>
@@ -9,10 +13,8 @@
 
 class Module;
 class Composition;
-
-namespace precision {
-std::string to_string(double d);
-}
+class Optimizer;
+class ThreadPool;
 
 struct FunctionIncorrectReactionsException : public std::exception {
 	std::string error;
@@ -72,13 +74,35 @@ struct NoSuchModuleException : public std::exception {
 class Module {
 public:
 	Module() {}
+	//! Throws the first error Analyze finds
 	void Verify();
+	//! Verify the module as a function
 	void VerifyFunction();
-	std::string OutputSpecieToString(const std::string &speciesName);
-	std::string SpecieConcsTostring(const std::pair<std::string, int> &concs);
-	std::string SpecieCoefToString(int coeff);
-	std::string SpecieReactToString(const std::pair<std::string, int> &specie);
+	/**
+	 * Find every error in the module
+	 *
+	 * Returns the exceptions Verify would throw: those of the concentrations,
+	 * by the name of their specie, then those of the reactions in the order
+	 * they were declared. A module without errors is marked as verified, so
+	 * Flatten does not check it again.
+	 */
+	std::vector<std::exception_ptr> Analyze();
+	//! Compile the module, and return the network as a string
 	std::string Compile();
+	/**
+	 * Verify the module and apply its compositions, leaving only the network
+	 *
+	 * With an optimizer, its passes are run on the module after the
+	 * compositions are applied.
+	 */
+	void PrepareNetwork(ThreadPool *pool = nullptr,
+											Optimizer *optimizer = nullptr);
+	//! Prepare the network, and stream it to out
+	void Emit(CrnWriter &out, ThreadPool *pool = nullptr,
+						Optimizer *optimizer = nullptr);
+	//! Write a reaction as in the network, without the terminating semicolon
+	static void EmitReaction(CrnWriter &out, const reaction &r,
+													 std::vector<speciesRatio> &buffer);
 	/**
 	 * Remove all compositions from the vector, and add items to the object
 	 *
@@ -87,14 +111,56 @@ public:
 	 * submodules reactions, compositions and private species should be added to
 	 * the supermodule. This function does that action, and pops the modules off
 	 * the vector
+	 *
+	 * With a pool, the submodules are flattened and the compositions applied in
+	 * parallel, producing the same result as the serial case.
 	 */
-	void ApplyCompositions();
+	void ApplyCompositions(ThreadPool *pool = nullptr);
+	/**
+	 * Verify and flatten the module, and build a template of the result
+	 *
+	 * Only the first call does any work. Later calls return the same template,
+	 * so a module which is composed many times is only flattened once.
+	 */
+	const ModuleTemplate &Flatten(ThreadPool *pool = nullptr);
+	//! The template built by Flatten, or null if it has not been called yet
+	std::shared_ptr<const ModuleTemplate> FlatTemplate() const {
+		return flatTemplate;
+	}
+	/**
+	 * Use a template flattened from an identical module, instead of flattening
+	 * this one
+	 *
+	 * The compositions are dropped, as Flatten would have applied them.
+	 */
+	void SetFlatTemplate(std::shared_ptr<const ModuleTemplate> flat);
 	std::string name;
 	std::vector<specie> inputSpecies;
 	std::vector<specie> outputSpecies;
 	std::vector<specie> privateSpecies;
 	std::map<specie, int> concentrations;
 	std::vector<reaction> reactions;
-	// TODO: This should be an unique pointer instead
+	// Functions must leave their input species unchanged
+	bool isFunction = false;
+	// The compositions are owned by the CompositionArena of the driver
 	std::vector<Composition *> compositions;
+
+private:
+	std::shared_ptr<const ModuleTemplate> flatTemplate;
+	bool verified = false;
+	/**
+	 * Flatten every module that this module transitively composes
+	 *
+	 * The modules are flattened level by level, deepest first, so all the
+	 * modules on a level can be flattened in parallel, and only read templates
+	 * that were finished on an earlier level.
+	 */
+	void FlattenSubModules(ThreadPool *pool);
+	//! Whether every reaction leaves the input species unchanged
+	bool FunctionPreservesInputs() const;
+	static void EmitSide(CrnWriter &out, const speciesRatios &ratios,
+											 std::vector<speciesRatio> &buffer);
+	//! Copies one side of a reaction into out, ordered by specie name
+	static void SortByName(const speciesRatios &ratios,
+												 std::vector<speciesRatio> &out);
 };
@@ -0,0 +1,393 @@
+#include "modulecache.h"
+#include "conditionalcomposition.h"
+#include "module.h"
+#include "modulecomposition.h"
+#include "parsecontext.h"
+#include "scalarcomposition.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+constexpr std::uint32_t CACHE_MAGIC = 0x434d4843; // "CHMC"
+// Bump whenever the layout of an entry changes
+constexpr std::uint32_t CACHE_FORMAT = 2;
+} // namespace
+
+void CacheWriter::WriteU8(std::uint8_t v) {
+	body.push_back(static_cast<char>(v));
+}
+
+void CacheWriter::WriteU32(std::uint32_t v) {
+	body.append(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+void CacheWriter::WriteU64(std::uint64_t v) {
+	body.append(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+void CacheWriter::WriteI32(std::int32_t v) {
+	body.append(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+void CacheWriter::WriteDouble(double d) {
+	body.append(reinterpret_cast<const char *>(&d), sizeof(d));
+}
+
+void CacheWriter::WriteString(const std::string &s) {
+	auto it = stringIndex.find(s);
+	if (it == stringIndex.end()) {
+		it = stringIndex.insert(std::make_pair(s, strings.size())).first;
+		strings.push_back(s);
+	}
+	WriteU32(it->second);
+}
+
+void CacheWriter::WriteRatios(const speciesRatios &ratios) {
+	WriteU32(static_cast<std::uint32_t>(ratios.size()));
+	for (const auto &ratio : ratios) {
+		WriteSpecie(ratio.first);
+		WriteI32(ratio.second);
+	}
+}
+
+std::string CacheWriter::Finish() const {
+	CacheWriter table;
+	table.WriteU32(static_cast<std::uint32_t>(strings.size()));
+	for (const std::string &s : strings) {
+		table.WriteU32(static_cast<std::uint32_t>(s.size()));
+		table.body += s;
+	}
+	return table.body + body;
+}
+
+void CacheReader::Read(void *out, size_t n) {
+	if (static_cast<size_t>(end - cursor) < n) {
+		throw CorruptCacheException();
+	}
+	std::memcpy(out, cursor, n);
+	cursor += n;
+}
+
+std::uint8_t CacheReader::ReadU8() {
+	std::uint8_t v;
+	Read(&v, sizeof(v));
+	return v;
+}
+
+std::uint32_t CacheReader::ReadU32() {
+	std::uint32_t v;
+	Read(&v, sizeof(v));
+	return v;
+}
+
+std::uint64_t CacheReader::ReadU64() {
+	std::uint64_t v;
+	Read(&v, sizeof(v));
+	return v;
+}
+
+std::int32_t CacheReader::ReadI32() {
+	std::int32_t v;
+	Read(&v, sizeof(v));
+	return v;
+}
+
+double CacheReader::ReadDouble() {
+	double v;
+	Read(&v, sizeof(v));
+	return v;
+}
+
+void CacheReader::ReadStringTable() {
+	std::uint32_t count = ReadU32();
+	// Every string takes at least its length, so a bad count fails here
+	// instead of allocating huge tables
+	if (count > static_cast<size_t>(end - cursor) / sizeof(std::uint32_t)) {
+		throw CorruptCacheException();
+	}
+	strings.reserve(count);
+	for (std::uint32_t i = 0; i < count; i++) {
+		std::uint32_t length = ReadU32();
+		if (static_cast<size_t>(end - cursor) < length) {
+			throw CorruptCacheException();
+		}
+		strings.emplace_back(cursor, length);
+		cursor += length;
+	}
+	species.resize(count);
+	interned.resize(count, false);
+}
+
+std::uint32_t CacheReader::ReadIndex() {
+	std::uint32_t index = ReadU32();
+	if (index >= strings.size()) {
+		throw CorruptCacheException();
+	}
+	return index;
+}
+
+std::string_view CacheReader::ReadString() {
+	return strings[ReadIndex()];
+}
+
+specie CacheReader::ReadSpecie() {
+	std::uint32_t index = ReadIndex();
+	if (!interned[index]) {
+		species[index] = specie(std::string(strings[index]));
+		interned[index] = true;
+	}
+	return species[index];
+}
+
+std::vector<specie> CacheReader::ReadSpecies() {
+	std::uint32_t count = ReadU32();
+	if (count > static_cast<size_t>(end - cursor) / sizeof(std::uint32_t)) {
+		throw CorruptCacheException();
+	}
+	std::vector<specie> res;
+	res.reserve(count);
+	for (std::uint32_t i = 0; i < count; i++) {
+		res.push_back(ReadSpecie());
+	}
+	return res;
+}
+
+speciesRatios CacheReader::ReadRatios() {
+	std::uint32_t count = ReadU32();
+	speciesRatios res;
+	for (std::uint32_t i = 0; i < count; i++) {
+		specie s = ReadSpecie();
+		res[s] += ReadI32();
+	}
+	return res;
+}
+
+bool ModuleCache::Load(const std::string &path, const std::string &source,
+											 ParseContext &ctx) const {
+	int fd = open(EntryPath(path).c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+	size_t size = static_cast<size_t>(st.st_size);
+	void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+
+	const char *begin = static_cast<const char *>(data);
+	bool loaded = false;
+	try {
+		CacheReader in(begin, begin + size);
+		if (in.ReadU32() == CACHE_MAGIC && in.ReadU32() == CACHE_FORMAT &&
+				in.ReadU64() == source.size() && in.ReadU64() == Hash(source)) {
+			in.ReadStringTable();
+			if (in.ReadString() == CHEMILANG_VERSION) {
+				ReadModules(in, ctx);
+				loaded = in.AtEnd();
+			}
+		}
+	} catch (const std::exception &) {
+		// A damaged entry, or one whose compositions no longer fit the modules
+		// they use. Parsing the file reports the latter properly.
+		loaded = false;
+	}
+	munmap(data, size);
+	if (!loaded) {
+		ctx.modules.clear();
+	}
+	return loaded;
+}
+
+void ModuleCache::ReadModules(CacheReader &in, ParseContext &ctx) {
+	// Every module is created before any composition, as compositions may use
+	// any module defined earlier in the file
+	std::uint32_t count = in.ReadU32();
+	std::vector<Module *> read;
+	for (std::uint32_t i = 0; i < count; i++) {
+		Module module;
+		module.name = std::string(in.ReadString());
+		module.inputSpecies = in.ReadSpecies();
+		module.outputSpecies = in.ReadSpecies();
+		module.privateSpecies = in.ReadSpecies();
+		module.isFunction = in.ReadU8() != 0;
+		std::uint32_t concentrations = in.ReadU32();
+		for (std::uint32_t j = 0; j < concentrations; j++) {
+			specie s = in.ReadSpecie();
+			module.concentrations[s] = in.ReadI32();
+		}
+		std::uint32_t reactions = in.ReadU32();
+		for (std::uint32_t j = 0; j < reactions; j++) {
+			reaction r;
+			r.reactants = in.ReadRatios();
+			r.products = in.ReadRatios();
+			r.rate = in.ReadDouble();
+			module.reactions.push_back(std::move(r));
+		}
+		std::string name = module.name;
+		auto inserted = ctx.modules.insert(std::make_pair(name, std::move(module)));
+		if (!inserted.second) {
+			throw CorruptCacheException();
+		}
+		read.push_back(&inserted.first->second);
+	}
+	for (Module *module : read) {
+		std::uint32_t compositions = in.ReadU32();
+		for (std::uint32_t j = 0; j < compositions; j++) {
+			module->compositions.push_back(ReadComposition(in, ctx));
+		}
+	}
+}
+
+Composition *ModuleCache::ReadComposition(CacheReader &in, ParseContext &ctx) {
+	std::uint8_t tag = in.ReadU8();
+	if (tag == ModuleTag) {
+		Module *module = ctx.FindModule(std::string(in.ReadString()));
+		std::uint32_t inputCount = in.ReadU32();
+		std::vector<specie> binding = in.ReadSpecies();
+		if (module == nullptr || inputCount > binding.size()) {
+			throw CorruptCacheException();
+		}
+		std::vector<specie> inputs(binding.begin(), binding.begin() + inputCount);
+		std::vector<specie> outputs(binding.begin() + inputCount, binding.end());
+		return ctx.arena->Make<ModuleComposition>(module, inputs, outputs);
+	}
+	if (tag != ConditionalTag && tag != ScalarTag) {
+		throw CorruptCacheException();
+	}
+	specie condition;
+	double scale = 1;
+	if (tag == ConditionalTag) {
+		condition = in.ReadSpecie();
+	} else {
+		scale = in.ReadDouble();
+	}
+	std::uint32_t count = in.ReadU32();
+	std::vector<Composition *> children;
+	for (std::uint32_t i = 0; i < count; i++) {
+		children.push_back(ReadComposition(in, ctx));
+	}
+	if (tag == ConditionalTag) {
+		return ctx.arena->Make<ConditionalComposition>(condition, children);
+	}
+	return ctx.arena->Make<ScalarComposition>(scale, children);
+}
+
+void ModuleCache::WriteModule(CacheWriter &out, const Module &module) {
+	out.WriteString(module.name);
+	out.WriteSpecies(module.inputSpecies.begin(), module.inputSpecies.end());
+	out.WriteSpecies(module.outputSpecies.begin(), module.outputSpecies.end());
+	out.WriteSpecies(module.privateSpecies.begin(), module.privateSpecies.end());
+	out.WriteU8(module.isFunction);
+	out.WriteU32(static_cast<std::uint32_t>(module.concentrations.size()));
+	for (const auto &conc : module.concentrations) {
+		out.WriteSpecie(conc.first);
+		out.WriteI32(conc.second);
+	}
+	out.WriteU32(static_cast<std::uint32_t>(module.reactions.size()));
+	for (const reaction &r : module.reactions) {
+		out.WriteRatios(r.reactants);
+		out.WriteRatios(r.products);
+		out.WriteDouble(r.rate);
+	}
+}
+
+void ModuleCache::Store(const std::string &path, const std::string &source,
+												const std::map<std::string, Module> &modules) const {
+	CacheWriter header;
+	header.WriteU32(CACHE_MAGIC);
+	header.WriteU32(CACHE_FORMAT);
+	header.WriteU64(source.size());
+	header.WriteU64(Hash(source));
+
+	CacheWriter entry;
+	entry.WriteString(CHEMILANG_VERSION);
+	entry.WriteU32(static_cast<std::uint32_t>(modules.size()));
+	for (const auto &m : modules) {
+		WriteModule(entry, m.second);
+	}
+	for (const auto &m : modules) {
+		const auto &compositions = m.second.compositions;
+		entry.WriteU32(static_cast<std::uint32_t>(compositions.size()));
+		for (const Composition *comp : compositions) {
+			comp->Serialize(entry);
+		}
+	}
+	std::string data = header.Data() + entry.Finish();
+
+	std::error_code ec;
+	std::filesystem::create_directories(directory, ec);
+	if (ec) {
+		return;
+	}
+	// Write a temporary file and rename it over the entry, so concurrent
+	// compilers never see half an entry
+	std::string entryPath = EntryPath(path);
+	std::string tmpPath = entryPath + ".XXXXXX";
+	int fd = mkstemp(&tmpPath[0]);
+	if (fd < 0) {
+		return;
+	}
+	size_t written = 0;
+	while (written < data.size()) {
+		ssize_t n = write(fd, data.data() + written, data.size() - written);
+		if (n <= 0) {
+			break;
+		}
+		written += static_cast<size_t>(n);
+	}
+	if (close(fd) != 0 || written != data.size() ||
+			rename(tmpPath.c_str(), entryPath.c_str()) != 0) {
+		unlink(tmpPath.c_str());
+	}
+}
+
+std::uint64_t ModuleCache::Hash(std::string_view data) {
+	std::uint64_t hash = 0xcbf29ce484222325ULL;
+	for (char c : data) {
+		hash ^= static_cast<unsigned char>(c);
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+std::uint64_t ModuleCache::ContentHash(const Module &module) {
+	CacheWriter out;
+	WriteModule(out, module);
+	out.WriteU32(static_cast<std::uint32_t>(module.compositions.size()));
+	for (const Composition *comp : module.compositions) {
+		comp->Serialize(out);
+	}
+	return Hash(out.Finish());
+}
+
+std::string ModuleCache::DefaultDirectory() {
+	if (const char *dir = getenv("CHEMCACHE")) {
+		return dir;
+	}
+	if (const char *dir = getenv("XDG_CACHE_HOME")) {
+		return std::string(dir) + "/chemilang";
+	}
+	if (const char *dir = getenv("HOME")) {
+		return std::string(dir) + "/.cache/chemilang";
+	}
+	return "";
+}
+
+std::string ModuleCache::EntryPath(const std::string &path) const {
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.chemc",
+					 static_cast<unsigned long long>(Hash(path)));
+	return directory + "/" + name;
+}
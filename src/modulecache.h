@@ -0,0 +1,149 @@
+#pragma once
+#include "typedefs.h"
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class Composition;
+class Module;
+class ParseContext;
+
+#ifndef CHEMILANG_VERSION
+#define CHEMILANG_VERSION "unknown"
+#endif
+
+//! Thrown by CacheReader when a cache file is truncated or malformed
+struct CorruptCacheException : public std::exception {
+	const char *what() const throw() {
+		return "Corrupt module cache file";
+	}
+};
+
+/*! \brief Serializes modules for a .chemc file
+ * \detail Strings, like module and specie names, are written once into a
+ * string table, and referred to by their index everywhere else. Numbers are
+ * written in the byte order of the host, as the cache is never shared between
+ * machines.
+ */
+class CacheWriter {
+public:
+	void WriteU8(std::uint8_t v);
+	void WriteU32(std::uint32_t v);
+	void WriteU64(std::uint64_t v);
+	void WriteI32(std::int32_t v);
+	void WriteDouble(double d);
+	void WriteString(const std::string &s);
+	void WriteSpecie(const specie &s) {
+		WriteString(s.Name());
+	}
+	template <class It> void WriteSpecies(It begin, It end) {
+		WriteU32(static_cast<std::uint32_t>(end - begin));
+		for (It it = begin; it != end; ++it) {
+			WriteSpecie(*it);
+		}
+	}
+	void WriteRatios(const speciesRatios &ratios);
+
+	//! The bytes written so far, without a string table
+	const std::string &Data() const {
+		return body;
+	}
+	//! The string table followed by everything written so far
+	std::string Finish() const;
+
+private:
+	std::string body;
+	std::vector<std::string> strings;
+	std::unordered_map<std::string, std::uint32_t> stringIndex;
+};
+
+/*! \brief Reads what CacheWriter wrote, straight from a mapped file
+ * \detail Every read is bounds checked, and throws CorruptCacheException when
+ * it runs past the end. Strings are views into the mapped file, and species are
+ * only interned the first time they are read.
+ */
+class CacheReader {
+public:
+	CacheReader(const char *begin, const char *end) : cursor(begin), end(end) {}
+
+	std::uint8_t ReadU8();
+	std::uint32_t ReadU32();
+	std::uint64_t ReadU64();
+	std::int32_t ReadI32();
+	double ReadDouble();
+	//! Read the string table, which must come before any string
+	void ReadStringTable();
+	std::string_view ReadString();
+	specie ReadSpecie();
+	std::vector<specie> ReadSpecies();
+	speciesRatios ReadRatios();
+	bool AtEnd() const {
+		return cursor == end;
+	}
+
+private:
+	void Read(void *out, size_t n);
+	std::uint32_t ReadIndex();
+	const char *cursor;
+	const char *end;
+	std::vector<std::string_view> strings;
+	std::vector<specie> species;
+	std::vector<bool> interned;
+};
+
+//! Tags of the composition kinds in a cache file
+enum CompositionTag : std::uint8_t {
+	ModuleTag = 0,
+	ConditionalTag = 1,
+	ScalarTag = 2,
+};
+
+/*! \brief A directory of precompiled, verified modules
+ * \detail Every imported file gets an entry, holding the modules it defines,
+ * keyed by the hash of its source and the compiler version. Compositions
+ * refer to their modules by name, so an entry only depends on the text of its
+ * own file, and the modules it uses are looked up again when it is loaded.
+ */
+class ModuleCache {
+public:
+	explicit ModuleCache(std::string directory)
+			: directory(std::move(directory)) {}
+
+	/**
+	 * Load the modules of the file at path into the sink of ctx
+	 *
+	 * Returns false, leaving the sink empty, if there is no valid entry for
+	 * exactly this source and compiler version, or if the modules it uses no
+	 * longer fit. The file should then be parsed instead.
+	 */
+	bool Load(const std::string &path, const std::string &source,
+						ParseContext &ctx) const;
+	/**
+	 * Write an entry for the modules parsed from the file at path
+	 *
+	 * The cache is only an optimization, so failing to write is not an error.
+	 */
+	void Store(const std::string &path, const std::string &source,
+						 const std::map<std::string, Module> &modules) const;
+
+	//! 64 bit FNV-1a
+	static std::uint64_t Hash(std::string_view data);
+	/**
+	 * Hash of everything a module defines, as it would be stored in an entry
+	 *
+	 * Modules it composes only count by name, not by what they define.
+	 */
+	static std::uint64_t ContentHash(const Module &module);
+	//! The cache directory from $CHEMCACHE, $XDG_CACHE_HOME or $HOME
+	static std::string DefaultDirectory();
+
+private:
+	std::string EntryPath(const std::string &path) const;
+	static void WriteModule(CacheWriter &out, const Module &module);
+	static void ReadModules(CacheReader &in, ParseContext &ctx);
+	static Composition *ReadComposition(CacheReader &in, ParseContext &ctx);
+	std::string directory;
+};
@@ -1,87 +1,70 @@
 #include "modulecomposition.h"
 #include "module.h"
+#include "modulecache.h"
 #include <iostream>
 
-ModuleComposition::ModuleComposition(Module *module, std::vector<specie> inputs,
-																		 std::vector<specie> outputs)
-		: module(module) {
+ModuleComposition::ModuleComposition(Module *module,
+																		 const std::vector<specie> &inputs,
+																		 const std::vector<specie> &outputs,
+																		 std::pmr::memory_resource *resource)
+		: module(module), binding(resource) {
 
 	if (inputs.size() != module->inputSpecies.size()) {
 		throw CompositionException(module->name, "input", inputs.size(),
 															 module->inputSpecies.size());
 	}
-	for (int i = 0; i < module->inputSpecies.size(); i++) {
-		inputMapping.insert(std::make_pair(module->inputSpecies[i], inputs[i]));
-	}
-
 	if (outputs.size() != module->outputSpecies.size()) {
 		throw CompositionException(module->name, "output", outputs.size(),
 															 module->outputSpecies.size());
 	}
-	for (int i = 0; i < module->outputSpecies.size(); i++) {
-		outputMapping.insert(std::make_pair(module->outputSpecies[i], outputs[i]));
-	}
+	binding.reserve(inputs.size() + outputs.size());
+	binding.insert(binding.end(), inputs.begin(), inputs.end());
+	binding.insert(binding.end(), outputs.begin(), outputs.end());
 }
 
-void ModuleComposition::ApplyComposition(
-		std::string moduleName, int compositionNumber,
-		std::map<specie, int> &concOut, std::vector<reaction> &reactionsOut,
-		std::vector<specie> &privateSpecieRes) {
-	module->Verify();
-	module->ApplyCompositions();
-
-	for (auto priSpecie : module->privateSpecies) {
-		specie newSpecie = module->name + "_" + std::to_string(compositionNumber) +
-											 "_" + priSpecie;
-
-		privateSpecieRes.push_back(newSpecie);
-		mapPri.insert(std::make_pair(priSpecie, newSpecie));
+ModuleComposition::ModuleComposition(Module *module,
+																		 const speciesMapping &inputMap,
+																		 const speciesMapping &outputMap,
+																		 std::pmr::memory_resource *resource)
+		: module(module), binding(resource) {
+	for (const auto &s : module->inputSpecies) {
+		binding.push_back(LookupMapping(inputMap, s));
 	}
-
-	for (const auto &reaction : module->reactions) {
-		reactionsOut.push_back(MapReaction(reaction));
-	}
-
-	for (const auto &c : module->concentrations) {
-		if (mapPri.find(c.first) != mapPri.end()) {
-			concOut.insert(std::pair<specie, int>(mapPri.at(c.first), c.second));
-		} else if (outputMapping.find(c.first) != outputMapping.end()) {
-			concOut.insert(
-					std::pair<specie, int>(outputMapping.at(c.first), c.second));
-		} else {
-			throw MapConcForSubModuleException(c.first, module->name, moduleName);
-		}
+	for (const auto &s : module->outputSpecies) {
+		binding.push_back(LookupMapping(outputMap, s));
 	}
 }
 
-reaction ModuleComposition::MapReaction(const reaction &r) {
-	speciesRatios leftSide;
-	for (const auto &specie : r.reactants) {
-		const std::string &specieName = specie.first;
-		leftSide.insert(std::make_pair(MapSpecie(specieName), specie.second));
+specie ModuleComposition::LookupMapping(const speciesMapping &mapping,
+																				const specie &s) {
+	auto it = mapping.find(s);
+	if (it == mapping.end()) {
+		throw std::runtime_error("Module '" + module->name + "' used the specie '" +
+														 s.Name() +
+														 "' in a composition, but did not declare it.");
 	}
+	return it->second;
+}
 
-	speciesRatios rightSide;
-	for (const auto &specie : r.products) {
-		const std::string &specieName = specie.first;
-		rightSide.insert(std::make_pair(MapSpecie(specieName), specie.second));
-	}
+void ModuleComposition::ApplyComposition(
+		std::string moduleName, int compositionNumber,
+		std::map<specie, int> &concOut, std::vector<reaction> &reactionsOut,
+		std::vector<specie> &privateSpecieRes, const compositionContext &context,
+		ThreadPool *pool) {
+	const ModuleTemplate &flat = module->Flatten(pool);
+	flat.Instantiate(std::vector<specie>(binding.begin(), binding.end()),
+									 module->name + "_" + std::to_string(compositionNumber) + "_",
+									 moduleName, context, concOut, reactionsOut,
+									 privateSpecieRes);
+}
 
-	reactionRate rate = r.rate;
-	reaction mapped = {leftSide, rightSide, rate};
-	return mapped;
+void ModuleComposition::AddSubModules(std::vector<Module *> &out) const {
+	out.push_back(module);
 }
 
-specie ModuleComposition::MapSpecie(const specie &specieName) {
-	if (inputMapping.find(specieName) != inputMapping.end()) {
-		return inputMapping.at(specieName);
-	} else if (outputMapping.find(specieName) != outputMapping.end()) {
-		return outputMapping.at(specieName);
-	} else if (mapPri.find(specieName) != mapPri.end()) {
-		return mapPri.at(specieName);
-	} else {
-		throw std::runtime_error("Module '" + module->name + "' used the specie '" +
-														 specieName +
-														 "' in a composition, but did not declare it.");
-	}
+void ModuleComposition::Serialize(CacheWriter &out) const {
+	out.WriteU8(ModuleTag);
+	out.WriteString(module->name);
+	out.WriteU32(static_cast<std::uint32_t>(module->inputSpecies.size()));
+	out.WriteSpecies(binding.begin(), binding.end());
 }
@@ -2,6 +2,7 @@
 #include "composition.h"
 #include "typedefs.h"
 #include <map>
+#include <memory_resource>
 #include <vector>
 
 class Module;
@@ -21,22 +22,27 @@ struct CompositionException : public std::exception {
 
 class ModuleComposition : public Composition {
 public:
-	ModuleComposition(Module *module, std::vector<specie> inputs,
-										std::vector<specie> outputs);
-	ModuleComposition(Module *module, speciesMapping inputMap,
-										speciesMapping outputMap)
-			: module(module), inputMapping(inputMap), outputMapping(outputMap) {}
+	ModuleComposition(
+			Module *module, const std::vector<specie> &inputs,
+			const std::vector<specie> &outputs,
+			std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+	ModuleComposition(
+			Module *module, const speciesMapping &inputMap,
+			const speciesMapping &outputMap,
+			std::pmr::memory_resource *resource = std::pmr::get_default_resource());
 	void ApplyComposition(std::string moduleName, int compositionNumber,
 												std::map<specie, int> &concOut,
 												std::vector<reaction> &reactionOut,
-												std::vector<specie> &specieOut) override;
+												std::vector<specie> &specieOut,
+												const compositionContext &context,
+												ThreadPool *pool) override;
+	void AddSubModules(std::vector<Module *> &out) const override;
+	void Serialize(CacheWriter &out) const override;
 
-	reaction MapReaction(const reaction &r);
-	specie MapSpecie(const specie &inSpecie);
-	speciesMapping inputMapping;
-	speciesMapping outputMapping;
 	Module *module;
+	//! The species bound to the input and then the output slots of the module
+	std::pmr::vector<specie> binding;
 
 private:
-	speciesMapping mapPri;
+	specie LookupMapping(const speciesMapping &mapping, const specie &s);
 };
@@ -0,0 +1,143 @@
+#include "modulelibrary.h"
+#include "parsecontext.h"
+#include <exception>
+#include <mutex>
+#include <sstream>
+
+compileResult ModuleLibrary::Compile(const compileRequest &request) {
+	std::ostringstream diagnostics;
+	compileResult result;
+	try {
+		driver drv;
+		drv.diagnostics = &diagnostics;
+		drv.baseDirectory = request.workingDirectory;
+		drv.jobs = request.jobs;
+		drv.optimizer.passes = request.passes;
+		std::vector<std::string> imports;
+		{
+			ParseContext scan(drv, nullptr);
+			for (const auto &import : scan.ScanImports(request.source)) {
+				imports.push_back(drv.ResolveImport(import));
+			}
+		}
+		WithLibrary(imports, request.workingDirectory, [&](driver *lib) {
+			drv.library = lib;
+			if (drv.parse_string(request.source, request.path) == 0) {
+				result.output = drv.Compile();
+				result.report = FormatReport(drv.optimizer.Report());
+				result.ok = true;
+			}
+		});
+	} catch (const std::exception &e) {
+		diagnostics << e.what() << std::endl;
+	}
+	if (!result.ok) {
+		result.output = diagnostics.str();
+	}
+	ReclaimNames();
+	return result;
+}
+
+void ModuleLibrary::ReclaimNames() {
+	if (!reclaimNames ||
+			SymbolTable::Global().Size() <= symbolMark + RECLAIM_NAMES) {
+		return;
+	}
+	std::unique_lock<std::shared_mutex> lock(libraryMutex);
+	if (SymbolTable::Global().Size() > symbolMark + RECLAIM_NAMES) {
+		ResetLibrary();
+	}
+}
+
+void ModuleLibrary::WithLibrary(const std::vector<std::string> &imports,
+																const std::string &workingDirectory,
+																const std::function<void(driver *)> &compile) {
+	{
+		std::shared_lock<std::shared_mutex> lock(libraryMutex);
+		if (LibraryCurrent(imports, workingDirectory)) {
+			compile(library.get());
+			return;
+		}
+	}
+	// Only the first request after a change waits for the library, and
+	// compiles while it still holds it exclusively
+	std::unique_lock<std::shared_mutex> lock(libraryMutex);
+	if (!LibraryCurrent(imports, workingDirectory)) {
+		LoadLibrary(imports, workingDirectory);
+	}
+	compile(library.get());
+}
+
+bool ModuleLibrary::LibraryCurrent(const std::vector<std::string> &imports,
+																	 const std::string &workingDirectory) const {
+	if (!library || !SameImportsFrom(workingDirectory)) {
+		return false;
+	}
+	for (const auto &import : imports) {
+		if (library->ImportedFiles().count(import) == 0) {
+			return false;
+		}
+	}
+	for (const auto &file : libraryFiles) {
+		std::error_code ec;
+		if (std::filesystem::last_write_time(file.first, ec) != file.second || ec) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool ModuleLibrary::SameImportsFrom(const std::string &workingDirectory) const {
+	return library->baseDirectory == workingDirectory ||
+				 library->ResolvesAlikeFrom(workingDirectory);
+}
+
+void ModuleLibrary::LoadLibrary(const std::vector<std::string> &imports,
+																const std::string &workingDirectory) {
+	// Library files were parsed with their nested imports resolved from
+	// another directory, to different files than this request would get
+	if (!library || !SameImportsFrom(workingDirectory)) {
+		ResetLibrary();
+	}
+	for (const auto &file : libraryFiles) {
+		std::error_code ec;
+		if (std::filesystem::last_write_time(file.first, ec) != file.second || ec) {
+			ResetLibrary();
+			break;
+		}
+	}
+	// A file that fails leaves the library empty, so the request parses
+	// everything itself and reports the errors
+	try {
+		library->baseDirectory = workingDirectory;
+		for (const auto &import : imports) {
+			if (library->ImportedFiles().count(import) == 0 &&
+					library->parse_file(import) != 0) {
+				ResetLibrary();
+				return;
+			}
+		}
+		for (auto &m : library->modules) {
+			m.second.Flatten();
+		}
+	} catch (const std::exception &) {
+		ResetLibrary();
+		return;
+	}
+	for (const auto &path : library->ImportedFiles()) {
+		std::error_code ec;
+		libraryFiles[path] = std::filesystem::last_write_time(path, ec);
+	}
+}
+
+void ModuleLibrary::ResetLibrary() {
+	// Requests only use species while they hold the library, and the library
+	// is held exclusively here, so no specie made since the mark is in use
+	library.reset();
+	if (reclaimNames) {
+		SymbolTable::Global().Truncate(symbolMark);
+	}
+	library = std::make_unique<driver>();
+	library->diagnostics = &discard;
+	libraryFiles.clear();
+}
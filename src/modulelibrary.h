@@ -0,0 +1,85 @@
+#pragma once
+#include "driver.h"
+#include "symboltable.h"
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+//! A file to compile against a ModuleLibrary
+struct compileRequest {
+	std::string source;
+	// The canonical path source was read from, used in diagnostics
+	std::string path;
+	// Where relative imports are looked up first
+	std::string workingDirectory;
+	unsigned jobs = 1;
+	// The optimization passes run on main, as in Optimizer::passes
+	unsigned passes = 0;
+};
+
+struct compileResult {
+	bool ok = false;
+	// The compiled network, or the diagnostics if compiling failed
+	std::string output;
+	// What the optimization passes changed, as formatted by FormatReport
+	std::string report;
+};
+
+/*! \brief Imported files shared by many compiles
+ * \detail Every file imported by a request is parsed once, verified and
+ * flattened into a library driver, and later requests importing it reuse its
+ * modules. As flattened modules are never modified again, any number of
+ * requests compile against the library at the same time. When a library file
+ * changes on disk, the library is rebuilt by the next request.
+ *
+ * Every specie name is interned for good, so the names of requests pile up
+ * in a long running library. A library which reclaims names forgets every
+ * name interned since it was created whenever it is rebuilt, and rebuilds
+ * itself once RECLAIM_NAMES names have been interned. Nothing else in the
+ * process may then keep a specie made after the library, which holds for the
+ * compile server.
+ */
+class ModuleLibrary {
+public:
+	static constexpr size_t RECLAIM_NAMES = 1 << 20;
+
+	explicit ModuleLibrary(bool reclaimNames = false)
+			: reclaimNames(reclaimNames) {}
+
+	//! Compile a request, using the library for everything it imports
+	compileResult Compile(const compileRequest &request);
+
+private:
+	//! Run compile with the library, after loading the imports into it
+	void WithLibrary(const std::vector<std::string> &imports,
+									 const std::string &workingDirectory,
+									 const std::function<void(driver *)> &compile);
+	bool LibraryCurrent(const std::vector<std::string> &imports,
+											const std::string &workingDirectory) const;
+	/**
+	 * Whether the imports of the library files resolve to the same files from
+	 * workingDirectory as from the directory they were parsed in
+	 */
+	bool SameImportsFrom(const std::string &workingDirectory) const;
+	void LoadLibrary(const std::vector<std::string> &imports,
+									 const std::string &workingDirectory);
+	//! Start an empty library, forgetting the names of the old one
+	void ResetLibrary();
+	//! Reset the library if too many names were interned since it was created
+	void ReclaimNames();
+
+	std::shared_mutex libraryMutex;
+	std::unique_ptr<driver> library;
+	bool reclaimNames;
+	// The size of the symbol table when the library was created
+	size_t symbolMark = SymbolTable::Global().Size();
+	// The modification time of every library file when it was parsed
+	std::map<std::string, std::filesystem::file_time_type> libraryFiles;
+	// Requests report the errors in their imports themselves
+	std::ostream discard{nullptr};
+};
@@ -0,0 +1,105 @@
+#include "moduletemplate.h"
+#include "composition.h"
+#include "module.h"
+#include <stdexcept>
+#include <unordered_map>
+
+ModuleTemplate::ModuleTemplate(const Module &module)
+		: name(module.name),
+			inputCount(static_cast<std::uint32_t>(module.inputSpecies.size())),
+			outputCount(static_cast<std::uint32_t>(module.outputSpecies.size())) {
+	slotSpecies.reserve(module.inputSpecies.size() +
+											module.outputSpecies.size() +
+											module.privateSpecies.size());
+	slotSpecies.insert(slotSpecies.end(), module.inputSpecies.begin(),
+										 module.inputSpecies.end());
+	slotSpecies.insert(slotSpecies.end(), module.outputSpecies.begin(),
+										 module.outputSpecies.end());
+	slotSpecies.insert(slotSpecies.end(), module.privateSpecies.begin(),
+										 module.privateSpecies.end());
+
+	// If a specie is declared twice, the first slot wins, so inputs take
+	// precedence over outputs, and outputs over private species.
+	std::unordered_map<specie, std::uint32_t> slots;
+	for (std::uint32_t i = 0; i < slotSpecies.size(); i++) {
+		slots.insert(std::make_pair(slotSpecies[i], i));
+	}
+	auto slotOf = [&](const specie &s) {
+		auto it = slots.find(s);
+		if (it == slots.end()) {
+			throw std::runtime_error("Module '" + name + "' used the specie '" +
+															 s.Name() +
+															 "' in a composition, but did not declare it.");
+		}
+		return it->second;
+	};
+
+	reactions.reserve(module.reactions.size());
+	for (const auto &r : module.reactions) {
+		templateReaction tr;
+		tr.reactantsBegin = static_cast<std::uint32_t>(ratios.size());
+		for (const auto &ratio : r.reactants) {
+			ratios.push_back({slotOf(ratio.first), ratio.second});
+		}
+		tr.productsBegin = static_cast<std::uint32_t>(ratios.size());
+		for (const auto &ratio : r.products) {
+			ratios.push_back({slotOf(ratio.first), ratio.second});
+		}
+		tr.productsEnd = static_cast<std::uint32_t>(ratios.size());
+		tr.rate = r.rate;
+		reactions.push_back(tr);
+	}
+
+	for (const auto &c : module.concentrations) {
+		concentrations.emplace_back(slotOf(c.first), c.second);
+	}
+}
+
+void ModuleTemplate::Instantiate(std::vector<specie> binding,
+																 const std::string &prefix,
+																 const std::string &composingModule,
+																 const compositionContext &context,
+																 std::map<specie, int> &concOut,
+																 std::vector<reaction> &reactionOut,
+																 std::vector<specie> &specieOut) const {
+	binding.reserve(slotSpecies.size());
+	for (size_t i = inputCount + outputCount; i < slotSpecies.size(); i++) {
+		specie newSpecie = prefix + slotSpecies[i].Name();
+		specieOut.push_back(newSpecie);
+		binding.push_back(newSpecie);
+	}
+
+	reactionOut.reserve(reactionOut.size() + reactions.size());
+	for (const auto &tr : reactions) {
+		reaction r;
+		for (auto i = tr.reactantsBegin; i < tr.productsBegin; i++) {
+			r.reactants.insert(speciesRatio{binding[ratios[i].slot],
+																			ratios[i].coefficient});
+		}
+		for (auto i = tr.productsBegin; i < tr.productsEnd; i++) {
+			r.products.insert(speciesRatio{binding[ratios[i].slot],
+																		 ratios[i].coefficient});
+		}
+		// Innermost first, as each conditional composition used to add its own
+		for (auto it = context.catalysts.rbegin(); it != context.catalysts.rend();
+				 ++it) {
+			r.reactants.insert(speciesRatio{*it, 1});
+			r.products.insert(speciesRatio{*it, 1});
+		}
+		// Innermost first too, as each scale used to multiply the rates of its
+		// children in turn, and the product depends on the order
+		r.rate = tr.rate;
+		for (auto it = context.scales.rbegin(); it != context.scales.rend(); ++it) {
+			r.rate *= *it;
+		}
+		reactionOut.push_back(std::move(r));
+	}
+
+	for (const auto &c : concentrations) {
+		if (c.first < inputCount) {
+			throw MapConcForSubModuleException(slotSpecies[c.first].Name(), name,
+																				 composingModule);
+		}
+		concOut.insert(std::make_pair(binding[c.first], c.second));
+	}
+}
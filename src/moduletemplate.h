@@ -0,0 +1,61 @@
+#pragma once
+#include "typedefs.h"
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+class Module;
+struct compositionContext;
+
+//! A specie on one side of a template reaction, as an index into the slots
+struct slotRatio {
+	std::uint32_t slot;
+	int coefficient;
+};
+
+//! A template reaction, whose sides are ranges in ModuleTemplate::ratios
+struct templateReaction {
+	std::uint32_t reactantsBegin;
+	std::uint32_t productsBegin;
+	std::uint32_t productsEnd;
+	reactionRate rate;
+};
+
+/*! \brief An immutable, flattened module, with its species replaced by slots
+ * \detail The slots are the input species, then the output species and then
+ * the private species of the module, all in declaration order. Instantiating
+ * the template is then only a matter of binding each slot to a specie in the
+ * composing module and copying the reactions, which is linear in the size of
+ * the template.
+ */
+class ModuleTemplate {
+public:
+	//! Build the template from a module which has already been flattened
+	explicit ModuleTemplate(const Module &module);
+
+	/**
+	 * Add an instance of the template to a composing module
+	 *
+	 * @param binding The specie for each input and output slot, in order. The
+	 * private slots are appended to it.
+	 * @param prefix Prefix given to the private species of this instance
+	 * @param context Applied to each reaction as it is created, so enclosing
+	 * compositions never copy the reactions again
+	 */
+	void Instantiate(std::vector<specie> binding, const std::string &prefix,
+									 const std::string &composingModule,
+									 const compositionContext &context,
+									 std::map<specie, int> &concOut,
+									 std::vector<reaction> &reactionOut,
+									 std::vector<specie> &specieOut) const;
+
+	std::string name;
+	std::uint32_t inputCount;
+	std::uint32_t outputCount;
+	//! The specie each slot had in the module itself
+	std::vector<specie> slotSpecies;
+	std::vector<slotRatio> ratios;
+	std::vector<templateReaction> reactions;
+	std::vector<std::pair<std::uint32_t, int>> concentrations;
+};
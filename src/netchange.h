@@ -0,0 +1,29 @@
+#pragma once
+#include "typedefs.h"
+
+/**
+ * Calls f with every specie whose amount the reaction changes, and by how much
+ *
+ * Both sides are sorted by specie id, so they are merged in one walk.
+ */
+template <class F> void ForEachNetChange(const reaction &r, F f) {
+	auto reactant = r.reactants.begin();
+	auto product = r.products.begin();
+	while (reactant != r.reactants.end() || product != r.products.end()) {
+		if (product == r.products.end() ||
+				(reactant != r.reactants.end() && reactant->first < product->first)) {
+			f(reactant->first, -reactant->second);
+			++reactant;
+		} else if (reactant == r.reactants.end() ||
+							 product->first < reactant->first) {
+			f(product->first, product->second);
+			++product;
+		} else {
+			if (reactant->second != product->second) {
+				f(reactant->first, product->second - reactant->second);
+			}
+			++reactant;
+			++product;
+		}
+	}
+}
@@ -0,0 +1,58 @@
+#include "optimizer.h"
+#include "module.h"
+#include <boost/algorithm/string.hpp>
+
+namespace {
+// In the order the passes run
+struct passInfo {
+	optimizationPass pass;
+	const char *name;
+	passResult (*run)(Module &);
+};
+
+const passInfo PASSES[] = {
+		{canonicalizePass, "canonicalize", CanonicalizeReactions},
+		{foldPass, "fold", FoldConstants},
+		{fusePass, "fuse", FuseLinks},
+		{deadPass, "dead", EliminateDeadReactions},
+};
+} // namespace
+
+void Optimizer::Run(Module &module) {
+	for (const passInfo &info : PASSES) {
+		if (passes & info.pass) {
+			report.push_back(info.run(module));
+		}
+	}
+}
+
+bool Optimizer::EnablePasses(const std::string &names) {
+	std::vector<std::string> list;
+	boost::split(list, names, [](char c) { return c == ','; });
+	unsigned enabled = 0;
+	for (const std::string &name : list) {
+		bool found = false;
+		for (const passInfo &info : PASSES) {
+			if (name == info.name) {
+				enabled |= info.pass;
+				found = true;
+			}
+		}
+		if (!found) {
+			return false;
+		}
+	}
+	passes |= enabled;
+	return true;
+}
+
+std::string FormatReport(const std::vector<passResult> &report) {
+	std::string text;
+	for (const auto &result : report) {
+		text += result.pass + ": " + result.summary + "\n";
+		for (const auto &detail : result.details) {
+			text += "\t" + detail + "\n";
+		}
+	}
+	return text;
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <string>
+#include <vector>
+
+class Module;
+
+//! What a pass changed, for the report printed with -O
+struct passResult {
+	std::string pass;
+	std::string summary;
+	// What was changed where, one line each
+	std::vector<std::string> details;
+};
+
+//! The passes an Optimizer can run
+enum optimizationPass : unsigned {
+	canonicalizePass = 1 << 0,
+	deadPass = 1 << 1,
+	fusePass = 1 << 2,
+	foldPass = 1 << 3,
+};
+
+/*! \brief Runs optimization passes on the flattened main module
+ * \detail The passes run after every composition has been applied, and before
+ * the network is emitted. Each pass adds a line to the report saying what it
+ * removed. The passes in ALL_PASSES keep the behaviour of the output species,
+ * except that folded species start at the value they would settle at. Fusing
+ * only keeps the steady state, so it is run only when asked for.
+ */
+class Optimizer {
+public:
+	//! The enabled passes, a combination of optimizationPass
+	unsigned passes = 0;
+	//! The passes run by -O
+	static constexpr unsigned ALL_PASSES = canonicalizePass | deadPass | foldPass;
+	//! Every pass, including those -O leaves out
+	static constexpr unsigned KNOWN_PASSES = ALL_PASSES | fusePass;
+
+	/**
+	 * Run the enabled passes on a module whose compositions have been applied
+	 *
+	 * Duplicates are merged first, so adapters composed more than once are
+	 * still recognised, constants are folded before adapters are fused, and
+	 * dead reactions are removed last.
+	 */
+	void Run(Module &module);
+	/**
+	 * Enable the passes in a comma separated list of pass names
+	 *
+	 * Returns false, enabling nothing, if a name is unknown.
+	 */
+	bool EnablePasses(const std::string &names);
+	const std::vector<passResult> &Report() const {
+		return report;
+	}
+
+private:
+	std::vector<passResult> report;
+};
+
+/**
+ * The report as printed with -O: a line for each pass, and an indented line
+ * for each of its details
+ */
+std::string FormatReport(const std::vector<passResult> &report);
+
+/**
+ * Merge reactions with the same reactants and products, and drop no-ops
+ *
+ * Duplicates are merged into the first of them, with the sum of their rates,
+ * as that is the same mass-action kinetics. Reactions which have the same
+ * species on both sides, or a rate of zero, change nothing and are dropped.
+ * Species with a coefficient of zero are removed from the sides first.
+ */
+passResult CanonicalizeReactions(Module &module);
+
+/**
+ * Remove everything the output species do not depend on
+ *
+ * Starting from the outputs, every reaction that changes the amount of a
+ * live specie is kept, and its reactants become live, as its rate depends on
+ * them. All other reactions are removed, along with the concentrations of
+ * species that are not live. A module without outputs is left alone.
+ */
+passResult EliminateDeadReactions(Module &module);
+
+/**
+ * Replace functions of constants with the concentration they settle at
+ *
+ * A constant is a specie no reaction changes, so it keeps its concentration.
+ * A specie z is folded when every reaction changing it either makes z from
+ * constants, or breaks down one z with constants as catalysts, and z has no
+ * concentration of its own. That covers link, copy, addition, multiplication
+ * and division of constants. z then settles at its production rate over its
+ * decay rate, which becomes its concentration when it is a whole number, and
+ * folded species are constants in turn. Private constants that nothing else
+ * reads are removed.
+ */
+passResult FoldConstants(Module &module);
+
+/**
+ * Alias the outputs of link and copy instances to their inputs
+ *
+ * A specie y is pass-through when its only reactions are `x ->(k) x + y`
+ * and `y ->(k) 0`, every other reaction uses it as a catalyst only, and it is
+ * neither an input, an output nor given a concentration. The two reactions
+ * are removed, and x is used wherever y was. Chains of adapters collapse onto
+ * the first specie.
+ *
+ * This is a steady-state approximation: y follows x with a lag of about 1/k
+ * and starts at 0, while x is read at once. Each detail names the instance as
+ * it would be composed, like `c = link(a)`, or by its reactions if it is
+ * neither a link nor a copy.
+ */
+passResult FuseLinks(Module &module);
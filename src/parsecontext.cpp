@@ -0,0 +1,62 @@
+#include "parsecontext.h"
+#include "driver.h"
+
+ParseContext::ParseContext(driver &drv, CompositionArena *arena,
+													 const std::string &fileName)
+		: drv(drv), arena(arena), fileName(fileName) {
+	if (!this->fileName.empty()) {
+		location.initialize(&this->fileName);
+	}
+}
+
+int ParseContext::Parse(const std::string &source) {
+	ScanBegin(source);
+	int res;
+	try {
+		yy::parser parse(*this);
+		parse.set_debug_level(
+				static_cast<yy::parser::debug_level_type>(drv.trace_parsing));
+		res = parse();
+	} catch (...) {
+		ScanEnd();
+		throw;
+	}
+	ScanEnd();
+	return res;
+}
+
+Module *ParseContext::FindModule(const std::string &name) {
+	auto it = modules.find(name);
+	if (it != modules.end()) {
+		return &it->second;
+	}
+	it = drv.modules.find(name);
+	if (it != drv.modules.end()) {
+		return &it->second;
+	}
+	auto shared = drv.libraryModules.find(name);
+	if (shared != drv.libraryModules.end()) {
+		return shared->second;
+	}
+	return nullptr;
+}
+
+void ParseContext::FinishParsingModule() {
+	AddModuleToMap();
+	currentModule = Module();
+}
+
+void ParseContext::FinishParsingFunction() {
+	currentModule.isFunction = true;
+	AddModuleToMap();
+	currentModule = Module();
+}
+
+void ParseContext::AddModuleToMap() {
+	if (FindModule(currentModule.name) == nullptr) {
+		std::string name = currentModule.name;
+		modules.emplace(std::move(name), std::move(currentModule));
+	} else {
+		throw MultipleModulesWithSameName(currentModule.name);
+	}
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include "compositionarena.h"
+#include "module.h"
+#include "parser.hpp"
+#include <map>
+#include <string>
+#include <vector>
+
+class driver;
+class ParseContext;
+
+// The parser calls the scanner of its context through this
+yy::parser::symbol_type yylex(ParseContext &ctx);
+
+/*! \brief The state of parsing a single file
+ * \detail Every file gets its own reentrant scanner, location and module sink,
+ * so any number of files can be parsed at the same time. Modules are looked up
+ * in the sink first, and then among the modules the driver has already
+ * merged, which includes everything the file imports.
+ */
+class ParseContext {
+public:
+	/**
+	 * @param drv The driver, whose modules are visible to the file
+	 * @param arena Owns the compositions created while parsing
+	 * @param fileName Used in the locations of error messages
+	 */
+	ParseContext(driver &drv, CompositionArena *arena,
+							 const std::string &fileName = "");
+	ParseContext(const ParseContext &) = delete;
+	ParseContext &operator=(const ParseContext &) = delete;
+
+	//! Parse source into the sink. Returns 0 on success.
+	int Parse(const std::string &source);
+	/**
+	 * Returns the file names of the import statements at the top of source
+	 *
+	 * Only the imports are scanned. Errors are left for Parse to report.
+	 */
+	std::vector<std::string> ScanImports(const std::string &source);
+
+	//! A module defined earlier in this file, merged by the driver, or in its library
+	Module *FindModule(const std::string &name);
+	// Add the current module to the sink. The driver verifies it after parsing.
+	void FinishParsingModule();
+	void FinishParsingFunction();
+
+	driver &drv;
+	CompositionArena *arena;
+	//! The modules defined in this file
+	std::map<std::string, Module> modules;
+	Module currentModule;
+	// The token's location used by the scanner.
+	yy::location location;
+	// The reentrant scanner, a yyscan_t
+	void *scanner = nullptr;
+
+private:
+	void AddModuleToMap();
+	void ScanBegin(const std::string &source);
+	void ScanEnd();
+	std::string fileName;
+};
@@ -1,5 +1,5 @@
 %skeleton "lalr1.cc" /* -*- C++ -*- */
-%require "3.4.2"
+%require "3.6"
 %defines
 
 %define api.token.constructor
@@ -15,11 +15,11 @@
   #include "modulecomposition.h"
   #include "conditionalcomposition.h"
   #include "scalarcomposition.h"
-  class driver;
+  class ParseContext;
 }
 
 // The parsing context.
-%param { driver& drv }
+%param { ParseContext& ctx }
 
 %locations
 
@@ -28,6 +28,7 @@
 
 %code {
 # include "driver.h"
+# include "parsecontext.h"
 
 template <class T>
 void MergeVectors(std::vector<T> &v1, const std::vector<T> &v2) {
@@ -36,20 +37,16 @@ void MergeVectors(std::vector<T> &v1, const std::vector<T> &v2) {
 	}
 }
 
-Composition *MakeComposition(driver &drv, const std::string &moduleName, std::vector<specie> inputs, std::vector<specie> outputs) {
-	if (drv.modules.find(moduleName) == drv.modules.end()) {
+Composition *MakeComposition(ParseContext &ctx, const std::string &moduleName, std::vector<specie> inputs, std::vector<specie> outputs) {
+	Module *module = ctx.FindModule(moduleName);
+	if (module == nullptr) {
 		throw NoSuchModuleException(moduleName);
 	}
-	Module *module = &drv.modules.at(moduleName);
-	return new ModuleComposition(module, inputs, outputs);
+	return ctx.arena->Make<ModuleComposition>(module, inputs, outputs);
 }
 
 void InsertToSpecieMap(speciesRatios &ratio, std::pair<specie, int> &toInsert) {
-	if (ratio.find(toInsert.first) == ratio.end()) {
-		ratio.insert(toInsert);
-	} else {
-		ratio[toInsert.first] += toInsert.second;
-	}
+	ratio[toInsert.first] += toInsert.second;
   }
 }
 
@@ -66,6 +63,7 @@ void InsertToSpecieMap(speciesRatios &ratio, std::pair<specie, int> &toInsert) {
     T_DCONCENTRATIONS    "concentrations:"
     T_DCOMPOSITIONS      "compositions:"
     T_DIF                "if"
+    T_DIMPORT            "import"
     T_RIGHTARROW         "->"
     T_BIARROW            "<->"
     T_BRACKETSTART       "["
@@ -82,6 +80,7 @@ void InsertToSpecieMap(speciesRatios &ratio, std::pair<specie, int> &toInsert) {
 ;
 
 %token <std::string>    T_NAME      "name"
+%token <std::string>    T_PATH      "path"
 %token <int>            T_NUMBER    "number"
 %token <double>         T_DECIMAL    "decimal"
 
@@ -95,36 +94,48 @@ void InsertToSpecieMap(speciesRatios &ratio, std::pair<specie, int> &toInsert) {
 
 %%
 
-%start modules;
+%start file;
+
+file : imports modules
+     | modules
+     ;
+
+/* The imports are found and parsed before the file itself, by the driver */
+imports : import
+        | imports import
+        ;
+
+import : "import" "path" ";"
+       ;
 
 modules  : module
          | modules module
          ;
 
-module : T_DMODULE "name" "{" properties "}" { drv.currentModule.name = $2; drv.FinishParsingModule(); }
-       | T_DFUNCTION "name" "{" properties "}" { drv.currentModule.name = $2; drv.FinishParsingFunction(); }
+module : T_DMODULE "name" "{" properties "}" { ctx.currentModule.name = $2; ctx.FinishParsingModule(); }
+       | T_DFUNCTION "name" "{" properties "}" { ctx.currentModule.name = $2; ctx.FinishParsingFunction(); }
 
 properties : property
 		   | properties property
 		   ;
 
-property : "private:" dSpecies ";" { MergeVectors(drv.currentModule.privateSpecies, $2); }
-		 | "output:" dSpecies ";" { MergeVectors(drv.currentModule.outputSpecies, $2); }
-		 | "input:" dSpecies ";" { MergeVectors(drv.currentModule.inputSpecies, $2); }
+property : "private:" dSpecies ";" { MergeVectors(ctx.currentModule.privateSpecies, $2); }
+		 | "output:" dSpecies ";" { MergeVectors(ctx.currentModule.outputSpecies, $2); }
+		 | "input:" dSpecies ";" { MergeVectors(ctx.currentModule.inputSpecies, $2); }
 		 | "reactions:" "{" reactions "}"
 		 | "concentrations:" "{" concentrations "}"
-		 | "compositions:" "{" compositions "}" {{ MergeVectors(drv.currentModule.compositions, $3); }}
+		 | "compositions:" "{" compositions "}" {{ MergeVectors(ctx.currentModule.compositions, $3); }}
 		 ;
 
 compositions: composition { std::vector<Composition*> vec; vec.push_back($1); $$ = vec; }
 			| compositions composition { auto vec = $1; $1.push_back($2); $$ = $1; }
       ;
 
-composition: speciesArray "=" "name" "(" speciesArray ")" ";" { $$ = MakeComposition(drv, $3, $5, $1); }
-					 | speciesArray "=" "name" "(" ")" ";" { $$ = MakeComposition(drv, $3, std::vector<specie>(), $1); }
-           | "if" "(" "name" ")" "{" compositions "}" { $$ = new ConditionalComposition($3, $6); }
-           | "scale" "(" "number" ")" "{" compositions "}" { $$ = new ScalarComposition(($3), $6); }
-           | "scale" "(" "decimal" ")" "{" compositions "}" { $$ = new ScalarComposition($3, $6); }
+composition: speciesArray "=" "name" "(" speciesArray ")" ";" { $$ = MakeComposition(ctx, $3, $5, $1); }
+					 | speciesArray "=" "name" "(" ")" ";" { $$ = MakeComposition(ctx, $3, std::vector<specie>(), $1); }
+           | "if" "(" "name" ")" "{" compositions "}" { $$ = ctx.arena->Make<ConditionalComposition>($3, $6); }
+           | "scale" "(" "number" ")" "{" compositions "}" { $$ = ctx.arena->Make<ScalarComposition>(($3), $6); }
+           | "scale" "(" "decimal" ")" "{" compositions "}" { $$ = ctx.arena->Make<ScalarComposition>($3, $6); }
 		       ;
 
 reactions: reaction
@@ -132,34 +143,34 @@ reactions: reaction
 		 ;
 
 reaction: reactionSpeciesList "->" reactionSpeciesList ";"
-            { reaction r = {$1, $3, 1}; drv.currentModule.reactions.push_back(r); }
+            { reaction r = {$1, $3, 1}; ctx.currentModule.reactions.push_back(r); }
 
         | reactionSpeciesList "->" "(" reactionRate ")" reactionSpeciesList ";"
-            { reaction r = {$1, $6, $4}; drv.currentModule.reactions.push_back(r); }
+            { reaction r = {$1, $6, $4}; ctx.currentModule.reactions.push_back(r); }
 
         | reactionSpeciesList "<->" reactionSpeciesList ";" {
-            reaction r = {$1, $3, 1}; drv.currentModule.reactions.push_back(r);
-            reaction R = {$3, $1, 1}; drv.currentModule.reactions.push_back(R);}
+            reaction r = {$1, $3, 1}; ctx.currentModule.reactions.push_back(r);
+            reaction R = {$3, $1, 1}; ctx.currentModule.reactions.push_back(R);}
 
         | reactionSpeciesList "<->" "(" reactionRate ")" reactionSpeciesList ";" {
-            reaction r = {$1, $6, $4}; drv.currentModule.reactions.push_back(r);
-            reaction R = {$6, $1, 1}; drv.currentModule.reactions.push_back(R);}
+            reaction r = {$1, $6, $4}; ctx.currentModule.reactions.push_back(r);
+            reaction R = {$6, $1, 1}; ctx.currentModule.reactions.push_back(R);}
 
         | reactionSpeciesList "(" reactionRate ")" "<->" "(" reactionRate ")" reactionSpeciesList ";" {
-            reaction r = {$1, $9, $7}; drv.currentModule.reactions.push_back(r);
-            reaction R = {$9, $1, $3}; drv.currentModule.reactions.push_back(R); }
+            reaction r = {$1, $9, $7}; ctx.currentModule.reactions.push_back(r);
+            reaction R = {$9, $1, $3}; ctx.currentModule.reactions.push_back(R); }
 
         | reactionSpeciesList "(" reactionRate ")" "<->" reactionSpeciesList ";" {
-            reaction r = {$1, $6, 1}; drv.currentModule.reactions.push_back(r);
-            reaction R = {$6, $1, $3}; drv.currentModule.reactions.push_back(R); }
+            reaction r = {$1, $6, 1}; ctx.currentModule.reactions.push_back(r);
+            reaction R = {$6, $1, $3}; ctx.currentModule.reactions.push_back(R); }
 
 reactionRate : "number" { $$ = static_cast<double>($1); }
              | "decimal" { $$ = $1; }
 
-reactionSpeciesList: reactionSpecie { speciesRatios l; InsertToSpecieMap(l, $1); $$ = l; }
-                    | reactionSpeciesList "+" reactionSpecie { speciesRatios l = $1; InsertToSpecieMap(l, $3); $$ = l; }
+reactionSpeciesList: reactionSpecie { InsertToSpecieMap($$, $1); }
+                    | reactionSpeciesList "+" reactionSpecie { $$ = std::move($1); InsertToSpecieMap($$, $3); }
                     | "number" {if ($1 !=0) {yy::parser::error(@1, "Standalone number in reaction "); YYABORT; }
-                            $$ = std::map<std::string, int>();}
+                            $$ = speciesRatios();}
                     ;
 
 reactionSpecie: "name" { $$ = std::pair<specie, int>(std::move($1), std::move(1)); }
@@ -178,12 +189,12 @@ concentrations: concentration
 			  | concentrations concentration
 			  ;
 
-concentration: "name" ":=" "number" ";" {drv.currentModule.concentrations.insert(std::make_pair($1, $3));}
+concentration: "name" ":=" "number" ";" {ctx.currentModule.concentrations.insert(std::make_pair($1, $3));}
 			 ;
 
 %%
 
 void yy::parser::error (const location_type &l, const std::string &m)
 {
-  std::cerr << l << ": " << m << '\n';
+  *ctx.drv.diagnostics << l << ": " << m << '\n';
 }
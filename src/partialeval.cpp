@@ -0,0 +1,154 @@
+#include "module.h"
+#include "netchange.h"
+#include "optimizer.h"
+#include <cmath>
+#include <unordered_map>
+#include <unordered_set>
+
+passResult FoldConstants(Module &module) {
+	std::vector<reaction> &reactions = module.reactions;
+	std::vector<std::vector<std::pair<specie, int>>> changes(reactions.size());
+	std::unordered_map<specie, std::vector<size_t>> changedBy;
+	std::unordered_map<specie, std::vector<size_t>> readBy;
+	for (size_t i = 0; i < reactions.size(); i++) {
+		ForEachNetChange(reactions[i], [&](const specie &s, int delta) {
+			changes[i].emplace_back(s, delta);
+			changedBy[s].push_back(i);
+		});
+		for (const auto &ratio : reactions[i].reactants) {
+			readBy[ratio.first].push_back(i);
+		}
+	}
+
+	std::unordered_set<specie> inputs(module.inputSpecies.begin(),
+																		module.inputSpecies.end());
+	// Nothing changes a constant, so it keeps its initial concentration
+	auto isConstant = [&](const specie &s) {
+		return inputs.count(s) == 0 && changedBy.count(s) == 0;
+	};
+	auto initial = [&](const specie &s) {
+		auto it = module.concentrations.find(s);
+		return it == module.concentrations.end() ? 0.0 : double(it->second);
+	};
+	// z settles at production / decay when every reaction changing it either
+	// makes it from constants, or breaks down one z with constants as catalysts
+	auto steadyState = [&](const specie &z, int &value) {
+		auto it = changedBy.find(z);
+		if (it == changedBy.end() || inputs.count(z) != 0 ||
+				module.concentrations.count(z) != 0) {
+			return false;
+		}
+		double production = 0;
+		double decay = 0;
+		for (size_t i : it->second) {
+			if (changes[i].size() != 1) {
+				return false;
+			}
+			const reaction &r = reactions[i];
+			double rate = r.rate;
+			int consumed = 0;
+			for (const auto &ratio : r.reactants) {
+				if (ratio.first == z) {
+					consumed = ratio.second;
+				} else if (isConstant(ratio.first)) {
+					rate *= std::pow(initial(ratio.first), ratio.second);
+				} else {
+					return false;
+				}
+			}
+			int delta = changes[i][0].second;
+			if (consumed == 0) {
+				production += rate * delta;
+			} else if (consumed == 1 && delta == -1) {
+				decay += rate;
+			} else {
+				return false;
+			}
+		}
+		if (decay <= 0) {
+			return false;
+		}
+		// Concentrations are whole numbers, so only those values can be folded
+		double steady = production / decay;
+		value = int(std::lround(steady));
+		return steady >= 0 &&
+					 std::abs(steady - value) < 1e-9 * std::max(1.0, steady);
+	};
+
+	std::vector<specie> work;
+	for (size_t i = reactions.size(); i-- > 0;) {
+		if (changes[i].size() == 1) {
+			work.push_back(changes[i][0].first);
+		}
+	}
+	std::vector<char> removed(reactions.size(), false);
+	std::vector<specie> orphans;
+	size_t folded = 0;
+	while (!work.empty()) {
+		specie z = work.back();
+		work.pop_back();
+		int value;
+		if (!steadyState(z, value)) {
+			continue;
+		}
+		for (size_t i : changedBy[z]) {
+			removed[i] = true;
+			for (const auto &ratio : reactions[i].reactants) {
+				orphans.push_back(ratio.first);
+			}
+		}
+		changedBy.erase(z);
+		module.concentrations[z] = value;
+		folded++;
+		// Reactions reading z may now be made from constants only
+		for (size_t i : readBy[z]) {
+			if (!removed[i] && changes[i].size() == 1) {
+				work.push_back(changes[i][0].first);
+			}
+		}
+	}
+
+	size_t kept = 0;
+	for (size_t i = 0; i < reactions.size(); i++) {
+		if (!removed[i]) {
+			if (kept != i) {
+				reactions[kept] = std::move(reactions[i]);
+			}
+			kept++;
+		}
+	}
+	size_t removedReactions = reactions.size() - kept;
+	reactions.resize(kept);
+
+	// Private constants read only by the folded reactions are not needed
+	std::unordered_set<specie> used(module.outputSpecies.begin(),
+																	module.outputSpecies.end());
+	used.insert(inputs.begin(), inputs.end());
+	for (const auto &r : reactions) {
+		for (const auto &ratio : r.reactants) {
+			used.insert(ratio.first);
+		}
+		for (const auto &ratio : r.products) {
+			used.insert(ratio.first);
+		}
+	}
+	std::unordered_set<specie> unused;
+	for (const auto &s : orphans) {
+		if (used.count(s) == 0) {
+			unused.insert(s);
+			module.concentrations.erase(s);
+		}
+	}
+	std::vector<specie> privateSpecies;
+	for (const auto &s : module.privateSpecies) {
+		if (unused.count(s) == 0 &&
+				(used.count(s) != 0 || module.concentrations.count(s) != 0)) {
+			privateSpecies.push_back(s);
+		}
+	}
+	module.privateSpecies = std::move(privateSpecies);
+
+	return {"fold", "folded " + std::to_string(folded) + " species, removing " +
+											std::to_string(removedReactions) + " reactions and " +
+											std::to_string(unused.size()) + " constants"};
+}
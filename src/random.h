@@ -0,0 +1,77 @@
+#pragma once
+#include <cstdint>
+
+/*! \brief A stream of random numbers from the Philox4x32-10 generator
+ * \detail Philox is counter based: each block of numbers is a keyed hash of
+ * its position in the stream and the number of the stream, rather than the
+ * next state of a recurrence. A stream therefore depends on nothing but the
+ * seed and its number, so simulations given stream numbers of their own give
+ * the same results however they are spread over threads.
+ */
+class RandomStream {
+public:
+	RandomStream(std::uint64_t seed, std::uint64_t stream)
+			: key{static_cast<std::uint32_t>(seed),
+						static_cast<std::uint32_t>(seed >> 32)},
+				stream(stream) {}
+
+	// Random number engine requirements, for the distributions of <random>
+	using result_type = std::uint64_t;
+	static constexpr result_type min() {
+		return 0;
+	}
+	static constexpr result_type max() {
+		return UINT64_MAX;
+	}
+	result_type operator()() {
+		return Next();
+	}
+
+	//! A uniformly distributed double in (0, 1], so its logarithm is finite
+	double Uniform() {
+		return ((Next() >> 11) + 1) * 0x1.0p-53;
+	}
+
+	std::uint64_t Next() {
+		if (used == 2) {
+			Generate();
+		}
+		return block[used++];
+	}
+
+private:
+	void Generate() {
+		std::uint32_t c[4] = {
+				static_cast<std::uint32_t>(counter),
+				static_cast<std::uint32_t>(counter >> 32),
+				static_cast<std::uint32_t>(stream),
+				static_cast<std::uint32_t>(stream >> 32),
+		};
+		std::uint32_t k[2] = {key[0], key[1]};
+		for (int round = 0; round < 10; round++) {
+			std::uint64_t p0 = std::uint64_t(0xD2511F53) * c[0];
+			std::uint64_t p1 = std::uint64_t(0xCD9E8D57) * c[2];
+			std::uint32_t next[4] = {
+					static_cast<std::uint32_t>(p1 >> 32) ^ c[1] ^ k[0],
+					static_cast<std::uint32_t>(p1),
+					static_cast<std::uint32_t>(p0 >> 32) ^ c[3] ^ k[1],
+					static_cast<std::uint32_t>(p0),
+			};
+			for (int i = 0; i < 4; i++) {
+				c[i] = next[i];
+			}
+			k[0] += 0x9E3779B9;
+			k[1] += 0xBB67AE85;
+		}
+		block[0] = (std::uint64_t(c[1]) << 32) | c[0];
+		block[1] = (std::uint64_t(c[3]) << 32) | c[2];
+		counter++;
+		used = 0;
+	}
+
+	std::uint32_t key[2];
+	std::uint64_t stream;
+	std::uint64_t counter = 0;
+	std::uint64_t block[2] = {0, 0};
+	int used = 2;
+};
@@ -1,18 +1,35 @@
 #include "scalarcomposition.h"
+#include "modulecache.h"
 
 void ScalarComposition::ApplyComposition(std::string moduleName,
 																				 int compositionNumber,
 																				 std::map<specie, int> &concOut,
 																				 std::vector<reaction> &reactionOut,
-																				 std::vector<specie> &specieOut) {
-	std::vector<reaction> preRates;
+																				 std::vector<specie> &specieOut,
+																				 const compositionContext &context,
+																				 ThreadPool *pool) {
+	std::vector<numberedComposition> comps;
 	for (Composition *subcomp : subCompositions) {
-		subcomp->ApplyComposition(moduleName, compositionNumber, concOut, preRates,
-															specieOut);
+		comps.push_back({subcomp, compositionNumber});
 		compositionNumber++;
 	}
-	for (auto reaction : preRates) {
-		reaction.rate *= scale;
-		reactionOut.push_back(reaction);
+	compositionContext inner = context;
+	inner.scales.push_back(scale);
+	ApplyCompositionsInOrder(comps, moduleName, concOut, reactionOut, specieOut,
+													 inner, pool);
+}
+
+void ScalarComposition::AddSubModules(std::vector<Module *> &out) const {
+	for (const Composition *subcomp : subCompositions) {
+		subcomp->AddSubModules(out);
+	}
+}
+
+void ScalarComposition::Serialize(CacheWriter &out) const {
+	out.WriteU8(ScalarTag);
+	out.WriteDouble(scale);
+	out.WriteU32(static_cast<std::uint32_t>(subCompositions.size()));
+	for (const Composition *subcomp : subCompositions) {
+		subcomp->Serialize(out);
 	}
 }
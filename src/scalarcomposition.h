@@ -1,17 +1,25 @@
 #pragma once
 #include "composition.h"
+#include <memory_resource>
 
 class ScalarComposition : public Composition {
 public:
-	ScalarComposition(double scale, std::vector<Composition *> subCompositions)
-			: subCompositions(subCompositions), scale(scale) {}
+	ScalarComposition(
+			double scale, const std::vector<Composition *> &subCompositions,
+			std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+			: scale(scale), subCompositions(subCompositions.begin(),
+																			 subCompositions.end(), resource) {}
 
 	void ApplyComposition(std::string moduleName, int compositionNumber,
 												std::map<specie, int> &concOut,
 												std::vector<reaction> &reactionOut,
-												std::vector<specie> &specieOut) override;
+												std::vector<specie> &specieOut,
+												const compositionContext &context,
+												ThreadPool *pool) override;
+	void AddSubModules(std::vector<Module *> &out) const override;
+	void Serialize(CacheWriter &out) const override;
 
 private:
 	double scale;
-	std::vector<Composition *> subCompositions;
+	std::pmr::vector<Composition *> subCompositions;
 };
@@ -0,0 +1,304 @@
+#include "simulation.h"
+#include "crnwriter.h"
+#include "kinetics.h"
+#include "random.h"
+#include "sparselu.h"
+#include "stochastic.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+// The Dormand-Prince tableau. The last stage is evaluated at the new state,
+// so it is the first stage of the next step.
+constexpr double A21 = 1.0 / 5;
+constexpr double A31 = 3.0 / 40, A32 = 9.0 / 40;
+constexpr double A41 = 44.0 / 45, A42 = -56.0 / 15, A43 = 32.0 / 9;
+constexpr double A51 = 19372.0 / 6561, A52 = -25360.0 / 2187,
+								 A53 = 64448.0 / 6561, A54 = -212.0 / 729;
+constexpr double A61 = 9017.0 / 3168, A62 = -355.0 / 33, A63 = 46732.0 / 5247,
+								 A64 = 49.0 / 176, A65 = -5103.0 / 18656;
+constexpr double A71 = 35.0 / 384, A73 = 500.0 / 1113, A74 = 125.0 / 192,
+								 A75 = -2187.0 / 6784, A76 = 11.0 / 84;
+// The fifth order solution minus the embedded fourth order one
+constexpr double E1 = 71.0 / 57600, E3 = -71.0 / 16695, E4 = 71.0 / 1920,
+								 E5 = -17253.0 / 339200, E6 = 22.0 / 525, E7 = -1.0 / 40;
+
+constexpr double MIN_FACTOR = 0.2;
+constexpr double MAX_FACTOR = 5;
+constexpr double SAFETY = 0.9;
+
+// The coefficients of the Rosenbrock method of Shampine and Reichelt
+const double GAMMA = 1 / (2 + std::sqrt(2.0));
+const double E32 = 6 + std::sqrt(2.0);
+
+//! How much to scale a step with this error, by a method of this error order
+double StepFactor(double error, double order) {
+	if (!std::isfinite(error)) {
+		return MIN_FACTOR;
+	}
+	if (error == 0) {
+		return MAX_FACTOR;
+	}
+	return std::clamp(SAFETY * std::pow(error, -1 / order), MIN_FACTOR,
+										MAX_FACTOR);
+}
+
+/**
+ * A first step which changes no specie by more than a hundredth of its scale,
+ * as suggested by Hairer, Norsett and Wanner
+ */
+double InitialStep(const std::vector<double> &y, const std::vector<double> &f,
+									 const simulationOptions &options) {
+	double yNorm = 0;
+	double fNorm = 0;
+	for (std::size_t i = 0; i < y.size(); i++) {
+		double scale =
+				options.absoluteTolerance + options.relativeTolerance * std::abs(y[i]);
+		yNorm += (y[i] / scale) * (y[i] / scale);
+		fNorm += (f[i] / scale) * (f[i] / scale);
+	}
+	return yNorm < 1e-10 || fNorm < 1e-10 ? 1e-6
+																				: 0.01 * std::sqrt(yNorm / fNorm);
+}
+
+//! The root mean square of the error, scaled by the tolerances
+double ErrorNorm(const std::vector<double> &error, const std::vector<double> &y,
+								 const std::vector<double> &next,
+								 const simulationOptions &options) {
+	double sum = 0;
+	for (std::size_t i = 0; i < error.size(); i++) {
+		double scale = options.absoluteTolerance +
+									 options.relativeTolerance *
+											 std::max(std::abs(y[i]), std::abs(next[i]));
+		sum += (error[i] / scale) * (error[i] / scale);
+	}
+	return error.empty() ? 0 : std::sqrt(sum / error.size());
+}
+
+void CheckStep(double h, double t) {
+	if (h < 1e-14 * std::max(1.0, std::abs(t))) {
+		throw SimulationFailedException("the step size vanished at time " +
+																		std::to_string(t));
+	}
+}
+
+const std::pair<const char *, SimulationMethod> METHODS[] = {
+		{"rk45", explicitMethod},
+		{"rosenbrock", rosenbrockMethod},
+		{"ssa", ssaMethod},
+		{"tau", tauLeapingMethod},
+};
+} // namespace
+
+bool ParseMethod(const std::string &name, SimulationMethod &method) {
+	for (const auto &entry : METHODS) {
+		if (name == entry.first) {
+			method = entry.second;
+			return true;
+		}
+	}
+	return false;
+}
+
+simulationStats RunSimulation(const KineticNetwork &network,
+															const simulationOptions &options,
+															const sampleCallback &sample) {
+	switch (options.method) {
+	case rosenbrockMethod:
+		return IntegrateRosenbrock(network, options, sample);
+	case ssaMethod:
+	case tauLeapingMethod: {
+		DependencyGraph dependencies(network);
+		RandomStream random(options.seed, 0);
+		return SimulateStochastic(network, dependencies, options, random, sample);
+	}
+	case explicitMethod:
+		break;
+	}
+	return IntegrateExplicit(network, options, sample);
+}
+
+simulationStats IntegrateExplicit(const KineticNetwork &network,
+																	const simulationOptions &options,
+																	const sampleCallback &sample) {
+	const std::size_t n = network.SpeciesCount();
+	std::vector<double> y = network.initialState;
+	std::vector<double> k1(n), k2(n), k3(n), k4(n), k5(n), k6(n), k7(n);
+	std::vector<double> stage(n), next(n), estimate(n);
+	simulationStats stats;
+
+	network.Derivative(y.data(), k1.data());
+	double h = InitialStep(y, k1, options);
+
+	double t = 0;
+	sample(t, y.data());
+	for (unsigned s = 1; s <= options.samples; s++) {
+		const double target = options.endTime * s / options.samples;
+		while (t < target) {
+			bool last = h >= target - t;
+			double step = last ? target - t : h;
+			for (std::size_t i = 0; i < n; i++) {
+				stage[i] = y[i] + step * A21 * k1[i];
+			}
+			network.Derivative(stage.data(), k2.data());
+			for (std::size_t i = 0; i < n; i++) {
+				stage[i] = y[i] + step * (A31 * k1[i] + A32 * k2[i]);
+			}
+			network.Derivative(stage.data(), k3.data());
+			for (std::size_t i = 0; i < n; i++) {
+				stage[i] = y[i] + step * (A41 * k1[i] + A42 * k2[i] + A43 * k3[i]);
+			}
+			network.Derivative(stage.data(), k4.data());
+			for (std::size_t i = 0; i < n; i++) {
+				stage[i] = y[i] + step * (A51 * k1[i] + A52 * k2[i] + A53 * k3[i] +
+																	A54 * k4[i]);
+			}
+			network.Derivative(stage.data(), k5.data());
+			for (std::size_t i = 0; i < n; i++) {
+				stage[i] = y[i] + step * (A61 * k1[i] + A62 * k2[i] + A63 * k3[i] +
+																	A64 * k4[i] + A65 * k5[i]);
+			}
+			network.Derivative(stage.data(), k6.data());
+			for (std::size_t i = 0; i < n; i++) {
+				next[i] = y[i] + step * (A71 * k1[i] + A73 * k3[i] + A74 * k4[i] +
+																 A75 * k5[i] + A76 * k6[i]);
+			}
+			network.Derivative(next.data(), k7.data());
+
+			for (std::size_t i = 0; i < n; i++) {
+				estimate[i] = step * (E1 * k1[i] + E3 * k3[i] + E4 * k4[i] +
+															E5 * k5[i] + E6 * k6[i] + E7 * k7[i]);
+			}
+			double error = ErrorNorm(estimate, y, next, options);
+
+			double proposed = step * StepFactor(error, 5);
+			if (error <= 1) {
+				t = last ? target : t + step;
+				y.swap(next);
+				k1.swap(k7);
+				stats.steps++;
+				// A step cut short by a sample says little about the step size
+				h = last ? std::max(h, proposed) : proposed;
+			} else {
+				stats.rejected++;
+				h = proposed;
+			}
+			CheckStep(h, t);
+		}
+		sample(t, y.data());
+	}
+	return stats;
+}
+
+simulationStats IntegrateRosenbrock(const KineticNetwork &network,
+																		const simulationOptions &options,
+																		const sampleCallback &sample) {
+	const std::size_t n = network.SpeciesCount();
+	const auto &offsets = network.jacobianOffsets;
+	const auto &columns = network.jacobianColumns;
+	SparseLU lu(offsets, columns);
+	std::vector<double> jacobian(columns.size()), matrix(columns.size());
+	std::vector<std::size_t> diagonal(n);
+	for (std::uint32_t s = 0; s < n; s++) {
+		diagonal[s] = std::lower_bound(columns.begin() + offsets[s],
+																	 columns.begin() + offsets[s + 1], s) -
+									columns.begin();
+	}
+
+	std::vector<double> y = network.initialState;
+	std::vector<double> f0(n), f1(n), f2(n), k1(n), k2(n), k3(n);
+	std::vector<double> next(n), estimate(n);
+	simulationStats stats;
+
+	network.Derivative(y.data(), f0.data());
+	double h = InitialStep(y, f0, options);
+	bool jacobianCurrent = false;
+
+	double t = 0;
+	sample(t, y.data());
+	for (unsigned s = 1; s <= options.samples; s++) {
+		const double target = options.endTime * s / options.samples;
+		while (t < target) {
+			bool last = h >= target - t;
+			double step = last ? target - t : h;
+			// A rejected step is tried again from the same state, so only the
+			// factorization has to be redone
+			if (!jacobianCurrent) {
+				network.Jacobian(y.data(), jacobian.data());
+				jacobianCurrent = true;
+			}
+			for (std::size_t e = 0; e < columns.size(); e++) {
+				matrix[e] = -step * GAMMA * jacobian[e];
+			}
+			for (std::size_t d : diagonal) {
+				matrix[d] += 1;
+			}
+			if (!lu.Factorize(matrix.data())) {
+				stats.rejected++;
+				h = step * MIN_FACTOR;
+				CheckStep(h, t);
+				continue;
+			}
+
+			k1 = f0;
+			lu.Solve(k1.data());
+			for (std::size_t i = 0; i < n; i++) {
+				next[i] = y[i] + 0.5 * step * k1[i];
+			}
+			network.Derivative(next.data(), f1.data());
+			for (std::size_t i = 0; i < n; i++) {
+				k2[i] = f1[i] - k1[i];
+			}
+			lu.Solve(k2.data());
+			for (std::size_t i = 0; i < n; i++) {
+				k2[i] += k1[i];
+				next[i] = y[i] + step * k2[i];
+			}
+			network.Derivative(next.data(), f2.data());
+			for (std::size_t i = 0; i < n; i++) {
+				k3[i] = f2[i] - E32 * (k2[i] - f1[i]) - 2 * (k1[i] - f0[i]);
+			}
+			lu.Solve(k3.data());
+			for (std::size_t i = 0; i < n; i++) {
+				estimate[i] = step / 6 * (k1[i] - 2 * k2[i] + k3[i]);
+			}
+			double error = ErrorNorm(estimate, y, next, options);
+
+			double proposed = step * StepFactor(error, 3);
+			if (error <= 1) {
+				t = last ? target : t + step;
+				y.swap(next);
+				f0.swap(f2);
+				jacobianCurrent = false;
+				stats.steps++;
+				h = last ? std::max(h, proposed) : proposed;
+			} else {
+				stats.rejected++;
+				h = proposed;
+			}
+			CheckStep(h, t);
+		}
+		sample(t, y.data());
+	}
+	return stats;
+}
+
+void WriteSampleHeader(const KineticNetwork &network, CrnWriter &out) {
+	out.Write("time");
+	for (auto s : network.observed) {
+		out.Write(',');
+		out.Write(network.names[s]);
+	}
+	out.Write('\n');
+}
+
+void WriteSample(const KineticNetwork &network, CrnWriter &out, double time,
+								 const double *state) {
+	out.WriteDouble(time);
+	for (auto s : network.observed) {
+		out.Write(',');
+		out.WriteDouble(state[s]);
+	}
+	out.Write('\n');
+}
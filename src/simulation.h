@@ -0,0 +1,96 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+class CrnWriter;
+class KineticNetwork;
+
+struct SimulationFailedException : public std::exception {
+	std::string error;
+	SimulationFailedException(std::string reason)
+			: error("Simulation failed: " + reason) {}
+	const char *what() const throw() {
+		return error.c_str();
+	}
+};
+
+enum SimulationMethod {
+	explicitMethod,
+	rosenbrockMethod,
+	ssaMethod,
+	tauLeapingMethod
+};
+
+struct simulationOptions {
+	//! The simulation runs from time 0 until this time
+	double endTime = 10;
+	//! The number of intervals between samples, so there are one more samples
+	unsigned samples = 100;
+	double relativeTolerance = 1e-6;
+	double absoluteTolerance = 1e-9;
+	SimulationMethod method = explicitMethod;
+	//! The relative change of the propensities allowed in a tau leap
+	double leapError = 0.03;
+	//! The seed of the random numbers of stochastic methods
+	std::uint64_t seed = 0;
+};
+
+//! How much work a simulation took
+struct simulationStats {
+	std::size_t steps = 0;
+	std::size_t rejected = 0;
+};
+
+//! Called with the time and the amount of every specie at each sample
+using sampleCallback = std::function<void(double time, const double *state)>;
+
+/**
+ * Integrate the mass action equations of the network with the explicit
+ * Dormand-Prince 5(4) Runge-Kutta method
+ *
+ * The step size is adapted to keep the local error estimate within the
+ * tolerances, and steps are shortened to end exactly at the sample times.
+ * Throws SimulationFailedException when the step size vanishes.
+ */
+simulationStats IntegrateExplicit(const KineticNetwork &network,
+																	const simulationOptions &options,
+																	const sampleCallback &sample);
+
+/**
+ * Integrate the mass action equations of the network with the linearly
+ * implicit Rosenbrock method of Shampine and Reichelt, of order 2 with an
+ * error estimate of order 3, for stiff networks
+ *
+ * Each step factorizes I - gamma h J once, and the three stages reuse it. J is
+ * computed from the symbolic Jacobian of the network, and the factorization
+ * keeps its pattern, so the ordering and fill-in are only worked out once.
+ * Steps are adapted and shortened to the sample times as by IntegrateExplicit.
+ */
+simulationStats IntegrateRosenbrock(const KineticNetwork &network,
+																		const simulationOptions &options,
+																		const sampleCallback &sample);
+
+/**
+ * Simulate the network with the method of the options. Stochastic methods
+ * simulate a single trajectory, with the first stream of the seed.
+ */
+simulationStats RunSimulation(const KineticNetwork &network,
+															const simulationOptions &options,
+															const sampleCallback &sample);
+//! Whether the method simulates molecule counts, with random numbers
+inline bool IsStochastic(SimulationMethod method) {
+	return method == ssaMethod || method == tauLeapingMethod;
+}
+/**
+ * The method named name, rk45, rosenbrock, ssa or tau. Returns false for
+ * other names.
+ */
+bool ParseMethod(const std::string &name, SimulationMethod &method);
+
+//! Write the header of the samples, the time and the observed species
+void WriteSampleHeader(const KineticNetwork &network, CrnWriter &out);
+//! Write the observed species of a sample as comma separated values
+void WriteSample(const KineticNetwork &network, CrnWriter &out, double time,
+								 const double *state);
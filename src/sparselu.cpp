@@ -0,0 +1,134 @@
+#include "sparselu.h"
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <set>
+
+SparseLU::SparseLU(const std::vector<std::uint32_t> &offsets,
+									 const std::vector<std::uint32_t> &columns)
+		: size(offsets.size() - 1) {
+	// Order by minimum degree on the symmetric pattern. Eliminating a node
+	// connects all its neighbours, which is exactly the fill-in, so the
+	// neighbours at elimination are the pattern of its row and column.
+	std::vector<std::vector<std::uint32_t>> adjacent(size);
+	for (std::uint32_t row = 0; row < size; row++) {
+		for (auto e = offsets[row]; e < offsets[row + 1]; e++) {
+			if (columns[e] != row) {
+				adjacent[row].push_back(columns[e]);
+				adjacent[columns[e]].push_back(row);
+			}
+		}
+	}
+	std::set<std::pair<std::size_t, std::uint32_t>> queue;
+	for (std::uint32_t v = 0; v < size; v++) {
+		auto &a = adjacent[v];
+		std::sort(a.begin(), a.end());
+		a.erase(std::unique(a.begin(), a.end()), a.end());
+		queue.emplace(a.size(), v);
+	}
+	std::vector<std::vector<std::uint32_t>> eliminated(size);
+	std::vector<std::uint32_t> merged;
+	step.resize(size);
+	while (!queue.empty()) {
+		std::uint32_t v = queue.begin()->second;
+		queue.erase(queue.begin());
+		step[v] = static_cast<std::uint32_t>(order.size());
+		order.push_back(v);
+		const std::vector<std::uint32_t> &neighbours = adjacent[v];
+		for (std::uint32_t u : neighbours) {
+			auto &a = adjacent[u];
+			queue.erase({a.size(), u});
+			merged.clear();
+			std::set_union(a.begin(), a.end(), neighbours.begin(), neighbours.end(),
+										 std::back_inserter(merged));
+			merged.erase(std::remove_if(merged.begin(), merged.end(),
+																	[&](std::uint32_t w) { return w == u || w == v; }),
+									 merged.end());
+			a.swap(merged);
+			queue.emplace(a.size(), u);
+		}
+		eliminated[v] = std::move(adjacent[v]);
+	}
+
+	std::vector<std::vector<std::uint32_t>> rows(size);
+	for (std::uint32_t k = 0; k < size; k++) {
+		rows[k].push_back(k);
+		for (std::uint32_t w : eliminated[order[k]]) {
+			rows[k].push_back(step[w]);
+			rows[step[w]].push_back(k);
+		}
+	}
+	factorOffsets.push_back(0);
+	for (auto &row : rows) {
+		std::sort(row.begin(), row.end());
+		factorColumns.insert(factorColumns.end(), row.begin(), row.end());
+		factorOffsets.push_back(static_cast<std::uint32_t>(factorColumns.size()));
+	}
+	diagonal.resize(size);
+	for (std::uint32_t k = 0; k < size; k++) {
+		auto begin = factorColumns.begin() + factorOffsets[k];
+		auto end = factorColumns.begin() + factorOffsets[k + 1];
+		diagonal[k] =
+				static_cast<std::uint32_t>(std::lower_bound(begin, end, k) -
+																	 factorColumns.begin());
+	}
+	for (std::uint32_t row = 0; row < size; row++) {
+		std::uint32_t k = step[row];
+		auto begin = factorColumns.begin() + factorOffsets[k];
+		auto end = factorColumns.begin() + factorOffsets[k + 1];
+		for (auto e = offsets[row]; e < offsets[row + 1]; e++) {
+			scatter.push_back(static_cast<std::uint32_t>(
+					std::lower_bound(begin, end, step[columns[e]]) -
+					factorColumns.begin()));
+		}
+	}
+	factors.resize(factorColumns.size());
+	position.resize(size);
+	work.resize(size);
+}
+
+bool SparseLU::Factorize(const double *values) {
+	std::fill(factors.begin(), factors.end(), 0.0);
+	for (std::size_t e = 0; e < scatter.size(); e++) {
+		factors[scatter[e]] += values[e];
+	}
+	for (std::uint32_t i = 0; i < size; i++) {
+		for (auto p = factorOffsets[i]; p < factorOffsets[i + 1]; p++) {
+			position[factorColumns[p]] = p;
+		}
+		// Row i of L, eliminating with every earlier row of U it touches, in
+		// order, so each multiplier is final before it is used
+		for (auto p = factorOffsets[i]; p < diagonal[i]; p++) {
+			std::uint32_t k = factorColumns[p];
+			double multiplier = factors[p] /= factors[diagonal[k]];
+			for (auto q = diagonal[k] + 1; q < factorOffsets[k + 1]; q++) {
+				factors[position[factorColumns[q]]] -= multiplier * factors[q];
+			}
+		}
+		double pivot = factors[diagonal[i]];
+		if (pivot == 0 || !std::isfinite(pivot)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void SparseLU::Solve(double *b) {
+	for (std::size_t k = 0; k < size; k++) {
+		work[k] = b[order[k]];
+	}
+	for (std::uint32_t i = 0; i < size; i++) {
+		for (auto p = factorOffsets[i]; p < diagonal[i]; p++) {
+			work[i] -= factors[p] * work[factorColumns[p]];
+		}
+	}
+	for (std::uint32_t i = static_cast<std::uint32_t>(size); i-- > 0;) {
+		for (auto p = diagonal[i] + 1; p < factorOffsets[i + 1]; p++) {
+			work[i] -= factors[p] * work[factorColumns[p]];
+		}
+		work[i] /= factors[diagonal[i]];
+	}
+	for (std::size_t k = 0; k < size; k++) {
+		b[order[k]] = work[k];
+	}
+}
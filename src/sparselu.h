@@ -0,0 +1,52 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*! \brief LU factorization of matrices that all have the same sparsity pattern
+ * \detail The pattern is analyzed once: the rows and columns are ordered by
+ * minimum degree to limit fill-in, and the pattern of the factors is worked
+ * out. Factorizing a matrix is then only arithmetic on fixed positions.
+ *
+ * Pivots are taken from the diagonal, without searching for a larger one, as
+ * that would change the pattern. This suits matrices like I - hJ, whose
+ * diagonal dominates for small enough h, and Factorize reports a vanishing
+ * pivot so the caller can try a smaller h.
+ */
+class SparseLU {
+public:
+	/**
+	 * Analyze a pattern of compressed sparse rows, in which every row has its
+	 * diagonal entry
+	 */
+	SparseLU(const std::vector<std::uint32_t> &offsets,
+					 const std::vector<std::uint32_t> &columns);
+
+	/**
+	 * Factorize the matrix with the analyzed pattern and these entries, in the
+	 * order of its columns. Returns false when a pivot is zero or not finite.
+	 */
+	bool Factorize(const double *values);
+	//! Solve the last matrix factorized times x = b, overwriting b with x
+	void Solve(double *b);
+
+	//! The number of entries in the factors, including the fill-in
+	std::size_t FactorEntries() const {
+		return factorColumns.size();
+	}
+
+private:
+	std::size_t size;
+	//! The specie eliminated at each step, and the step of each specie
+	std::vector<std::uint32_t> order;
+	std::vector<std::uint32_t> step;
+	//! The rows of L and U together, with unit diagonal of L left out
+	std::vector<std::uint32_t> factorOffsets;
+	std::vector<std::uint32_t> factorColumns;
+	std::vector<std::uint32_t> diagonal;
+	//! Where each entry of the original matrix goes in the factors
+	std::vector<std::uint32_t> scatter;
+	std::vector<double> factors;
+	std::vector<std::uint32_t> position;
+	std::vector<double> work;
+};
@@ -0,0 +1,45 @@
+#pragma once
+#include "symboltable.h"
+#include <functional>
+#include <string>
+
+/*! \brief A handle to an interned specie name
+ * \detail A specie is only the id of its name in the global SymbolTable, so
+ * copying and comparing species never touches the name itself. Comparisons are
+ * by id, so anything that has to be ordered alphabetically, like the emitted
+ * network, must sort by Name() instead.
+ */
+struct specie {
+	specieId id;
+
+	specie() : id(0) {}
+	specie(const std::string &name) : id(SymbolTable::Global().Intern(name)) {}
+	specie(const char *name) : id(SymbolTable::Global().Intern(name)) {}
+	static specie FromId(specieId id) {
+		specie s;
+		s.id = id;
+		return s;
+	}
+
+	const std::string &Name() const {
+		return SymbolTable::Global().Name(id);
+	}
+
+	bool operator==(const specie &other) const {
+		return id == other.id;
+	}
+	bool operator!=(const specie &other) const {
+		return id != other.id;
+	}
+	bool operator<(const specie &other) const {
+		return id < other.id;
+	}
+};
+
+namespace std {
+template <> struct hash<specie> {
+	size_t operator()(const specie &s) const {
+		return std::hash<specieId>()(s.id);
+	}
+};
+} // namespace std
@@ -0,0 +1,129 @@
+#include "speciesratios.h"
+#include <algorithm>
+#include <stdexcept>
+
+speciesRatios::speciesRatios(const speciesRatios &other) : data(inlineData) {
+	*this = other;
+}
+
+speciesRatios::speciesRatios(speciesRatios &&other) noexcept
+		: data(inlineData) {
+	*this = std::move(other);
+}
+
+speciesRatios &speciesRatios::operator=(const speciesRatios &other) {
+	if (this == &other) {
+		return *this;
+	}
+	count_ = 0;
+	Reserve(other.count_);
+	std::copy(other.begin(), other.end(), data);
+	count_ = other.count_;
+	return *this;
+}
+
+speciesRatios &speciesRatios::operator=(speciesRatios &&other) noexcept {
+	if (this == &other) {
+		return *this;
+	}
+	if (other.IsInline()) {
+		count_ = 0;
+		std::copy(other.begin(), other.end(), data);
+		count_ = other.count_;
+	} else {
+		if (!IsInline()) {
+			delete[] data;
+		}
+		data = other.data;
+		capacity = other.capacity;
+		count_ = other.count_;
+		other.data = other.inlineData;
+		other.capacity = INLINE_CAPACITY;
+	}
+	other.count_ = 0;
+	return *this;
+}
+
+speciesRatios::~speciesRatios() {
+	if (!IsInline()) {
+		delete[] data;
+	}
+}
+
+void speciesRatios::Reserve(std::uint32_t newCapacity) {
+	if (newCapacity <= capacity) {
+		return;
+	}
+	auto *grown = new speciesRatio[newCapacity];
+	std::copy(begin(), end(), grown);
+	if (!IsInline()) {
+		delete[] data;
+	}
+	data = grown;
+	capacity = newCapacity;
+}
+
+speciesRatios::iterator speciesRatios::LowerBound(const specie &s) const {
+	return std::lower_bound(
+			data, data + count_, s,
+			[](const speciesRatio &r, const specie &v) { return r.first < v; });
+}
+
+std::pair<speciesRatios::iterator, bool>
+speciesRatios::insert(const speciesRatio &ratio) {
+	iterator pos = LowerBound(ratio.first);
+	if (pos != end() && pos->first == ratio.first) {
+		return std::make_pair(pos, false);
+	}
+	auto index = pos - data;
+	if (count_ == capacity) {
+		Reserve(capacity * 2);
+	}
+	pos = data + index;
+	std::copy_backward(pos, end(), end() + 1);
+	*pos = ratio;
+	count_++;
+	return std::make_pair(pos, true);
+}
+
+int &speciesRatios::operator[](const specie &s) {
+	return insert(speciesRatio{s, 0}).first->second;
+}
+
+int &speciesRatios::at(const specie &s) {
+	iterator it = find(s);
+	if (it == end()) {
+		throw std::out_of_range("speciesRatios::at: " + s.Name());
+	}
+	return it->second;
+}
+
+const int &speciesRatios::at(const specie &s) const {
+	const_iterator it = find(s);
+	if (it == end()) {
+		throw std::out_of_range("speciesRatios::at: " + s.Name());
+	}
+	return it->second;
+}
+
+speciesRatios::iterator speciesRatios::find(const specie &s) {
+	iterator pos = LowerBound(s);
+	return (pos != end() && pos->first == s) ? pos : end();
+}
+
+speciesRatios::const_iterator speciesRatios::find(const specie &s) const {
+	const_iterator pos = LowerBound(s);
+	return (pos != end() && pos->first == s) ? pos : end();
+}
+
+void speciesRatios::erase(iterator it) {
+	std::copy(it + 1, end(), it);
+	count_--;
+}
+
+bool speciesRatios::operator==(const speciesRatios &other) const {
+	return std::equal(begin(), end(), other.begin(), other.end(),
+										[](const speciesRatio &a, const speciesRatio &b) {
+											return a.first == b.first && a.second == b.second;
+										});
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include "specie.h"
+#include <cstdint>
+#include <utility>
+
+//! A specie and its stoichiometric coefficient on one side of a reaction
+struct speciesRatio {
+	specie first;
+	int second;
+};
+
+/*! \brief One side of a reaction
+ * \detail Reactions rarely have more than a handful of species on each side, so
+ * the entries are stored in a small inline array, and only spill to the heap
+ * when that is exceeded. Entries are kept sorted by specie id, and the
+ * interface mirrors the parts of std::map that the compiler uses.
+ */
+class speciesRatios {
+public:
+	using value_type = speciesRatio;
+	using iterator = speciesRatio *;
+	using const_iterator = const speciesRatio *;
+
+	speciesRatios() : data(inlineData) {}
+	speciesRatios(const speciesRatios &other);
+	speciesRatios(speciesRatios &&other) noexcept;
+	speciesRatios &operator=(const speciesRatios &other);
+	speciesRatios &operator=(speciesRatios &&other) noexcept;
+	~speciesRatios();
+
+	/**
+	 * Add an entry, unless the specie is already present
+	 *
+	 * Like std::map::insert, the existing coefficient is left untouched
+	 */
+	std::pair<iterator, bool> insert(const speciesRatio &ratio);
+	template <class S>
+	std::pair<iterator, bool> insert(const std::pair<S, int> &ratio) {
+		return insert(speciesRatio{specie(ratio.first), ratio.second});
+	}
+	int &operator[](const specie &s);
+	int &at(const specie &s);
+	const int &at(const specie &s) const;
+	iterator find(const specie &s);
+	const_iterator find(const specie &s) const;
+	size_t count(const specie &s) const {
+		return find(s) != end() ? 1 : 0;
+	}
+	void erase(iterator it);
+	void clear() {
+		count_ = 0;
+	}
+
+	bool empty() const {
+		return count_ == 0;
+	}
+	size_t size() const {
+		return count_;
+	}
+	iterator begin() {
+		return data;
+	}
+	iterator end() {
+		return data + count_;
+	}
+	const_iterator begin() const {
+		return data;
+	}
+	const_iterator end() const {
+		return data + count_;
+	}
+
+	bool operator==(const speciesRatios &other) const;
+	bool operator!=(const speciesRatios &other) const {
+		return !(*this == other);
+	}
+
+private:
+	static constexpr std::uint32_t INLINE_CAPACITY = 4;
+	iterator LowerBound(const specie &s) const;
+	void Reserve(std::uint32_t newCapacity);
+	bool IsInline() const {
+		return data == inlineData;
+	}
+
+	speciesRatio *data;
+	std::uint32_t count_ = 0;
+	std::uint32_t capacity = INLINE_CAPACITY;
+	speciesRatio inlineData[INLINE_CAPACITY];
+};
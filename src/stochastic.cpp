@@ -0,0 +1,411 @@
+#include "stochastic.h"
+#include "kinetics.h"
+#include "random.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <utility>
+
+namespace {
+constexpr double NEVER = std::numeric_limits<double>::infinity();
+
+/*! \brief A binary min-heap of reactions by firing time, which also knows
+ * where each reaction is, so any time can be changed in place
+ */
+class ReactionQueue {
+public:
+	explicit ReactionQueue(const std::vector<double> &initial)
+			: times(initial), heap(initial.size()), position(initial.size()) {
+		for (std::uint32_t r = 0; r < heap.size(); r++) {
+			heap[r] = r;
+			position[r] = r;
+		}
+		for (std::size_t i = heap.size() / 2; i-- > 0;) {
+			Down(i);
+		}
+	}
+
+	std::uint32_t Top() const {
+		return heap[0];
+	}
+	double Time(std::uint32_t r) const {
+		return times[r];
+	}
+	void Update(std::uint32_t r, double time) {
+		double old = times[r];
+		times[r] = time;
+		if (time < old) {
+			Up(position[r]);
+		} else {
+			Down(position[r]);
+		}
+	}
+
+private:
+	void Swap(std::size_t i, std::size_t j) {
+		std::swap(heap[i], heap[j]);
+		position[heap[i]] = static_cast<std::uint32_t>(i);
+		position[heap[j]] = static_cast<std::uint32_t>(j);
+	}
+	void Up(std::size_t i) {
+		while (i > 0 && times[heap[i]] < times[heap[(i - 1) / 2]]) {
+			Swap(i, (i - 1) / 2);
+			i = (i - 1) / 2;
+		}
+	}
+	void Down(std::size_t i) {
+		for (;;) {
+			std::size_t least = i;
+			for (std::size_t child = 2 * i + 1; child <= 2 * i + 2; child++) {
+				if (child < heap.size() && times[heap[child]] < times[heap[least]]) {
+					least = child;
+				}
+			}
+			if (least == i) {
+				return;
+			}
+			Swap(i, least);
+			i = least;
+		}
+	}
+
+	std::vector<double> times;
+	std::vector<std::uint32_t> heap;
+	std::vector<std::uint32_t> position;
+};
+
+double FiringTime(double now, double propensity, RandomStream &random) {
+	return propensity > 0 ? now - std::log(random.Uniform()) / propensity
+												: NEVER;
+}
+} // namespace
+
+DependencyGraph::DependencyGraph(const KineticNetwork &network) {
+	const std::size_t species = network.SpeciesCount();
+	const std::size_t reactions = network.ReactionCount();
+	// The reactions consuming each specie, as the transpose of the reactants
+	std::vector<std::uint32_t> consumerOffsets(species + 1, 0);
+	for (auto s : network.reactantSpecies) {
+		consumerOffsets[s + 1]++;
+	}
+	for (std::size_t s = 0; s < species; s++) {
+		consumerOffsets[s + 1] += consumerOffsets[s];
+	}
+	std::vector<std::uint32_t> consumers(network.reactantSpecies.size());
+	std::vector<std::uint32_t> fill(consumerOffsets.begin(),
+																	consumerOffsets.end() - 1);
+	for (std::uint32_t r = 0; r < reactions; r++) {
+		for (auto i = network.reactantOffsets[r];
+				 i < network.reactantOffsets[r + 1]; i++) {
+			consumers[fill[network.reactantSpecies[i]]++] = r;
+		}
+	}
+
+	// The reaction each dependent was last added for, to skip duplicates
+	std::vector<std::uint32_t> added(reactions, UINT32_MAX);
+	offsets.push_back(0);
+	for (std::uint32_t r = 0; r < reactions; r++) {
+		added[r] = r;
+		for (auto c = network.changeOffsets[r]; c < network.changeOffsets[r + 1];
+				 c++) {
+			auto s = network.changeSpecies[c];
+			for (auto i = consumerOffsets[s]; i < consumerOffsets[s + 1]; i++) {
+				if (added[consumers[i]] != r) {
+					added[consumers[i]] = r;
+					this->reactions.push_back(consumers[i]);
+				}
+			}
+		}
+		offsets.push_back(static_cast<std::uint32_t>(this->reactions.size()));
+	}
+}
+
+simulationStats SimulateNextReaction(const KineticNetwork &network,
+																		 const DependencyGraph &dependencies,
+																		 const simulationOptions &options,
+																		 RandomStream &random,
+																		 const sampleCallback &sample) {
+	const std::size_t reactions = network.ReactionCount();
+	std::vector<double> state = network.initialState;
+	std::vector<double> propensities(reactions);
+	std::vector<double> times(reactions);
+	for (std::size_t r = 0; r < reactions; r++) {
+		propensities[r] = network.StochasticPropensity(r, state.data());
+		times[r] = FiringTime(0, propensities[r], random);
+	}
+	ReactionQueue queue(times);
+	simulationStats stats;
+
+	sample(0, state.data());
+	for (unsigned s = 1; s <= options.samples; s++) {
+		const double target = options.endTime * s / options.samples;
+		while (reactions > 0 && queue.Time(queue.Top()) <= target) {
+			const std::uint32_t fired = queue.Top();
+			const double now = queue.Time(fired);
+			for (auto i = network.changeOffsets[fired];
+					 i < network.changeOffsets[fired + 1]; i++) {
+				state[network.changeSpecies[i]] += network.changeAmounts[i];
+			}
+			stats.steps++;
+
+			for (auto i = dependencies.offsets[fired];
+					 i < dependencies.offsets[fired + 1]; i++) {
+				auto r = dependencies.reactions[i];
+				double old = propensities[r];
+				propensities[r] = network.StochasticPropensity(r, state.data());
+				double time;
+				if (propensities[r] == 0) {
+					time = NEVER;
+				} else if (old == 0) {
+					// The old time is lost with its rate, but waiting times are
+					// memoryless, so a fresh one is as good
+					time = FiringTime(now, propensities[r], random);
+				} else {
+					// Reuse the time left, stretched by the change in rate
+					time = now + old / propensities[r] * (queue.Time(r) - now);
+				}
+				queue.Update(r, time);
+			}
+			propensities[fired] = network.StochasticPropensity(fired, state.data());
+			queue.Update(fired, FiringTime(now, propensities[fired], random));
+		}
+		sample(target, state.data());
+	}
+	return stats;
+}
+
+namespace {
+//! Reactions this close to using up a reactant are critical
+constexpr int CRITICAL_FIRINGS = 10;
+//! Leaps shorter than this many mean exact steps are not worth taking...
+constexpr double EXACT_LEAP = 10;
+//! ...and this many exact steps are taken instead
+constexpr int EXACT_STEPS = 100;
+
+/*! \brief Exact steps by the direct method, with the propensities kept up to
+ * date through the dependency graph
+ */
+struct directStepper {
+	const KineticNetwork &network;
+	const DependencyGraph &dependencies;
+	std::vector<double> &state;
+	std::vector<double> &propensities;
+
+	//! Fire one reaction chosen by propensity, of which total is the sum
+	void Step(double total, RandomStream &random) {
+		double pick = (1 - random.Uniform()) * total;
+		// When rounding leaves pick at or above 0, the last reaction that can
+		// fire is taken, never one whose propensity is 0
+		std::size_t fired = 0;
+		for (std::size_t r = 0; r < propensities.size(); r++) {
+			if (propensities[r] > 0) {
+				fired = r;
+				pick -= propensities[r];
+				if (pick < 0) {
+					break;
+				}
+			}
+		}
+		for (auto i = network.changeOffsets[fired];
+				 i < network.changeOffsets[fired + 1]; i++) {
+			state[network.changeSpecies[i]] += network.changeAmounts[i];
+		}
+		for (auto i = dependencies.offsets[fired];
+				 i < dependencies.offsets[fired + 1]; i++) {
+			auto r = dependencies.reactions[i];
+			propensities[r] = network.StochasticPropensity(r, state.data());
+		}
+		propensities[fired] = network.StochasticPropensity(fired, state.data());
+	}
+};
+} // namespace
+
+simulationStats SimulateTauLeaping(const KineticNetwork &network,
+																	 const DependencyGraph &dependencies,
+																	 const simulationOptions &options,
+																	 RandomStream &random,
+																	 const sampleCallback &sample) {
+	const std::size_t species = network.SpeciesCount();
+	const std::size_t reactions = network.ReactionCount();
+	std::vector<int> orders(reactions, 0);
+	for (std::size_t r = 0; r < reactions; r++) {
+		for (auto i = network.reactantOffsets[r];
+				 i < network.reactantOffsets[r + 1]; i++) {
+			orders[r] += network.reactantOrders[i];
+		}
+	}
+	std::vector<double> state = network.initialState;
+	std::vector<double> trial(species);
+	std::vector<double> propensities(reactions);
+	std::vector<char> critical(reactions);
+	std::vector<double> mean(species), variance(species), order(species);
+	std::vector<double> firings(reactions);
+	directStepper direct{network, dependencies, state, propensities};
+	simulationStats stats;
+
+	double t = 0;
+	sample(t, state.data());
+	for (unsigned s = 1; s <= options.samples; s++) {
+		const double target = options.endTime * s / options.samples;
+		while (t < target) {
+			for (std::size_t r = 0; r < reactions; r++) {
+				propensities[r] = network.StochasticPropensity(r, state.data());
+			}
+			double total = 0;
+			double criticalTotal = 0;
+			for (std::size_t r = 0; r < reactions; r++) {
+				total += propensities[r];
+				// How many times r can fire before a reactant runs out
+				double left = NEVER;
+				for (auto i = network.changeOffsets[r];
+						 i < network.changeOffsets[r + 1]; i++) {
+					if (network.changeAmounts[i] < 0) {
+						left = std::min(left, std::floor(state[network.changeSpecies[i]] /
+																						 -network.changeAmounts[i]));
+					}
+				}
+				critical[r] = propensities[r] > 0 && left < CRITICAL_FIRINGS;
+				if (critical[r]) {
+					criticalTotal += propensities[r];
+				}
+			}
+			if (total <= 0) {
+				t = target;
+				break;
+			}
+
+			// The mean and variance of the change of every specie per time, from
+			// the reactions which are not critical
+			std::fill(mean.begin(), mean.end(), 0.0);
+			std::fill(variance.begin(), variance.end(), 0.0);
+			for (std::size_t r = 0; r < reactions; r++) {
+				if (critical[r]) {
+					continue;
+				}
+				for (auto i = network.changeOffsets[r];
+						 i < network.changeOffsets[r + 1]; i++) {
+					double change = network.changeAmounts[i];
+					mean[network.changeSpecies[i]] += change * propensities[r];
+					variance[network.changeSpecies[i]] +=
+							change * change * propensities[r];
+				}
+			}
+			// How sensitive the propensities are to each reactant, for the
+			// highest order reaction it takes part in
+			std::fill(order.begin(), order.end(), 0.0);
+			for (std::size_t r = 0; r < reactions; r++) {
+				for (auto i = network.reactantOffsets[r];
+						 i < network.reactantOffsets[r + 1]; i++) {
+					auto x = state[network.reactantSpecies[i]];
+					int m = network.reactantOrders[i];
+					double g = m;
+					for (int k = 1; k < m && x > k; k++) {
+						g += k / (x - k);
+					}
+					g *= double(orders[r]) / m;
+					auto &o = order[network.reactantSpecies[i]];
+					o = std::max(o, g);
+				}
+			}
+			double leap = NEVER;
+			for (std::size_t i = 0; i < species; i++) {
+				if (order[i] == 0) {
+					continue;
+				}
+				double bound = std::max(options.leapError * state[i] / order[i], 1.0);
+				if (mean[i] != 0) {
+					leap = std::min(leap, bound / std::abs(mean[i]));
+				}
+				if (variance[i] != 0) {
+					leap = std::min(leap, bound * bound / variance[i]);
+				}
+			}
+
+			if (leap < EXACT_LEAP / total) {
+				for (int n = 0; n < EXACT_STEPS && total > 0; n++) {
+					double dt = -std::log(random.Uniform()) / total;
+					if (t + dt > target) {
+						t = target;
+						break;
+					}
+					t += dt;
+					direct.Step(total, random);
+					stats.steps++;
+					total = 0;
+					for (double a : propensities) {
+						total += a;
+					}
+				}
+				if (total <= 0) {
+					t = target;
+				}
+				continue;
+			}
+
+			// The next critical firing, if it comes before the leap ends
+			double criticalTime =
+					criticalTotal > 0 ? -std::log(random.Uniform()) / criticalTotal
+														: NEVER;
+			for (;;) {
+				double tau = std::min({leap, criticalTime, target - t});
+				std::fill(firings.begin(), firings.end(), 0.0);
+				for (std::size_t r = 0; r < reactions; r++) {
+					if (!critical[r] && propensities[r] > 0) {
+						std::poisson_distribution<long long> poisson(propensities[r] *
+																												 tau);
+						firings[r] = poisson(random);
+					}
+				}
+				if (tau == criticalTime) {
+					double pick = (1 - random.Uniform()) * criticalTotal;
+					std::size_t fired = 0;
+					for (std::size_t r = 0; r < reactions; r++) {
+						if (critical[r]) {
+							fired = r;
+							pick -= propensities[r];
+							if (pick < 0) {
+								break;
+							}
+						}
+					}
+					firings[fired] = 1;
+				}
+				trial = state;
+				bool negative = false;
+				for (std::size_t r = 0; r < reactions; r++) {
+					if (firings[r] == 0) {
+						continue;
+					}
+					for (auto i = network.changeOffsets[r];
+							 i < network.changeOffsets[r + 1]; i++) {
+						double &x = trial[network.changeSpecies[i]];
+						x += firings[r] * network.changeAmounts[i];
+						negative = negative || x < 0;
+					}
+				}
+				if (!negative) {
+					state.swap(trial);
+					t = tau == target - t ? target : t + tau;
+					stats.steps++;
+					break;
+				}
+				stats.rejected++;
+				leap = tau / 2;
+			}
+		}
+		sample(t, state.data());
+	}
+	return stats;
+}
+
+simulationStats SimulateStochastic(const KineticNetwork &network,
+																	 const DependencyGraph &dependencies,
+																	 const simulationOptions &options,
+																	 RandomStream &random,
+																	 const sampleCallback &sample) {
+	if (options.method == tauLeapingMethod) {
+		return SimulateTauLeaping(network, dependencies, options, random, sample);
+	}
+	return SimulateNextReaction(network, dependencies, options, random, sample);
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include "simulation.h"
+#include <cstdint>
+#include <vector>
+
+class RandomStream;
+
+/*! \brief Which propensities every reaction of a network changes
+ * \detail Reaction r changes the propensity of every other reaction with a
+ * reactant whose amount r changes. The graph is built once, and is only read
+ * while simulating, so any number of simulations may share it.
+ */
+class DependencyGraph {
+public:
+	explicit DependencyGraph(const KineticNetwork &network);
+
+	//! The reactions depending on reaction r, in compressed sparse rows
+	std::vector<std::uint32_t> offsets;
+	std::vector<std::uint32_t> reactions;
+};
+
+/**
+ * Simulate one trajectory of the network with the next reaction method of
+ * Gibson and Bruck, treating amounts as molecule counts
+ *
+ * Every reaction has a putative firing time, kept in an indexed binary heap.
+ * After the earliest reaction fires, only its own time and those of the
+ * reactions depending on it are updated, so an event costs the fan out of the
+ * reaction times the logarithm of the number of reactions. The propensities
+ * are those of KineticNetwork::StochasticPropensity, and the state is passed
+ * to sample as it is at each sample time.
+ */
+simulationStats SimulateNextReaction(const KineticNetwork &network,
+																		 const DependencyGraph &dependencies,
+																		 const simulationOptions &options,
+																		 RandomStream &random,
+																		 const sampleCallback &sample);
+
+//! Simulate one trajectory with the stochastic method of the options
+simulationStats SimulateStochastic(const KineticNetwork &network,
+																	 const DependencyGraph &dependencies,
+																	 const simulationOptions &options,
+																	 RandomStream &random,
+																	 const sampleCallback &sample);
+
+/**
+ * Simulate one trajectory of the network by tau leaping, firing each reaction
+ * a Poisson distributed number of times per leap
+ *
+ * Leaps are chosen as by Cao, Gillespie and Petzold, so that no propensity is
+ * expected to change by more than options.leapError of itself. Reactions
+ * within a few firings of using up a reactant are critical, and fire at most
+ * once per leap, as in an exact simulation; leaps which still drive a count
+ * negative are halved and taken again. Where the leap would be only a few
+ * times the exact step, exact steps are taken instead.
+ */
+simulationStats SimulateTauLeaping(const KineticNetwork &network,
+																	 const DependencyGraph &dependencies,
+																	 const simulationOptions &options,
+																	 RandomStream &random,
+																	 const sampleCallback &sample);
@@ -0,0 +1,52 @@
+#include "symboltable.h"
+#include <algorithm>
+#include <mutex>
+
+SymbolTable::SymbolTable() {
+	// Id 0 is the empty name, which is what a default constructed specie holds
+	Intern("");
+}
+
+SymbolTable &SymbolTable::Global() {
+	static SymbolTable table;
+	return table;
+}
+
+specieId SymbolTable::Intern(const std::string &name) {
+	{
+		std::shared_lock<std::shared_mutex> lock(mutex);
+		auto it = ids.find(name);
+		if (it != ids.end()) {
+			return it->second;
+		}
+	}
+	std::unique_lock<std::shared_mutex> lock(mutex);
+	auto it = ids.find(name);
+	if (it != ids.end()) {
+		return it->second;
+	}
+	auto id = static_cast<specieId>(names.size());
+	names.push_back(name);
+	ids.insert(std::make_pair(std::string_view(names.back()), id));
+	return id;
+}
+
+const std::string &SymbolTable::Name(specieId id) const {
+	std::shared_lock<std::shared_mutex> lock(mutex);
+	return names.at(id);
+}
+
+size_t SymbolTable::Size() const {
+	std::shared_lock<std::shared_mutex> lock(mutex);
+	return names.size();
+}
+
+void SymbolTable::Truncate(size_t size) {
+	std::unique_lock<std::shared_mutex> lock(mutex);
+	// Id 0 is never forgotten
+	size = std::max<size_t>(size, 1);
+	while (names.size() > size) {
+		ids.erase(names.back());
+		names.pop_back();
+	}
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+using specieId = std::uint32_t;
+
+/*! \brief Interns specie names to 32-bit ids
+ * \detail Every specie name that passes through the compiler is stored exactly
+ * once in the table, and the rest of the compiler only passes the id around.
+ * Names are kept in a deque, so references returned by Name stay valid for the
+ * lifetime of the table. The table is safe to use from several threads.
+ */
+class SymbolTable {
+public:
+	//! The process-wide table used by specie
+	static SymbolTable &Global();
+
+	//! Returns the id of name, adding it to the table if it is new
+	specieId Intern(const std::string &name);
+	const std::string &Name(specieId id) const;
+	size_t Size() const;
+	/**
+	 * Forget every name after the first size, so their memory is reclaimed
+	 *
+	 * No specie holding one of the forgotten ids may be used afterwards, and
+	 * the ids are handed out again to the next names interned.
+	 */
+	void Truncate(size_t size);
+
+private:
+	SymbolTable();
+	mutable std::shared_mutex mutex;
+	std::deque<std::string> names;
+	std::unordered_map<std::string_view, specieId> ids;
+};
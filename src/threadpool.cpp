@@ -0,0 +1,148 @@
+#include "threadpool.h"
+
+namespace {
+thread_local const ThreadPool *currentPool = nullptr;
+thread_local size_t currentQueue = 0;
+} // namespace
+
+ThreadPool::ThreadPool(unsigned threadCount) {
+	// The last queue is shared by the threads outside the pool
+	for (unsigned i = 0; i <= threadCount; i++) {
+		queues.push_back(std::make_unique<taskQueue>());
+	}
+	for (unsigned i = 0; i < threadCount; i++) {
+		threads.emplace_back([this, i] { WorkerLoop(i); });
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (auto &thread : threads) {
+		thread.join();
+	}
+}
+
+size_t ThreadPool::OwnQueue() const {
+	return currentPool == this ? currentQueue : threads.size();
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+	// Counted before it can be taken, so RunOne never takes queued below zero
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		queued++;
+	}
+	{
+		taskQueue &queue = *queues[OwnQueue()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back(std::move(task));
+	}
+	wake.notify_one();
+}
+
+bool ThreadPool::Pop(size_t queue, bool back, std::function<void()> &task) {
+	taskQueue &q = *queues[queue];
+	std::lock_guard<std::mutex> lock(q.mutex);
+	if (q.tasks.empty()) {
+		return false;
+	}
+	if (back) {
+		task = std::move(q.tasks.back());
+		q.tasks.pop_back();
+	} else {
+		task = std::move(q.tasks.front());
+		q.tasks.pop_front();
+	}
+	return true;
+}
+
+bool ThreadPool::RunOne() {
+	std::function<void()> task;
+	size_t own = OwnQueue();
+	bool found = Pop(own, true, task);
+	for (size_t i = 1; !found && i < queues.size(); i++) {
+		found = Pop((own + i) % queues.size(), false, task);
+	}
+	if (!found) {
+		return false;
+	}
+	queued--;
+	task();
+	return true;
+}
+
+void ThreadPool::HelpUntil(const std::function<bool()> &done) {
+	while (!done()) {
+		if (RunOne()) {
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wake.wait(lock, [&] { return done() || queued > 0; });
+	}
+}
+
+void ThreadPool::Notify() {
+	// Taking the mutex orders the change before any waiter checks it again
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+	}
+	wake.notify_all();
+}
+
+void ThreadPool::WorkerLoop(unsigned index) {
+	currentPool = this;
+	currentQueue = index;
+	while (true) {
+		if (RunOne()) {
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wake.wait(lock, [this] { return stopping || queued > 0; });
+		if (stopping && queued == 0) {
+			return;
+		}
+	}
+}
+
+TaskGroup::~TaskGroup() {
+	// The tasks reference the group, so it cannot go away before they finish
+	if (pool != nullptr) {
+		pool->HelpUntil([this] { return pending == 0; });
+	}
+}
+
+void TaskGroup::Run(std::function<void()> task) {
+	if (pool == nullptr) {
+		task();
+		return;
+	}
+	pending++;
+	pool->Submit([this, pool = pool, task = std::move(task)] {
+		try {
+			task();
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(errorMutex);
+			if (!error) {
+				error = std::current_exception();
+			}
+		}
+		// The group may be gone once pending is 0, but the pool is not
+		pending--;
+		pool->Notify();
+	});
+}
+
+void TaskGroup::Wait() {
+	if (pool != nullptr) {
+		pool->HelpUntil([this] { return pending == 0; });
+	}
+	if (error) {
+		std::exception_ptr e = error;
+		error = nullptr;
+		std::rethrow_exception(e);
+	}
+}
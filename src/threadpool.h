@@ -0,0 +1,76 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*! \brief A fixed size, work-stealing thread pool
+ * \detail Every worker has a deque of its own. Tasks submitted from a worker go
+ * to the back of its deque, and it takes work from the back, while idle
+ * workers steal from the front of the other deques. Threads outside the pool
+ * share an extra deque. Any thread can help with the queued work through
+ * RunOne, and HelpUntil runs it until a condition holds and sleeps while
+ * there is none, which is how TaskGroup waits without blocking a worker.
+ */
+class ThreadPool {
+public:
+	explicit ThreadPool(unsigned threadCount);
+	~ThreadPool();
+
+	void Submit(std::function<void()> task);
+	//! Run one queued task on the calling thread. Returns false if none was found
+	bool RunOne();
+	/**
+	 * Run queued tasks on the calling thread until done returns true, sleeping
+	 * while there are none
+	 *
+	 * Whatever done depends on must be changed before calling Notify.
+	 */
+	void HelpUntil(const std::function<bool()> &done);
+	//! Wake the threads in HelpUntil, to check whether they are done
+	void Notify();
+	unsigned Size() const {
+		return static_cast<unsigned>(threads.size());
+	}
+
+private:
+	struct taskQueue {
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+	void WorkerLoop(unsigned index);
+	size_t OwnQueue() const;
+	bool Pop(size_t queue, bool back, std::function<void()> &task);
+
+	std::vector<std::unique_ptr<taskQueue>> queues;
+	std::vector<std::thread> threads;
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+	std::atomic<size_t> queued{0};
+	bool stopping = false;
+};
+
+/*! \brief A set of tasks which can be waited for together
+ * \detail Without a pool, Run executes the task immediately, so code written
+ * against a TaskGroup also works serially.
+ */
+class TaskGroup {
+public:
+	explicit TaskGroup(ThreadPool *pool) : pool(pool) {}
+	~TaskGroup();
+
+	void Run(std::function<void()> task);
+	//! Wait for all tasks, and rethrow the first exception one of them threw
+	void Wait();
+
+private:
+	ThreadPool *pool;
+	std::atomic<size_t> pending{0};
+	std::mutex errorMutex;
+	std::exception_ptr error;
+};
@@ -1,11 +1,9 @@
 #pragma once
+#include "specie.h"
+#include "speciesratios.h"
 #include <map>
 #include <string>
 
-#define MAX_DECS 10
-
-using specie = std::string;
-using speciesRatios = std::map<specie, int>;
 using reactionRate = double;
 
 struct reaction {
@@ -1,5 +1,11 @@
+#include "analysis.h"
 #include "driver.h"
+#include "incremental.h"
+#include "modulecache.h"
+#include <filesystem>
+#include <fstream>
 #include <gtest/gtest.h>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 
@@ -1052,6 +1058,56 @@ TEST_F(BasicTest, ScaleRateTestDown) {
 	EXPECT_EQ(drv.Compile(), out);
 }
 
+TEST_F(BasicTest, NestedConditionalScale) {
+	std::string in = "module Move {\n"
+									 "input: x;\n"
+									 "output: z;\n"
+									 "reactions: {\n"
+									 "x -> z;\n"
+									 "2z ->(3) 0;\n"
+									 "}\n"
+									 "}\n"
+									 "module main {\n"
+									 "private: [a, b, c, d];\n"
+									 "output: e;\n"
+									 "compositions: {\n"
+									 "if (a) { scale (2) { if (b) { e = Move(c); } d = Move(e); } }\n"
+									 "}\n"
+									 "}\n";
+
+	std::string out = "#!/usr/bin/env -S crnsimul -e -P -C e\n"
+										"a + b + c ->(2) a + b + e;\n"
+										"a + b + 2e ->(6) a + b;\n"
+										"a + e ->(2) a + d;\n"
+										"a + 2d ->(6) a;\n";
+	driver drv;
+	ASSERT_EQ(drv.parse_string(in), 0);
+	EXPECT_EQ(drv.Compile(), out);
+}
+
+TEST_F(BasicTest, NestedScalesInOrder) {
+	// Each scale multiplies the rates inside it in turn, innermost first, which
+	// rounds differently than multiplying the scales together first
+	std::string in = "module Decay {\n"
+									 "input: x;\n"
+									 "output: z;\n"
+									 "reactions: { x ->(0.6) z; }\n"
+									 "}\n"
+									 "module main {\n"
+									 "private: a;\n"
+									 "output: e;\n"
+									 "compositions: {\n"
+									 "scale (0.00001) { scale (0.6) { e = Decay(a); } }\n"
+									 "}\n"
+									 "}\n";
+
+	std::string out = "#!/usr/bin/env -S crnsimul -e -P -C e\n"
+										"a ->(0.0000036000000000000003) e;\n";
+	driver drv;
+	ASSERT_EQ(drv.parse_string(in), 0);
+	EXPECT_EQ(drv.Compile(), out);
+}
+
 TEST_F(BasicTest, CompErrorTest) {
 	std::string in = "module main {\n"
 									 "private: [a, b, c, d];\n"
@@ -1096,4 +1152,431 @@ TEST_F(BasicTest, MultipleModulesWithSameName) {
 	driver drv;
 	// drv.parse_string(in);
 	EXPECT_THROW(drv.parse_string(in), MultipleModulesWithSameName);
-}
\ No newline at end of file
+}
+TEST_F(BasicTest, ParallelFlattenMatchesSerial) {
+	std::string in = "module Addition {\n"
+									 "input: [x, y];\n"
+									 "private: k;\n"
+									 "output: z;\n"
+									 "concentrations: { k := 3; }\n"
+									 "reactions: { x -> x + z; y + k -> y + k + z; z -> 0; }\n"
+									 "}\n"
+									 "module Twice {\n"
+									 "input: x;\n"
+									 "private: t;\n"
+									 "output: z;\n"
+									 "compositions: { t = Addition(x, x); z = Addition(t, x); }\n"
+									 "}\n"
+									 "module main {\n"
+									 "private: [a, b, c, d, e, f, g];\n"
+									 "output: h;\n"
+									 "concentrations: { a := 5; b := 7; }\n"
+									 "compositions: {\n"
+									 "c = Twice(a);\n"
+									 "d = Addition(a, b);\n"
+									 "if (b) { e = Twice(c); scale (2) { f = Twice(d); g = "
+									 "Addition(e, f); } }\n"
+									 "h = Twice(g);\n"
+									 "}\n"
+									 "}\n";
+
+	driver serial;
+	ASSERT_EQ(serial.parse_string(in), 0);
+	driver parallel;
+	parallel.jobs = 4;
+	ASSERT_EQ(parallel.parse_string(in), 0);
+	EXPECT_EQ(parallel.Compile(), serial.Compile());
+}
+
+TEST_F(BasicTest, ImportOnce) {
+	std::string in = "import tests/chemfiles/include2.chem;\n"
+									 "import tests/chemfiles/include1.chem;\n"
+									 "import tests/../tests/chemfiles/include2.chem;\n"
+									 "module main {\n"
+									 "private: [a, b];\n"
+									 "output: z;\n"
+									 "compositions: { z = Addition(a, b); }\n"
+									 "}";
+
+	std::string out = "#!/usr/bin/env -S crnsimul -e -P -C z\n"
+										"a -> a + z;\n"
+										"b -> b + z;\n"
+										"z -> 0;\n";
+
+	driver drv;
+	ASSERT_EQ(drv.parse_string(in), 0);
+	EXPECT_EQ(drv.Compile(), out);
+}
+
+TEST_F(BasicTest, ImportMissingFile) {
+	std::string in = "import tests/chemfiles/doesnotexist.chem;\n"
+									 "module main {\n"
+									 "private: a;\n"
+									 "}";
+	driver drv;
+	EXPECT_THROW(drv.parse_string(in), std::runtime_error);
+}
+
+TEST_F(BasicTest, ImportCycle) {
+	std::string in = "import tests/chemfiles/cycle1.chem;\n"
+									 "module main {\n"
+									 "private: a;\n"
+									 "output: [b, c];\n"
+									 "compositions: { b = CycleOne(a); c = CycleTwo(a); }\n"
+									 "}";
+
+	std::string out = "#!/usr/bin/env -S crnsimul -e -P -C b,c\n"
+										"a -> a + 2c;\n"
+										"a -> a + b;\n";
+
+	driver drv;
+	ASSERT_EQ(drv.parse_string(in), 0);
+	EXPECT_EQ(drv.Compile(), out);
+}
+
+TEST_F(BasicTest, ImportSeesEarlierImports) {
+	// sibling.chem imports nothing, but uses a module of include1.chem, which is
+	// imported before it
+	std::string in = "import tests/chemfiles/include1.chem;\n"
+									 "import tests/chemfiles/sibling.chem;\n"
+									 "module main {\n"
+									 "private: [a, b];\n"
+									 "output: z;\n"
+									 "compositions: { z = Sum(a, b); }\n"
+									 "}";
+	driver serial;
+	ASSERT_EQ(serial.parse_string(in), 0);
+	std::string out = serial.Compile();
+	EXPECT_NE(out.find("a -> Sum_0_MulAdditions_0_x + a;\n"), std::string::npos);
+	driver parallel;
+	parallel.jobs = 4;
+	ASSERT_EQ(parallel.parse_string(in), 0);
+	EXPECT_EQ(parallel.Compile(), out);
+
+	driver missing;
+	EXPECT_THROW(missing.parse_string("import tests/chemfiles/sibling.chem;\n"
+																		"module main { private: a; }"),
+							 NoSuchModuleException);
+}
+
+TEST_F(BasicTest, ConcurrentImports) {
+	std::string in = "import chemlib/addition.chem;\n"
+									 "import chemlib/multiplication.chem;\n"
+									 "import chemlib/subtraction.chem;\n"
+									 "import tests/chemfiles/include1.chem;\n"
+									 "module main {\n"
+									 "private: [a, b, c, d, e];\n"
+									 "output: z;\n"
+									 "concentrations: { a := 3; b := 4; }\n"
+									 "compositions: {\n"
+									 "c = addition(a, b);\n"
+									 "d = multiplication(c, a);\n"
+									 "e = subtraction(d, b);\n"
+									 "z = MulAdditions(a, b, d, e);\n"
+									 "}\n"
+									 "}";
+
+	driver serial;
+	ASSERT_EQ(serial.parse_string(in), 0);
+	driver parallel;
+	parallel.jobs = 4;
+	ASSERT_EQ(parallel.parse_string(in), 0);
+	EXPECT_EQ(parallel.modules.size(), serial.modules.size());
+	EXPECT_EQ(parallel.Compile(), serial.Compile());
+}
+
+TEST_F(BasicTest, ModuleCache) {
+	std::string dir = ::testing::TempDir() + "chemilang-cache-test";
+	std::filesystem::remove_all(dir);
+	std::string in = "import tests/chemfiles/cached.chem;\n"
+									 "import chemlib/multiplication.chem;\n"
+									 "module main {\n"
+									 "private: [a, b, c];\n"
+									 "output: z;\n"
+									 "concentrations: { a := 3; b := 4; }\n"
+									 "compositions: { c = Gated(a, b); z = multiplication(c, a); }\n"
+									 "}";
+
+	driver plain;
+	ASSERT_EQ(plain.parse_string(in), 0);
+	driver cold;
+	cold.cacheDirectory = dir;
+	ASSERT_EQ(cold.parse_string(in), 0);
+	driver warm;
+	warm.cacheDirectory = dir;
+	ASSERT_EQ(warm.parse_string(in), 0);
+	std::string out = plain.Compile();
+	EXPECT_EQ(cold.Compile(), out);
+	EXPECT_EQ(warm.Compile(), out);
+
+	// The entry is only used for exactly the source it was written for
+	std::string path = std::filesystem::canonical("tests/chemfiles/cached.chem");
+	std::stringstream source;
+	source << std::ifstream(path).rdbuf();
+	driver drv;
+	ASSERT_EQ(drv.parse_file("tests/chemfiles/include2.chem"), 0);
+	CompositionArena arena;
+	ModuleCache cache(dir);
+	ParseContext changed(drv, &arena, path);
+	EXPECT_FALSE(cache.Load(path, source.str() + "\n", changed));
+	EXPECT_TRUE(changed.modules.empty());
+	ParseContext same(drv, &arena, path);
+	ASSERT_TRUE(cache.Load(path, source.str(), same));
+	EXPECT_EQ(same.modules.size(), 2);
+	EXPECT_EQ(same.modules["Gated"].compositions.size(), 2);
+
+	// Damaged entries are parsed again
+	for (const auto &entry : std::filesystem::directory_iterator(dir)) {
+		std::filesystem::resize_file(entry.path(), 20);
+	}
+	driver damaged;
+	damaged.cacheDirectory = dir;
+	ASSERT_EQ(damaged.parse_string(in), 0);
+	EXPECT_EQ(damaged.Compile(), out);
+	std::filesystem::remove_all(dir);
+}
+
+TEST_F(BasicTest, IncrementalRecompile) {
+	std::string dir = ::testing::TempDir() + "chemilang-incremental-test";
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir);
+	std::string lib = "module Addition {\n"
+										"input: [a, b];\n"
+										"output: v;\n"
+										"reactions: { a -> a + v; b -> b + v; v -> 0; }\n"
+										"}\n"
+										"module Twice {\n"
+										"input: x;\n"
+										"private: t;\n"
+										"output: z;\n"
+										"compositions: { t = Addition(x, x); z = Addition(t, x); }\n"
+										"}\n"
+										"module Other {\n"
+										"input: x;\n"
+										"output: z;\n"
+										"reactions: { x -> x + z; }\n"
+										"}\n";
+	std::string main = "import " + dir + "/lib.chem;\n"
+										 "module main {\n"
+										 "private: [a, b, c];\n"
+										 "output: d;\n"
+										 "concentrations: { a := 3; }\n"
+										 "compositions: { b = Twice(a); c = Other(b); d = Twice(c); }\n"
+										 "}\n";
+	auto write = [&](const std::string &name, const std::string &text) {
+		std::ofstream(dir + "/" + name) << text;
+	};
+	auto fresh = [&]() {
+		driver drv;
+		EXPECT_EQ(drv.parse_file(dir + "/main.chem"), 0);
+		return drv.Compile();
+	};
+	write("lib.chem", lib);
+	write("main.chem", main);
+
+	IncrementalCompiler compiler(dir + "/main.chem");
+	std::string out;
+	ASSERT_EQ(compiler.Compile(out), 0);
+	EXPECT_EQ(out, fresh());
+	EXPECT_EQ(compiler.Reflattened(), 3);
+
+	ASSERT_EQ(compiler.Compile(out), 0);
+	EXPECT_EQ(out, fresh());
+	EXPECT_EQ(compiler.Reflattened(), 0);
+
+	// Only main changed, so every submodule is reused
+	main.replace(main.find("a := 3"), 6, "a := 4");
+	write("main.chem", main);
+	ASSERT_EQ(compiler.Compile(out), 0);
+	EXPECT_EQ(out, fresh());
+	EXPECT_EQ(compiler.Reflattened(), 0);
+
+	// Other changed, but Addition and Twice do not depend on it
+	lib.replace(lib.find("x -> x + z"), 10, "x -> x + 2z");
+	write("lib.chem", lib);
+	ASSERT_EQ(compiler.Compile(out), 0);
+	EXPECT_EQ(out, fresh());
+	EXPECT_EQ(compiler.Reflattened(), 1);
+
+	// Addition changed, and Twice composes it
+	lib.replace(lib.find("v -> 0"), 6, "2v -> 0");
+	write("lib.chem", lib);
+	ASSERT_EQ(compiler.Compile(out), 0);
+	EXPECT_EQ(out, fresh());
+	EXPECT_EQ(compiler.Reflattened(), 2);
+
+	int compiles = 0;
+	compiler.Watch([&](int res, const std::string &network) {
+		EXPECT_EQ(res, 0);
+		EXPECT_EQ(network, out);
+		return ++compiles < 1;
+	});
+	EXPECT_EQ(compiles, 1);
+	std::filesystem::remove_all(dir);
+}
+
+TEST_F(BasicTest, AllSemanticErrorsReported) {
+	std::string in = "module first {\n"
+									 "input: a;\n"
+									 "output: b;\n"
+									 "reactions: { a + c -> b; }\n"
+									 "}\n"
+									 "function second {\n"
+									 "input: a;\n"
+									 "output: b;\n"
+									 "reactions: { a -> b; }\n"
+									 "}\n"
+									 "module main {\n"
+									 "private: a;\n"
+									 "concentrations: { a := 1; d := 2; }\n"
+									 "}\n";
+	driver drv;
+	drv.jobs = 4;
+	try {
+		drv.parse_string(in);
+		FAIL() << "Expected SemanticErrorsException";
+	} catch (const SemanticErrorsException &e) {
+		ASSERT_EQ(e.errors.size(), 3);
+		std::string what = e.what();
+		EXPECT_NE(what.find("species c was not declared in module first"),
+							std::string::npos);
+		EXPECT_NE(what.find("Mistake in function second"), std::string::npos);
+		EXPECT_NE(what.find("species d was not declared in module main"),
+							std::string::npos);
+	}
+}
+
+TEST_F(BasicTest, SemanticErrorsOfEveryFileReported) {
+	// The import is parsed on a level before main, and its error does not stop
+	// main from being checked
+	std::string in = "import tests/chemfiles/undeclared.chem;\n"
+									 "module main {\n"
+									 "private: a;\n"
+									 "output: b;\n"
+									 "concentrations: { d := 2; }\n"
+									 "compositions: { b = Leaky(a); }\n"
+									 "}\n";
+	driver drv;
+	try {
+		drv.parse_string(in);
+		FAIL() << "Expected SemanticErrorsException";
+	} catch (const SemanticErrorsException &e) {
+		ASSERT_EQ(e.errors.size(), 2);
+		std::string what = e.what();
+		EXPECT_LT(what.find("species c was not declared in module Leaky"),
+							what.find("species d was not declared in module main"));
+		EXPECT_NE(what.find("species d was not declared in module main"),
+							std::string::npos);
+	}
+}
+
+TEST_F(BasicTest, OptimizerReportsPasses) {
+	std::string in = "import chemlib/link.chem;\n"
+									 "module main {\n"
+									 "private: a;\n"
+									 "output: y;\n"
+									 "compositions: { y = link(a); y = link(a); }\n"
+									 "}";
+	driver plain;
+	ASSERT_EQ(plain.parse_string(in), 0);
+	EXPECT_EQ(plain.Compile(), "#!/usr/bin/env -S crnsimul -e -P -C y\n"
+														 "a -> a + y;\n"
+														 "y -> 0;\n"
+														 "a -> a + y;\n"
+														 "y -> 0;\n");
+
+	driver drv;
+	EXPECT_FALSE(drv.optimizer.EnablePasses("canonicalize,nonexistent"));
+	EXPECT_EQ(drv.optimizer.passes, 0);
+	ASSERT_TRUE(drv.optimizer.EnablePasses("canonicalize"));
+	ASSERT_EQ(drv.parse_string(in), 0);
+	EXPECT_EQ(drv.Compile(), "#!/usr/bin/env -S crnsimul -e -P -C y\n"
+													 "a ->(2) a + y;\n"
+													 "y ->(2) 0;\n");
+	ASSERT_EQ(drv.optimizer.Report().size(), 1);
+	EXPECT_EQ(drv.optimizer.Report()[0].pass, "canonicalize");
+}
+
+TEST_F(BasicTest, DeadReactionsEliminated) {
+	std::string in = "import chemlib/addition.chem;\n"
+									 "import chemlib/link.chem;\n"
+									 "module main {\n"
+									 "private: [a, b, d, q, w];\n"
+									 "output: z;\n"
+									 "concentrations: { a := 3; b := 4; q := 5; w := 1; }\n"
+									 "compositions: { z = addition(a, b); d = link(z); }\n"
+									 "reactions: { 0 -> w; w + z -> 0; q -> d; }\n"
+									 "}";
+	driver drv;
+	drv.optimizer.passes = deadPass;
+	ASSERT_EQ(drv.parse_string(in), 0);
+	EXPECT_EQ(drv.Compile(), "#!/usr/bin/env -S crnsimul -e -P -C z\n"
+													 "a := 3;\n"
+													 "b := 4;\n"
+													 "w := 1;\n"
+													 "0 -> w;\n"
+													 "w + z -> 0;\n"
+													 "a -> a + z;\n"
+													 "b -> b + z;\n"
+													 "z -> 0;\n");
+	ASSERT_EQ(drv.optimizer.Report().size(), 1);
+	EXPECT_EQ(drv.optimizer.Report()[0].summary,
+						"removed 3 reactions, 2 species and 1 concentrations");
+}
+
+TEST_F(BasicTest, LinksFused) {
+	std::string in = "import chemlib/copy.chem;\n"
+									 "import chemlib/link.chem;\n"
+									 "import chemlib/multiplication.chem;\n"
+									 "module main {\n"
+									 "private: [a, b, c, d];\n"
+									 "output: [y, z];\n"
+									 "concentrations: { a := 3; b := 4; }\n"
+									 "compositions: { c = link(a); d = copy(c); z = multiplication(d, b); "
+									 "y = link(b); }\n"
+									 "}";
+	// Fusing changes the dynamics, so -O leaves the links alone
+	EXPECT_EQ(Optimizer::ALL_PASSES & fusePass, 0u);
+	driver optimized;
+	optimized.optimizer.passes = canonicalizePass | deadPass;
+	ASSERT_EQ(optimized.parse_string(in), 0);
+	std::string network = optimized.Compile();
+	EXPECT_NE(network.find("a -> a + c;\n"), std::string::npos);
+	EXPECT_NE(network.find("c ->(100) c + d;\n"), std::string::npos);
+
+	driver drv;
+	drv.optimizer.passes = fusePass;
+	ASSERT_EQ(drv.parse_string(in), 0);
+	EXPECT_EQ(drv.Compile(), "#!/usr/bin/env -S crnsimul -e -P -C y,z\n"
+													 "a := 3;\n"
+													 "b := 4;\n"
+													 "b -> b + y;\n"
+													 "y -> 0;\n"
+													 "a + b -> a + b + z;\n"
+													 "z -> 0;\n");
+	ASSERT_EQ(drv.optimizer.Report().size(), 1);
+	EXPECT_EQ(drv.optimizer.Report()[0].summary, "fused 2 pass-through species");
+	EXPECT_EQ(drv.optimizer.Report()[0].details,
+						std::vector<std::string>({"d = copy(c)", "c = link(a)"}));
+}
+
+TEST_F(BasicTest, ConstantsFolded) {
+	std::string in = "import chemlib/addition.chem;\n"
+									 "import chemlib/multiplication.chem;\n"
+									 "module main {\n"
+									 "private: [a, b, c, d, e, w];\n"
+									 "output: [y, z];\n"
+									 "concentrations: { a := 3; b := 4; d := 7; e := 2; }\n"
+									 "compositions: { c = addition(a, b); z = multiplication(c, b); }\n"
+									 "reactions: { d ->(2) d + y; e + y -> e; w + z -> w; }\n"
+									 "}";
+	driver drv;
+	drv.optimizer.passes = foldPass;
+	ASSERT_EQ(drv.parse_string(in), 0);
+	EXPECT_EQ(drv.Compile(), "#!/usr/bin/env -S crnsimul -e -P -C y,z\n"
+													 "y := 7;\n"
+													 "z := 28;\n");
+	ASSERT_EQ(drv.optimizer.Report().size(), 1);
+	EXPECT_EQ(drv.optimizer.Report()[0].summary,
+						"folded 3 species, removing 8 reactions and 6 constants");
+}
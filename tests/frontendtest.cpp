@@ -1,10 +1,25 @@
 #include "frontend.h"
+#include "batch.h"
+#include "binarynetwork.h"
+#include "compileserver.h"
+#include "crnwriter.h"
+#include "incremental.h"
+#include "matrixexport.h"
+#include "symboltable.h"
 #include "driver.h"
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <gtest/gtest.h>
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
 
 class FrontendTest : public ::testing::Test {
 protected:
@@ -71,3 +86,442 @@ TEST_F(FrontendTest, stringstreamTestNotEqual) {
 	expected.str(out);
 	EXPECT_NE(front.stream.str(), expected.str());
 }
+
+TEST_F(FrontendTest, CompileServerSharesLibraries) {
+	std::string cached = "import tests/chemfiles/cached.chem;\n"
+											 "module main {\n"
+											 "private: [a, b];\n"
+											 "output: z;\n"
+											 "compositions: { z = Gated(a, b); }\n"
+											 "}";
+	// Defines a module with the name of one in a library file it does not import
+	std::string own = "import tests/chemfiles/include2.chem;\n"
+										"module Twice {\n"
+										"input: x;\n"
+										"output: z;\n"
+										"compositions: { z = Addition(x, x); }\n"
+										"}\n"
+										"module main {\n"
+										"private: a;\n"
+										"output: z;\n"
+										"compositions: { z = Twice(a); }\n"
+										"}";
+
+	CompileServer server("");
+	for (const std::string &source : {cached, own, cached}) {
+		driver drv;
+		ASSERT_EQ(drv.parse_string(source), 0);
+		compileRequest request;
+		request.source = source;
+		compileResult result = server.Compile(request);
+		EXPECT_TRUE(result.ok) << result.output;
+		EXPECT_EQ(result.output, drv.Compile());
+	}
+
+	compileRequest broken;
+	broken.source = "module main { private: a; reactions: { a -> ; } }";
+	compileResult result = server.Compile(broken);
+	EXPECT_FALSE(result.ok);
+	EXPECT_NE(result.output.find("syntax error"), std::string::npos);
+}
+
+TEST_F(FrontendTest, CompileServerResolvesPerDirectory) {
+	// A shared library file whose relative import is a different file for each
+	// client directory
+	std::string dir = ::testing::TempDir() + "chemilang-directory-test";
+	std::filesystem::remove_all(dir);
+	for (const char *client : {"one", "two"}) {
+		std::filesystem::create_directories(dir + "/" + client);
+		std::ofstream(dir + "/" + client + "/part.chem")
+				<< "module Part {\n"
+					 "input: x;\n"
+					 "output: y;\n"
+					 "reactions: { x ->(" +
+							 std::string(client == std::string("one") ? "1" : "2") +
+							 ") y; }\n"
+							 "}\n";
+	}
+	std::ofstream(dir + "/wrap.chem") << "import part.chem;\n"
+																			 "module Wrap {\n"
+																			 "input: x;\n"
+																			 "output: y;\n"
+																			 "compositions: { y = Part(x); }\n"
+																			 "}\n";
+	compileRequest request;
+	request.source = "import " + dir +
+									 "/wrap.chem;\n"
+									 "module main {\n"
+									 "private: a;\n"
+									 "output: b;\n"
+									 "compositions: { b = Wrap(a); }\n"
+									 "}";
+
+	CompileServer server("");
+	for (const char *client : {"one", "two", "one"}) {
+		request.workingDirectory = dir + "/" + client;
+		driver drv;
+		drv.baseDirectory = request.workingDirectory;
+		ASSERT_EQ(drv.parse_string(request.source), 0);
+		compileResult result = server.Compile(request);
+		EXPECT_TRUE(result.ok) << result.output;
+		EXPECT_EQ(result.output, drv.Compile()) << "from " << client;
+	}
+	std::filesystem::remove_all(dir);
+}
+
+TEST_F(FrontendTest, CompileServerReclaimsNames) {
+	std::string dir = ::testing::TempDir() + "chemilang-reclaim-test";
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir);
+	std::string lib = dir + "/lib.chem";
+	std::ofstream(lib) << "module Lib {\n"
+												"input: x;\n"
+												"output: y;\n"
+												"reactions: { x -> x + y; y -> 0; }\n"
+												"}\n";
+	auto written = std::filesystem::last_write_time(lib);
+
+	CompileServer server("", true);
+	std::vector<size_t> sizes;
+	for (int i = 0; i < 3; i++) {
+		// Every request rebuilds the library, and uses a name of its own
+		std::filesystem::last_write_time(lib, written + std::chrono::seconds(i));
+		compileRequest request;
+		request.source = "import " + lib +
+										 ";\n"
+										 "module main {\n"
+										 "private: fresh" +
+										 std::to_string(i) +
+										 ";\n"
+										 "output: z;\n"
+										 "compositions: { z = Lib(fresh" +
+										 std::to_string(i) +
+										 "); }\n"
+										 "}";
+		compileResult result = server.Compile(request);
+		EXPECT_TRUE(result.ok) << result.output;
+		EXPECT_NE(result.output.find("fresh" + std::to_string(i) + " -> "),
+							std::string::npos);
+		sizes.push_back(SymbolTable::Global().Size());
+	}
+	// The names of earlier requests are forgotten, so the table does not grow
+	EXPECT_LE(sizes[1], sizes[0]);
+	EXPECT_LE(sizes[2], sizes[0]);
+	std::filesystem::remove_all(dir);
+}
+
+TEST_F(FrontendTest, CompileServerSocket) {
+	std::string socketPath = ::testing::TempDir() + "chemilang-test.sock";
+	compileRequest request;
+	request.source = "import chemlib/addition.chem;\n"
+									 "module main {\n"
+									 "private: [a, b];\n"
+									 "output: c;\n"
+									 "concentrations: { a := 2; b := 3; }\n"
+									 "compositions: { c = addition(a, b); }\n"
+									 "}";
+	request.workingDirectory = std::filesystem::current_path().string();
+	compileResult result;
+	EXPECT_FALSE(CompileRemote(socketPath, request, result));
+
+	CompileServer server(socketPath);
+	std::thread serving([&server] { server.Serve(); });
+	bool connected = false;
+	for (int i = 0; i < 500 && !connected; i++) {
+		connected = CompileRemote(socketPath, request, result);
+		if (!connected) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+	}
+	ASSERT_TRUE(connected);
+	driver drv;
+	ASSERT_EQ(drv.parse_string(request.source), 0);
+	EXPECT_TRUE(result.ok);
+	EXPECT_EQ(result.output, drv.Compile());
+
+	// More clients than connections served at once, which wait their turn
+	std::vector<std::thread> clients;
+	std::vector<compileResult> results(CompileServer::MAX_CONNECTIONS + 4);
+	for (auto &res : results) {
+		clients.emplace_back([&] { CompileRemote(socketPath, request, res); });
+	}
+	for (auto &client : clients) {
+		client.join();
+	}
+	for (const auto &res : results) {
+		EXPECT_EQ(res.output, result.output);
+	}
+
+	// A client that never finishes its request does not keep the server up
+	int idle = socket(AF_UNIX, SOCK_STREAM, 0);
+	sockaddr_un addr{};
+	addr.sun_family = AF_UNIX;
+	std::strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+	ASSERT_EQ(connect(idle, reinterpret_cast<const sockaddr *>(&addr),
+										sizeof(addr)),
+						0);
+	ASSERT_EQ(send(idle, "chemilang", 9, 0), 9);
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	auto stopped = std::chrono::steady_clock::now();
+	server.Stop();
+	serving.join();
+	EXPECT_LT(std::chrono::steady_clock::now() - stopped,
+						std::chrono::seconds(CompileServer::RECEIVE_TIMEOUT_SECONDS));
+	close(idle);
+	EXPECT_FALSE(std::filesystem::exists(socketPath));
+}
+
+TEST_F(FrontendTest, BatchCompile) {
+	std::string dir = ::testing::TempDir() + "chemilang-batch-test";
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir + "/out");
+	std::vector<std::string> sources;
+	for (int i = 0; i < 6; i++) {
+		sources.push_back("import chemlib/addition.chem;\n"
+											"import tests/chemfiles/cached.chem;\n"
+											"module main {\n"
+											"private: [a, b, c];\n"
+											"output: z;\n"
+											"concentrations: { a := " +
+											std::to_string(i + 1) +
+											"; }\n"
+											"compositions: { c = addition(a, b); z = Gated(c, b); }\n"
+											"}");
+		std::ofstream(dir + "/design" + std::to_string(i) + ".chem") << sources[i];
+	}
+	std::ofstream(dir + "/broken.chem") << "module main { private: a; }\n}";
+	std::ofstream(dir + "/list.txt") << "# Every design\n"
+																	 "design0.chem\n"
+																	 "design1.chem named.crn\n"
+																	 "\n"
+																	 "broken.chem\n";
+
+	std::vector<batchItem> items = ReadManifest(dir + "/list.txt", dir + "/out");
+	ASSERT_EQ(items.size(), 3);
+	EXPECT_EQ(items[0].output, dir + "/out/design0.crn");
+	EXPECT_EQ(items[1].output, dir + "/named.crn");
+	for (int i = 2; i < 6; i++) {
+		std::string input = dir + "/design" + std::to_string(i) + ".chem";
+		items.push_back({input, BatchOutputName(input, "")});
+	}
+	EXPECT_EQ(items.back().output, dir + "/design5.crn");
+
+	std::ostringstream diagnostics;
+	EXPECT_EQ(CompileBatch(items, 4, diagnostics), 1);
+	EXPECT_EQ(diagnostics.str().find(dir + "/broken.chem:\n"), 0);
+	for (const auto &item : items) {
+		if (item.input.find("design") == std::string::npos) {
+			EXPECT_FALSE(std::filesystem::exists(item.output));
+			continue;
+		}
+		driver drv;
+		ASSERT_EQ(drv.parse_file(item.input), 0);
+		std::stringstream written;
+		written << std::ifstream(item.output).rdbuf();
+		EXPECT_EQ(written.str(), drv.Compile());
+	}
+	std::filesystem::remove_all(dir);
+}
+
+TEST_F(FrontendTest, OptimizationForwarded) {
+	std::string dir = ::testing::TempDir() + "chemilang-passes-test";
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir);
+	std::string source = "module main {\n"
+											 "private: [a, b];\n"
+											 "output: z;\n"
+											 "concentrations: { a := 2; }\n"
+											 "reactions: { a -> z; a -> z; b -> 0; }\n"
+											 "}";
+	std::string input = dir + "/design.chem";
+	std::ofstream(input) << source;
+	driver drv;
+	drv.optimizer.passes = Optimizer::ALL_PASSES;
+	ASSERT_EQ(drv.parse_string(source), 0);
+	std::string optimized = drv.Compile();
+	std::string report = FormatReport(drv.optimizer.Report());
+	ASSERT_NE(report, "");
+
+	compileRequest request;
+	request.source = source;
+	request.passes = Optimizer::ALL_PASSES;
+	compileRequest decoded;
+	ASSERT_TRUE(CompileServer::DecodeRequest(CompileServer::EncodeRequest(request),
+																					 decoded));
+	EXPECT_EQ(decoded.passes, Optimizer::ALL_PASSES);
+	std::string socketPath = ::testing::TempDir() + "chemilang-passes.sock";
+	CompileServer server(socketPath);
+	std::thread serving([&server] { server.Serve(); });
+	compileResult result;
+	bool connected = false;
+	for (int i = 0; i < 500 && !connected; i++) {
+		connected = CompileRemote(socketPath, request, result);
+		if (!connected) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+	}
+	server.Stop();
+	serving.join();
+	ASSERT_TRUE(connected);
+	EXPECT_TRUE(result.ok);
+	EXPECT_EQ(result.output, optimized);
+	EXPECT_EQ(result.report, report);
+
+	std::ostringstream diagnostics;
+	std::vector<batchItem> items{{input, dir + "/design.crn"}};
+	EXPECT_EQ(CompileBatch(items, 1, diagnostics, Optimizer::ALL_PASSES), 0);
+	std::stringstream written;
+	written << std::ifstream(dir + "/design.crn").rdbuf();
+	EXPECT_EQ(written.str(), optimized);
+	EXPECT_EQ(diagnostics.str(), input + ":\n" + report);
+
+	IncrementalCompiler compiler(input, "", 1, Optimizer::ALL_PASSES);
+	std::string network;
+	ASSERT_EQ(compiler.Compile(network), 0);
+	EXPECT_EQ(network, optimized);
+	EXPECT_EQ(compiler.Report(), report);
+	std::filesystem::remove_all(dir);
+}
+
+TEST_F(FrontendTest, BinaryNetworkRoundTrip) {
+	std::string dir = ::testing::TempDir() + "chemilang-binary-test";
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir);
+	std::string in = "import chemlib/addition.chem;\n"
+									 "import tests/chemfiles/cached.chem;\n"
+									 "module main {\n"
+									 "private: [a, b, c];\n"
+									 "output: [z, c];\n"
+									 "concentrations: { a := 3; b := 12; }\n"
+									 "compositions: { c = addition(a, b); z = Gated(c, b); }\n"
+									 "reactions: { 0 ->(0.25) a; 3z -> 0; }\n"
+									 "}";
+	driver drv;
+	Frontend front;
+	ASSERT_EQ(drv.parse_string(in), 0);
+	front.drv = &drv;
+	front.format = binaryFormat;
+	front.verbose = false;
+	front.outputFileName = dir + "/main.crnb";
+	front.WriteFile();
+
+	driver text;
+	ASSERT_EQ(text.parse_string(in), 0);
+	std::string expected = text.Compile();
+	{
+		BinaryNetwork network(dir + "/main.crnb");
+		EXPECT_EQ(network.Header().outputCount, 2);
+		EXPECT_EQ(network.SpecieName(network.outputs[0]), "z");
+		EXPECT_EQ(network.Header().reactionCount,
+							std::count(expected.begin(), expected.end(), '>'));
+		std::string decoded;
+		{
+			CrnWriter writer(decoded);
+			network.WriteText(writer);
+		}
+		EXPECT_EQ(decoded, expected);
+	}
+	Frontend decoder;
+	decoder.verbose = false;
+	decoder.outputFileName = dir + "/main.crn";
+	decoder.DecodeFile(dir + "/main.crnb");
+	std::stringstream written;
+	written << std::ifstream(dir + "/main.crn").rdbuf();
+	EXPECT_EQ(written.str(), expected);
+	// Decoding onto the binary network itself is refused, leaving it intact
+	decoder.outputFileName = dir + "/../" +
+													 std::filesystem::path(dir).filename().string() +
+													 "/main.crnb";
+	EXPECT_THROW(decoder.DecodeFile(dir + "/main.crnb"), WriteFailedException);
+
+	std::string data;
+	{
+		std::stringstream bytes;
+		bytes << std::ifstream(dir + "/main.crnb").rdbuf();
+		data = bytes.str();
+	}
+	EXPECT_THROW(BinaryNetwork(data.data(), data.size() - 1),
+							 BadNetworkFileException);
+	data[0] ^= 1;
+	EXPECT_THROW(BinaryNetwork(data.data(), data.size()), BadNetworkFileException);
+	std::filesystem::remove_all(dir);
+}
+
+TEST_F(FrontendTest, MatrixExport) {
+	std::string dir = ::testing::TempDir() + "chemilang-matrix-test";
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir);
+	std::string in = "module main {\n"
+									 "private: [x, y];\n"
+									 "output: z;\n"
+									 "concentrations: { x := 5; }\n"
+									 "reactions: { 2x + y ->(0.5) y + z; z -> 0; x -> x; }\n"
+									 "}";
+	auto read = [](const std::string &fileName) {
+		std::stringstream content;
+		content << std::ifstream(fileName).rdbuf();
+		return content.str();
+	};
+	driver drv;
+	Frontend front;
+	ASSERT_EQ(drv.parse_string(in), 0);
+	front.drv = &drv;
+	front.verbose = false;
+	front.matrixFormat = "mm";
+	front.outputFileName = dir + "/main.crn";
+	front.WriteFile();
+	EXPECT_EQ(read(dir + "/main.stoichiometry.mtx"),
+						"%%MatrixMarket matrix coordinate integer general\n"
+						"% Net change of each specie in each reaction\n"
+						"% Row i is specie i - 1 and column j is reaction j - 1 in the "
+						"index\n"
+						"3 3 3\n"
+						"1 1 -2\n"
+						"3 1 1\n"
+						"3 2 -1\n");
+	EXPECT_EQ(read(dir + "/main.orders.mtx"),
+						"%%MatrixMarket matrix coordinate integer general\n"
+						"% Order of each reaction in each of its reactants\n"
+						"% Row i is specie i - 1 and column j is reaction j - 1 in the "
+						"index\n"
+						"3 3 4\n"
+						"1 1 2\n"
+						"2 1 1\n"
+						"3 2 1\n"
+						"1 3 1\n");
+	EXPECT_EQ(read(dir + "/main.rates.mtx"),
+						"%%MatrixMarket matrix array real general\n"
+						"% Rate constant of each reaction\n"
+						"3 1\n"
+						"0.5\n"
+						"1\n"
+						"1\n");
+	EXPECT_EQ(read(dir + "/main.index"), "# species\n"
+																			 "0 x\n"
+																			 "1 y\n"
+																			 "2 z\n"
+																			 "# reactions\n"
+																			 "0 2x + y ->(0.5) y + z\n"
+																			 "1 z -> 0\n"
+																			 "2 x -> x\n");
+
+	std::string csr;
+	{
+		CrnWriter writer(csr);
+		MatrixExporter(drv.modules.at("main")).WriteCsr(writer);
+	}
+	csrMatricesHeader header;
+	ASSERT_GE(csr.size(), sizeof header);
+	std::memcpy(&header, csr.data(), sizeof header);
+	EXPECT_EQ(header.magic, CSR_MATRICES_MAGIC);
+	EXPECT_EQ(header.speciesCount, 3);
+	EXPECT_EQ(header.reactionCount, 3);
+	EXPECT_EQ(header.stoichiometryCount, 3);
+	EXPECT_EQ(header.orderCount, 4);
+	std::vector<std::uint32_t> orderOffsets(4);
+	size_t offset = sizeof header + 3 * sizeof(double) + 4 * 4 + 3 * 4 + 3 * 4;
+	EXPECT_EQ(csr.size(), offset + 4 * 4 + 4 * 4 + 4 * 4);
+	std::memcpy(orderOffsets.data(), csr.data() + offset, 4 * 4);
+	EXPECT_EQ(orderOffsets, std::vector<std::uint32_t>({0, 2, 3, 4}));
+	std::filesystem::remove_all(dir);
+}
@@ -1,5 +1,6 @@
 #include "module.h"
 #include "driver.h"
+#include "optimizer.h"
 #include <gtest/gtest.h>
 #include <iostream>
 #include <string>
@@ -72,6 +73,7 @@ TEST_F(ModuleTest, SpecieNotDeclaredConcentrations) {
 }
 
 TEST_F(ModuleTest, ApplyCompositionsTest) {
+	CompositionArena arena;
 	Module a;
 	a.inputSpecies.push_back("x");
 	a.inputSpecies.push_back("y");
@@ -111,7 +113,7 @@ TEST_F(ModuleTest, ApplyCompositionsTest) {
 		inputMap.insert(std::make_pair("y", "y"));
 		speciesMapping outputMap;
 		outputMap.insert(std::make_pair("z", "o"));
-		auto c = new ModuleComposition(&a, inputMap, outputMap);
+		auto c = arena.Make<ModuleComposition>(&a, inputMap, outputMap);
 		main.compositions.push_back(c);
 	}
 
@@ -122,7 +124,7 @@ TEST_F(ModuleTest, ApplyCompositionsTest) {
 		inputMap.insert(std::make_pair("y", "o"));
 		speciesMapping outputMap;
 		outputMap.insert(std::make_pair("z", "v"));
-		auto c = new ModuleComposition(&a, inputMap, outputMap);
+		auto c = arena.Make<ModuleComposition>(&a, inputMap, outputMap);
 		main.compositions.push_back(c);
 	}
 
@@ -233,6 +235,7 @@ TEST_F(ModuleTest, ReactionRateTrailingZeros) {
 }
 
 TEST_F(ModuleTest, InputConcException) {
+	CompositionArena arena;
 	Module a;
 	a.inputSpecies.push_back("x");
 	a.outputSpecies.push_back("z");
@@ -261,7 +264,7 @@ TEST_F(ModuleTest, InputConcException) {
 		inputMap.insert(std::make_pair("x", "x"));
 		speciesMapping outputMap;
 		outputMap.insert(std::make_pair("z", "z"));
-		auto c = new ModuleComposition(&a, inputMap, outputMap);
+		auto c = arena.Make<ModuleComposition>(&a, inputMap, outputMap);
 		main.compositions.push_back(c);
 	}
 
@@ -380,6 +383,35 @@ TEST_F(ModuleTest, BadFunctionModule) {
 	driver drv;
 	EXPECT_THROW(drv.parse_string(input), SpecieNotDeclaredException);
 }
+TEST_F(ModuleTest, AnalyzeFindsEveryError) {
+	Module m;
+	m.name = "funcm";
+	m.isFunction = true;
+	m.inputSpecies.push_back("x");
+	m.outputSpecies.push_back("y");
+	m.concentrations.insert(std::make_pair("x", 1));
+	// Undeclared species are reported once, however often they are used
+	for (int i = 0; i < 3; i++) {
+		speciesRatios leftSide;
+		leftSide.insert(std::make_pair("x", 1));
+		leftSide.insert(std::make_pair("u", 1));
+		speciesRatios rightSide;
+		rightSide.insert(std::make_pair("y", 1));
+		rightSide.insert(std::make_pair("q", 1));
+		m.reactions.push_back({leftSide, rightSide, 1});
+	}
+
+	std::vector<std::exception_ptr> errors = m.Analyze();
+	ASSERT_EQ(errors.size(), 4);
+	EXPECT_THROW(std::rethrow_exception(errors[0]), InputSpecieConcException);
+	EXPECT_THROW(std::rethrow_exception(errors[1]), SpecieNotDeclaredException);
+	EXPECT_THROW(std::rethrow_exception(errors[2]), SpecieNotDeclaredException);
+	EXPECT_THROW(std::rethrow_exception(errors[3]),
+							 FunctionIncorrectReactionsException);
+	// Checking the function does not add the inputs to the products
+	EXPECT_EQ(m.reactions[0].products.size(), 2);
+}
+
 /*
  * Also commented out as per issue #72
 TEST_F(ModuleTest, FunctionTestInputSpeciesVariantPresence) {
@@ -413,4 +445,155 @@ TEST_F(ModuleTest, TestNumberPrint) {
 	EXPECT_EQ(precision::to_string(10), "10");
 	EXPECT_EQ(precision::to_string(100), "100");
 	EXPECT_EQ(precision::to_string(1.00), "1");
+	EXPECT_EQ(precision::to_string(1e-12), "0.000000000001");
+	EXPECT_EQ(precision::to_string(0.1), "0.1");
+	EXPECT_EQ(precision::to_string(2.00001), "2.00001");
+}
+
+TEST_F(ModuleTest, WriterSpansBuffer) {
+	std::string out;
+	{
+		CrnWriter writer(out);
+		for (int i = 0; i < 100000; i++) {
+			writer.WriteInt(i);
+			writer.Write(';');
+		}
+	}
+	EXPECT_EQ(out.substr(0, 8), "0;1;2;3;");
+	EXPECT_EQ(out.substr(out.size() - 6), "99999;");
+}
+
+TEST_F(ModuleTest, SpeciesRatiosSpill) {
+	speciesRatios ratios;
+	for (int i = 0; i < 10; i++) {
+		ratios.insert(std::make_pair("spill" + std::to_string(i), i + 1));
+	}
+	EXPECT_EQ(ratios.size(), 10);
+	EXPECT_FALSE(ratios.insert(std::make_pair("spill3", 100)).second);
+	EXPECT_EQ(ratios.at("spill3"), 4);
+	speciesRatios copy = ratios;
+	EXPECT_EQ(copy, ratios);
+	EXPECT_THROW(ratios.at("spillmissing"), std::out_of_range);
+}
+
+TEST_F(ModuleTest, OutputOrderedByName) {
+	Module m;
+	m.name = "main";
+	// Interned in reverse order, so ids do not follow the names
+	m.privateSpecies.emplace_back("orderzz");
+	m.privateSpecies.emplace_back("orderaa");
+
+	{
+		speciesRatios leftSide;
+		leftSide.insert(std::make_pair("orderzz", 1));
+		leftSide.insert(std::make_pair("orderaa", 1));
+		speciesRatios rightSide;
+		reaction r = {leftSide, rightSide, 1};
+		m.reactions.push_back(r);
+	}
+
+	m.concentrations.insert(std::make_pair("orderzz", 1));
+	m.concentrations.insert(std::make_pair("orderaa", 2));
+
+	std::string output = "\norderaa := 2;\n"
+											 "orderzz := 1;\n"
+											 "orderaa + orderzz -> 0;\n";
+
+	EXPECT_EQ(m.Compile(), output);
+}
+
+TEST_F(ModuleTest, FlattenIsMemoized) {
+	std::string input = "module inner {\n"
+											"input: x;\n"
+											"private: p;\n"
+											"output: y;\n"
+											"concentrations: { p := 2; }\n"
+											"reactions: { x + p -> x + p + y; y -> 0; }\n"
+											"}\n"
+											"module outer {\n"
+											"input: x;\n"
+											"private: q;\n"
+											"output: y;\n"
+											"compositions: { q = inner(x); y = inner(q); }\n"
+											"}\n"
+											"module main {\n"
+											"private: [a, b, c];\n"
+											"output: d;\n"
+											"compositions: { b = outer(a); c = outer(b); d = outer(c); }\n"
+											"}\n";
+	driver drv;
+	ASSERT_EQ(drv.parse_string(input), 0);
+	drv.Compile();
+	Module &outer = drv.modules.at("outer");
+	const ModuleTemplate &flat = outer.Flatten();
+	EXPECT_EQ(&flat, &outer.Flatten());
+	EXPECT_EQ(flat.reactions.size(), 4);
+	EXPECT_EQ(drv.modules.at("main").reactions.size(), 12);
+	EXPECT_EQ(drv.modules.at("main").concentrations.at("outer_2_inner_1_p"), 2);
+}
+
+namespace {
+struct countingComposition : public Composition {
+	countingComposition(int &destroyed, std::pmr::memory_resource *resource)
+			: destroyed(destroyed) {}
+	~countingComposition() override {
+		destroyed++;
+	}
+	void ApplyComposition(std::string moduleName, int compositionNumber,
+												std::map<specie, int> &concOut,
+												std::vector<reaction> &reactionOut,
+												std::vector<specie> &specieOut,
+												const compositionContext &context,
+												ThreadPool *pool) override {}
+	void AddSubModules(std::vector<Module *> &out) const override {}
+	void Serialize(CacheWriter &out) const override {}
+	int &destroyed;
+};
+} // namespace
+
+TEST_F(ModuleTest, ArenaReleasesCompositions) {
+	int destroyed = 0;
+	{
+		CompositionArena arena;
+		for (int i = 0; i < 1000; i++) {
+			arena.Make<countingComposition>(destroyed);
+		}
+		EXPECT_EQ(arena.Size(), 1000);
+		arena.Release();
+		EXPECT_EQ(destroyed, 1000);
+		EXPECT_EQ(arena.Size(), 0);
+		arena.Make<countingComposition>(destroyed);
+	}
+	EXPECT_EQ(destroyed, 1001);
+}
+
+TEST_F(ModuleTest, CanonicalizeMergesDuplicates) {
+	Module m;
+	m.name = "main";
+	m.privateSpecies = {"x", "y", "c"};
+	auto add = [&m](std::vector<std::pair<std::string, int>> lhs,
+									std::vector<std::pair<std::string, int>> rhs, double rate) {
+		reaction r;
+		for (const auto &ratio : lhs) {
+			r.reactants.insert(ratio);
+		}
+		for (const auto &ratio : rhs) {
+			r.products.insert(ratio);
+		}
+		r.rate = rate;
+		m.reactions.push_back(r);
+	};
+	add({{"x", 1}}, {{"x", 1}, {"y", 1}}, 1);
+	add({{"y", 1}}, {}, 1);
+	add({{"c", 1}, {"x", 1}}, {{"c", 1}, {"x", 1}}, 5);
+	add({{"x", 1}}, {{"y", 1}, {"x", 1}}, 2);
+	add({{"y", 1}, {"c", 0}}, {}, 0.5);
+	add({{"x", 1}}, {{"c", 1}}, 0);
+
+	passResult result = CanonicalizeReactions(m);
+	EXPECT_EQ(result.summary,
+						"merged 2 duplicate reactions, dropped 2 no-op reactions");
+	EXPECT_EQ(m.Compile(), "\n"
+												 "x ->(3) x + y;\n"
+												 "y ->(1.5) 0;\n");
 }
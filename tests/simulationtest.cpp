@@ -0,0 +1,359 @@
+#include "codegen.h"
+#include "crnwriter.h"
+#include "driver.h"
+#include "ensemble.h"
+#include "kinetics.h"
+#include "random.h"
+#include "simulation.h"
+#include "sparselu.h"
+#include "stochastic.h"
+#include "threadpool.h"
+#include <cmath>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+class SimulationTest : public ::testing::Test {
+protected:
+	void SetUp() override {}
+
+	void TearDown() override {}
+
+	//! The observed species at every sample of the network compiled from in
+	std::vector<std::vector<double>> Samples(
+			const std::string &in, const simulationOptions &options,
+			simulationStats *stats = nullptr) {
+		driver drv;
+		EXPECT_EQ(drv.parse_string(in), 0);
+		KineticNetwork network(drv.PrepareMain());
+		std::vector<std::vector<double>> samples;
+		simulationStats res = RunSimulation(
+				network, options, [&](double time, const double *state) {
+					std::vector<double> row{time};
+					for (auto s : network.observed) {
+						row.push_back(state[s]);
+					}
+					samples.push_back(row);
+				});
+		if (stats != nullptr) {
+			*stats = res;
+		}
+		return samples;
+	}
+};
+
+TEST_F(SimulationTest, NetworkLowered) {
+	driver drv;
+	ASSERT_EQ(drv.parse_string("module main {\n"
+														 "private: [x, y];\n"
+														 "output: z;\n"
+														 "concentrations: { x := 5; y := 2; }\n"
+														 "reactions: { 2x + y ->(0.5) y + z; z -> 0; }\n"
+														 "}"),
+						0);
+	KineticNetwork network(drv.PrepareMain());
+	EXPECT_EQ(network.names, std::vector<std::string>({"x", "y", "z"}));
+	EXPECT_EQ(network.initialState, std::vector<double>({5, 2, 0}));
+	EXPECT_EQ(network.observed, std::vector<std::uint32_t>({2}));
+	double state[] = {5, 2, 0};
+	EXPECT_DOUBLE_EQ(network.Propensity(0, state), 0.5 * 25 * 2);
+	double derivative[3];
+	network.Derivative(state, derivative);
+	EXPECT_DOUBLE_EQ(derivative[0], -50);
+	EXPECT_DOUBLE_EQ(derivative[1], 0);
+	EXPECT_DOUBLE_EQ(derivative[2], 25);
+}
+
+TEST_F(SimulationTest, ExplicitMatchesExactSolution) {
+	// z follows 3 (1 - e^-t), and d decays as 4 e^-2t
+	std::string in = "import chemlib/link.chem;\n"
+									 "module main {\n"
+									 "private: a;\n"
+									 "output: [z, d];\n"
+									 "concentrations: { a := 3; d := 4; }\n"
+									 "compositions: { z = link(a); }\n"
+									 "reactions: { d ->(2) 0; }\n"
+									 "}";
+	simulationOptions options;
+	options.endTime = 5;
+	options.samples = 10;
+	simulationStats stats;
+	auto samples = Samples(in, options, &stats);
+	ASSERT_EQ(samples.size(), 11);
+	for (const auto &row : samples) {
+		double t = row[0];
+		EXPECT_NEAR(row[1], 3 * (1 - std::exp(-t)), 1e-5) << "at " << t;
+		EXPECT_NEAR(row[2], 4 * std::exp(-2 * t), 1e-5) << "at " << t;
+	}
+	EXPECT_DOUBLE_EQ(samples.back()[0], 5);
+	EXPECT_GT(stats.steps, 0);
+}
+
+TEST_F(SimulationTest, JacobianMatchesDerivative) {
+	driver drv;
+	ASSERT_EQ(drv.parse_string("module main {\n"
+														 "private: [x, y];\n"
+														 "output: z;\n"
+														 "concentrations: { x := 5; y := 2; }\n"
+														 "reactions: { 2x + y ->(0.5) y + z; z -> 0; 0 -> x; }\n"
+														 "}"),
+						0);
+	KineticNetwork network(drv.PrepareMain());
+	// Every row has its diagonal, and x and y in the rows the first reaction
+	// changes
+	EXPECT_EQ(network.jacobianOffsets, std::vector<std::uint32_t>({0, 2, 3, 6}));
+	EXPECT_EQ(network.jacobianColumns,
+						std::vector<std::uint32_t>({0, 1, 1, 0, 1, 2}));
+	double state[] = {5, 2, 3};
+	std::vector<double> values(network.jacobianColumns.size());
+	network.Jacobian(state, values.data());
+	// Central differences are exact for these polynomials of degree two
+	for (std::uint32_t column = 0; column < 3; column++) {
+		double plus[3] = {5, 2, 3};
+		double minus[3] = {5, 2, 3};
+		plus[column] += 0.5;
+		minus[column] -= 0.5;
+		double up[3];
+		double down[3];
+		network.Derivative(plus, up);
+		network.Derivative(minus, down);
+		for (std::uint32_t row = 0; row < 3; row++) {
+			double expected = up[row] - down[row];
+			double actual = 0;
+			for (auto e = network.jacobianOffsets[row];
+					 e < network.jacobianOffsets[row + 1]; e++) {
+				if (network.jacobianColumns[e] == column) {
+					actual = values[e];
+				}
+			}
+			EXPECT_DOUBLE_EQ(actual, expected) << row << ", " << column;
+		}
+	}
+}
+
+TEST_F(SimulationTest, NativeKernelsMatchInterpreter) {
+	driver drv;
+	ASSERT_EQ(drv.parse_string("import chemlib/copy.chem;\n"
+														 "module main {\n"
+														 "private: [x, y, c];\n"
+														 "output: z;\n"
+														 "concentrations: { x := 5; y := 2; }\n"
+														 "compositions: { c = copy(x); }\n"
+														 "reactions: { 3c + y ->(0.25) y + z; "
+														 "z ->(30000000000000000000000.0) 0; }\n"
+														 "}"),
+						0);
+	KineticNetwork network(drv.PrepareMain());
+	std::string source;
+	{
+		CrnWriter writer(source);
+		WriteNativeKernels(network, writer);
+	}
+	EXPECT_NE(source.find("extern \"C\" void chemilang_rhs"), std::string::npos);
+	// Too large for an integer literal, which fixed notation would write
+	EXPECT_NE(source.find("3e+22 * x["), std::string::npos);
+
+	std::unique_ptr<NativeKernels> kernels;
+	try {
+		kernels = std::make_unique<NativeKernels>(network);
+	} catch (const NativeCompileException &e) {
+		GTEST_SKIP() << e.what();
+	}
+	std::vector<double> state{1.5, 5, 2, 0.5};
+	const std::size_t entries = network.jacobianColumns.size();
+	std::vector<double> derivative(4), propensities(4), jacobian(entries);
+	network.Derivative(state.data(), derivative.data());
+	network.Propensities(state.data(), propensities.data());
+	network.Jacobian(state.data(), jacobian.data());
+	network.UseNative(*kernels);
+	std::vector<double> nativeDerivative(4), nativePropensities(4),
+			nativeJacobian(entries);
+	network.Derivative(state.data(), nativeDerivative.data());
+	network.Propensities(state.data(), nativePropensities.data());
+	network.Jacobian(state.data(), nativeJacobian.data());
+	for (std::size_t i = 0; i < 4; i++) {
+		EXPECT_DOUBLE_EQ(nativeDerivative[i], derivative[i]);
+		EXPECT_DOUBLE_EQ(nativePropensities[i], propensities[i]);
+	}
+	for (std::size_t e = 0; e < entries; e++) {
+		EXPECT_DOUBLE_EQ(nativeJacobian[e], jacobian[e]);
+	}
+}
+
+TEST_F(SimulationTest, SparseLUOrdersAgainstFill) {
+	// An arrow matrix fills in completely when its dense row and column are
+	// eliminated first, and not at all when they are eliminated last
+	std::vector<std::uint32_t> offsets{0, 4, 6, 8, 10};
+	std::vector<std::uint32_t> columns{0, 1, 2, 3, 0, 1, 0, 2, 0, 3};
+	std::vector<double> values{4, 1, 1, 1, 1, 3, 1, 3, 1, 3};
+	SparseLU lu(offsets, columns);
+	EXPECT_EQ(lu.FactorEntries(), columns.size());
+	ASSERT_TRUE(lu.Factorize(values.data()));
+	// The solution of the matrix times (1, 2, 3, 4)
+	double b[] = {4 + 2 + 3 + 4, 1 + 6, 1 + 9, 1 + 12};
+	lu.Solve(b);
+	for (int i = 0; i < 4; i++) {
+		EXPECT_NEAR(b[i], i + 1, 1e-12);
+	}
+	values[0] = 0;
+	values[5] = 0;
+	EXPECT_FALSE(lu.Factorize(values.data()));
+}
+
+TEST_F(SimulationTest, RosenbrockSolvesStiffNetwork) {
+	// a decays a hundred thousand times faster than b, which follows
+	// 3 k / (k - 1) (e^-t - e^-kt)
+	std::string in = "module main {\n"
+									 "private: a;\n"
+									 "output: b;\n"
+									 "concentrations: { a := 3; }\n"
+									 "reactions: { a ->(100000) b; b -> 0; }\n"
+									 "}";
+	simulationOptions options;
+	options.endTime = 10;
+	options.samples = 10;
+	simulationStats explicitStats;
+	Samples(in, options, &explicitStats);
+	options.method = rosenbrockMethod;
+	simulationStats stats;
+	auto samples = Samples(in, options, &stats);
+	ASSERT_EQ(samples.size(), 11);
+	for (const auto &row : samples) {
+		double t = row[0];
+		double k = 100000;
+		double exact = 3 * k / (k - 1) * (std::exp(-t) - std::exp(-k * t));
+		EXPECT_NEAR(row[1], exact, 1e-4) << "at " << t;
+	}
+	EXPECT_LT(stats.steps * 100, explicitStats.steps);
+}
+
+TEST_F(SimulationTest, RandomStreamMatchesPhilox) {
+	// The known answer of Philox4x32-10 for a zero key and counter
+	RandomStream random(0, 0);
+	EXPECT_EQ(random.Next(), 0xe169c58d6627e8d5);
+	EXPECT_EQ(random.Next(), 0x9b00dbd8bc57ac4c);
+	RandomStream other(0, 1);
+	EXPECT_NE(other.Next(), 0xe169c58d6627e8d5);
+}
+
+TEST_F(SimulationTest, NextReactionSimulatesCounts) {
+	// x and y trade 50 molecules, and z is born and dies, averaging 5
+	std::string in = "module main {\n"
+									 "output: [x, y, z];\n"
+									 "concentrations: { x := 50; }\n"
+									 "reactions: { x -> y; y -> x; 0 ->(5) z; z -> 0; }\n"
+									 "}";
+	driver drv;
+	ASSERT_EQ(drv.parse_string(in), 0);
+	KineticNetwork network(drv.PrepareMain());
+	DependencyGraph dependencies(network);
+	EXPECT_EQ(dependencies.offsets, std::vector<std::uint32_t>({0, 1, 2, 3, 3}));
+	EXPECT_EQ(dependencies.reactions, std::vector<std::uint32_t>({1, 0, 3}));
+
+	simulationOptions options;
+	options.endTime = 500;
+	options.samples = 5000;
+	options.method = ssaMethod;
+	options.seed = 42;
+	simulationStats stats;
+	auto samples = Samples(in, options, &stats);
+	ASSERT_EQ(samples.size(), 5001);
+	double total = 0;
+	for (const auto &row : samples) {
+		EXPECT_EQ(row[1] + row[2], 50);
+		EXPECT_GE(row[1], 0);
+		EXPECT_GE(row[2], 0);
+		EXPECT_EQ(row[3], std::floor(row[3]));
+		EXPECT_GE(row[3], 0);
+		total += row[3];
+	}
+	EXPECT_NEAR(total / samples.size(), 5, 0.5);
+	EXPECT_GT(stats.steps, 0);
+
+	EXPECT_EQ(Samples(in, options), samples);
+	options.seed = 43;
+	EXPECT_NE(Samples(in, options), samples);
+}
+
+TEST_F(SimulationTest, TauLeapingStaysNonNegative) {
+	// x decays from 10000, so at time 1 it is binomial with mean 10000 / e and
+	// a standard deviation below 50, and y runs out of its 20 molecules
+	std::string in = "module main {\n"
+									 "output: [x, y];\n"
+									 "concentrations: { x := 10000; y := 20; }\n"
+									 "reactions: { x -> 0; y ->(2) 0; }\n"
+									 "}";
+	simulationOptions options;
+	options.endTime = 10;
+	options.samples = 10;
+	options.method = ssaMethod;
+	simulationStats exact;
+	Samples(in, options, &exact);
+	options.method = tauLeapingMethod;
+	simulationStats stats;
+	auto samples = Samples(in, options, &stats);
+	ASSERT_EQ(samples.size(), 11);
+	EXPECT_NEAR(samples[1][1], 10000 * std::exp(-1), 250);
+	for (const auto &row : samples) {
+		EXPECT_GE(row[1], 0);
+		EXPECT_GE(row[2], 0);
+		EXPECT_EQ(row[2], std::floor(row[2]));
+	}
+	EXPECT_EQ(samples.back()[2], 0);
+	EXPECT_LT(stats.steps * 10, exact.steps);
+}
+
+TEST_F(SimulationTest, EnsembleReproducibleOnAnyThreads) {
+	// z is born at rate 10 and dies, so it is Poisson distributed with mean
+	// 10 (1 - e^-t) at every time t
+	driver drv;
+	ASSERT_EQ(drv.parse_string("module main {\n"
+														 "private: a;\n"
+														 "output: z;\n"
+														 "concentrations: { a := 2; }\n"
+														 "reactions: { a ->(5) a + z; z -> 0; }\n"
+														 "}"),
+						0);
+	KineticNetwork network(drv.PrepareMain());
+	simulationOptions options;
+	options.endTime = 4;
+	options.samples = 4;
+	options.method = ssaMethod;
+	EnsembleStatistics serial(5, 1);
+	RunEnsemble(network, options, 2000, nullptr, serial);
+	ThreadPool pool(4);
+	EnsembleStatistics parallel(5, 1);
+	ensembleStats stats = RunEnsemble(network, options, 2000, &pool, parallel);
+
+	ASSERT_EQ(parallel.Count(), 2000);
+	// Only trajectories close behind the earliest unfinished one are held
+	EXPECT_LE(stats.peakBuffered, 2 * pool.Size());
+	for (std::size_t s = 0; s < 5; s++) {
+		double mean = 10 * (1 - std::exp(-double(s)));
+		EXPECT_NEAR(serial.Mean(s, 0), mean, 0.3) << "at " << s;
+		EXPECT_NEAR(serial.Variance(s, 0), mean, 1) << "at " << s;
+		EXPECT_EQ(serial.Mean(s, 0), parallel.Mean(s, 0));
+		EXPECT_EQ(serial.Variance(s, 0), parallel.Variance(s, 0));
+		for (std::size_t q = 0; q < EnsembleStatistics::QUANTILE_COUNT; q++) {
+			EXPECT_EQ(serial.Quantile(s, 0, q), parallel.Quantile(s, 0, q));
+		}
+	}
+	EXPECT_NEAR(serial.Quantile(4, 0, 1), 10, 1);
+	EXPECT_LT(serial.Quantile(4, 0, 0), serial.Quantile(4, 0, 2));
+}
+
+TEST_F(SimulationTest, QuantileEstimatorTracksDistribution) {
+	QuantileEstimator median(0.5);
+	QuantileEstimator tail(0.9);
+	median.Add(3);
+	EXPECT_EQ(median.Value(), 3);
+	RandomStream random(1, 0);
+	for (int i = 0; i < 10000; i++) {
+		double u = random.Uniform();
+		median.Add(u);
+		tail.Add(u);
+	}
+	EXPECT_NEAR(median.Value(), 0.5, 0.02);
+	EXPECT_NEAR(tail.Value(), 0.9, 0.02);
+}